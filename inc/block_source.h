@@ -0,0 +1,185 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// A place in the decompressed stream where decoding can restart without
+// replaying what came before. Which fields matter depends on the codec.
+// -----------------------------------------------------------------------------
+struct AccessPoint {
+  uint64_t uoff  = 0;  // decompressed offset of the point
+  uint64_t coff  = 0;  // compressed offset (bytes; bits for bzip2)
+  uint32_t block = 0;  // xz/bzip2 block or zstd frame number
+  uint8_t  bits  = 0;  // gzip: bits of byte coff-1 still to be consumed
+  std::vector<unsigned char> window; // gzip: up to 32 KiB of prior output
+};
+
+// -----------------------------------------------------------------------------
+// Producer of decompressed byte blocks for ArchiveByteReader. next() hands
+// out the next block; its memory stays valid until the following next()
+// call or destruction of the source.
+// -----------------------------------------------------------------------------
+class BlockSource {
+public:
+  virtual ~BlockSource() {}
+
+  // Returns false at end of stream or on error (see failed()).
+  virtual bool next(const unsigned char** p, size_t* n) = 0;
+
+  // True if the input is compressed, i.e. worth decoding ahead.
+  virtual bool compressed() const { return false; }
+
+  bool failed() const { return failed_; }
+  const std::string& error() const { return err_; }
+
+  // Ask the source to append access points at least 'span' decompressed
+  // bytes apart to 'v' as it goes. A point is appended no later than the
+  // next() call that returns the byte at its offset. Sources that cannot
+  // restart mid-stream ignore this.
+  void record_points(std::vector<AccessPoint>* v, uint64_t span) {
+    points_ = v; span_ = span;
+  }
+
+protected:
+  bool fail(const std::string& e) { failed_ = true; err_ = e; return false; }
+
+  bool want_point(uint64_t uoff) const {
+    return points_ && (points_->empty() || uoff >= points_->back().uoff + span_);
+  }
+
+  bool failed_ = false;
+  std::string err_;
+
+  std::vector<AccessPoint>* points_ = nullptr;
+  uint64_t span_ = 0;
+};
+
+// -----------------------------------------------------------------------------
+// Read-only mapping of a whole input file.
+// -----------------------------------------------------------------------------
+class MappedFile {
+public:
+  MappedFile() {}
+  ~MappedFile() { close(); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool open(const std::string& path);
+  void close();
+
+  // Tell the kernel the mapping is read front to back from 'off' (larger
+  // read-ahead, pages dropped behind), and optionally that it should be
+  // backed by huge pages where the filesystem supports it.
+  void advise(uint64_t off, bool huge_pages) const;
+
+  const unsigned char* data() const { return p_; }
+  size_t size() const { return n_; }
+
+private:
+  const unsigned char* p_ = nullptr;
+  size_t n_ = 0;
+};
+
+// -----------------------------------------------------------------------------
+// Uncompressed input straight from a mapping, optionally from an offset.
+// The rest of the file is handed out as one block, so the decoder reads
+// the page cache directly; only while recording access points is it cut
+// into slices.
+// -----------------------------------------------------------------------------
+class MmapSource : public BlockSource {
+public:
+  static constexpr size_t kSliceBytes = 1 << 20;
+
+  bool open(const std::string& path, uint64_t off = 0, bool huge_pages = false);
+  bool next(const unsigned char** p, size_t* n) override;
+
+  // False if the file starts with a compression or tar signature, i.e.
+  // is not a bare trace whatever its name says.
+  bool plain() const;
+
+private:
+  MappedFile mf_;
+  uint64_t pos_ = 0;
+};
+
+// -----------------------------------------------------------------------------
+// libarchive: raw, compressed and tar inputs.
+// -----------------------------------------------------------------------------
+class LibarchiveSource : public BlockSource {
+public:
+  ~LibarchiveSource() override { close(); }
+
+  bool open(const std::string& path, bool force_raw);
+  // Decode a bare stream held in memory owned by the caller, using only
+  // the given ARCHIVE_FILTER_* (no bidding, which can misfire on data
+  // that merely looks compressed).
+  bool open_memory(const void* p, size_t n, int filter);
+  bool next(const unsigned char** p, size_t* n) override;
+  bool compressed() const override { return filter_ != 0; }
+
+  // libarchive's ARCHIVE_FILTER_* code of the outermost filter, and whether
+  // the stream is a bare compressed file rather than a container.
+  int  filter() const { return filter_; }
+  bool raw() const { return raw_; }
+
+private:
+  struct archive* a_ = nullptr;
+  int  filter_ = 0;
+  bool raw_ = true;
+
+  bool open_with(const std::string& path, bool raw_only);
+  bool next_entry();
+  bool fail_archive(const char* where);
+  void close();
+};
+
+// -----------------------------------------------------------------------------
+// Runs another source on a producer thread. Decoded blocks are coalesced
+// into a bounded ring of slots and handed over through a lock-free SPSC
+// queue; either side parks on a condition variable only when the ring is
+// full (backpressure) or empty. End of stream and errors travel through the
+// ring as a final state.
+// -----------------------------------------------------------------------------
+class PrefetchSource : public BlockSource {
+public:
+  static constexpr size_t kSlots     = 8;
+  static constexpr size_t kSlotBytes = 1 << 20;
+
+  explicit PrefetchSource(std::unique_ptr<BlockSource> inner);
+  ~PrefetchSource() override;
+
+  bool next(const unsigned char** p, size_t* n) override;
+  bool compressed() const override { return true; }
+
+private:
+  struct Slot {
+    std::vector<unsigned char> data;
+    size_t len = 0;
+  };
+
+  std::unique_ptr<BlockSource> inner_;
+  std::vector<Slot> slots_;
+
+  // head_: slots published by the producer; tail_: slots released by the
+  // consumer. The consumer holds slot tail_ while its data is in use.
+  std::atomic<uint64_t> head_{0}, tail_{0};
+  std::atomic<bool> done_{false}, stop_{false};
+  bool holding_ = false;
+
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::atomic<int> sleepers_{0};
+
+  std::thread th_;
+
+  void produce();
+  template<class Pred> void wait_until(Pred pred);
+  void wake();
+};
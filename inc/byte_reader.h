@@ -2,10 +2,42 @@
 #include <string>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
+#include "block_source.h"
+
+// Who decompresses bare .gz/.xz/.bz2/.zst inputs. NATIVE uses zlib,
+// liblzma, libbz2 and libzstd directly and leaves tar containers and
+// other formats to libarchive; LIBARCHIVE sends everything through it.
+enum class Backend { NATIVE, LIBARCHIVE };
+
+// TraceReader's PC -> static-decode cache, off unless asked for. VERIFY
+// also cracks every cached record the long way and stops on the first
+// difference.
+enum class PcCacheMode { OFF, ON, VERIFY };
+
+// Reader knobs threaded down from the command line.
+struct ReaderOpts {
+  bool force_raw = false; // skip libarchive container probing
+  bool prefetch  = true;  // decompress ahead on a producer thread
+  // The input is expected to be a bare, uncompressed trace (set from the
+  // path by Converter); it is mapped instead of streamed through
+  // libarchive, unless its first bytes say otherwise.
+  bool plain = false;
+  bool huge_pages = false; // huge-page hint for that mapping
+  Backend backend = Backend::NATIVE;
+  // Threads for block-parallel .xz/.bz2 decoding; 0 = one per core,
+  // 1 = serial libarchive path.
+  unsigned decomp_threads = 0;
+  // Checkpoint index used by TraceReader::seek(); empty = "<input>.cbpidx"
+  // when that exists.
+  std::string index;
+  PcCacheMode pc_cache = PcCacheMode::OFF;
+};
 
 // Minimal streaming byte reader over raw/compressed/tar inputs via libarchive.
-// Presents a simple read(void*, size) and eof() interface like istream::read.
+// Presents a simple read(void*, size) and eof() interface like istream::read,
+// plus a zero-copy peek/consume interface for decoders.
 class ArchiveByteReader {
 public:
   ArchiveByteReader() {}
@@ -14,26 +46,97 @@ public:
   // Open any of: raw, .gz, .xz, .bz2, .zst, .tar, .tar.{gz,xz,bz2,zst}
   // Returns true on success.
   bool open(const std::string& path, bool force_raw = false);
+  bool open(const std::string& path, const ReaderOpts& opts);
+
+  // Read from an already positioned source whose first byte sits at
+  // decompressed offset 'base'.
+  bool open(std::unique_ptr<BlockSource> src, uint64_t base, bool prefetch);
 
   // Read exactly 'n' bytes into dst, unless EOF occurs earlier.
   // Returns number of bytes copied (0 only at EOF).
   size_t read(void* dst, size_t n);
 
+  // Zero-copy access. Returns a pointer to the next 'n' bytes without
+  // consuming them, or nullptr if fewer than 'n' bytes remain. The pointer
+  // aims straight into libarchive's decompressed block; only a span that
+  // crosses a block boundary is gathered into the staging buffer. Valid
+  // until the next peek/consume/read.
+  const unsigned char* peek(size_t n) {
+    if (stage_pos_ == stage_.size() && blk_sz_ - pos_ >= n) return blk_ + pos_;
+    return peek_slow(n);
+  }
+
+  // Skip up to 'n' bytes; returns the number skipped.
+  uint64_t skip(uint64_t n);
+
+  // Decompressed offset of the next byte to be read.
+  uint64_t tell() const {
+    return base_ + pos_ - (stage_.size() - stage_pos_);
+  }
+
+  // Drop 'n' bytes previously made visible by peek().
+  void consume(size_t n) {
+    if (stage_pos_ == stage_.size()) { pos_ += n; return; }
+    consume_slow(n);
+  }
+
+  // Contiguous bytes readable at the current position without fetching or
+  // staging; '*p' receives their address.
+  size_t contiguous(const unsigned char** p) const {
+    if (stage_pos_ < stage_.size()) {
+      *p = stage_.data() + stage_pos_;
+      return stage_.size() - stage_pos_;
+    }
+    *p = blk_ + pos_;
+    return blk_sz_ - pos_;
+  }
+
+  // Hand out everything buffered at the current position (staged bytes
+  // first, then the rest of the current block) and consume it. Fetches a
+  // new block when nothing is buffered. Returns false at EOF.
+  bool next_block(const unsigned char** p, size_t* n);
+
   // True iff no more bytes will be produced from this source.
-  bool eof() const { return eof_; }
+  bool eof() const {
+    return eof_ && stage_pos_ == stage_.size() && pos_ >= blk_sz_;
+  }
+
+  // True if the source stopped on a read/decompression error.
+  bool failed() const { return src_ && src_->failed(); }
+  const std::string& error() const {
+    static const std::string none;
+    return src_ ? src_->error() : none;
+  }
 
   void close();
 
 private:
-  struct archive* a_ = nullptr;
+  std::unique_ptr<BlockSource> src_;
   bool eof_ = true;
 
-  // Decompressed block buffered from libarchive
-  std::vector<unsigned char> buf_;
-  size_t pos_ = 0; // read offset within buf_
+  // Current decompressed block, owned by the source and valid until the
+  // next BlockSource::next() call.
+  const unsigned char* blk_ = nullptr;
+  size_t blk_sz_ = 0;
+  size_t pos_ = 0; // read offset within blk_
+  uint64_t base_ = 0; // decompressed offset of blk_[0]
+
+  // Staging for spans that straddle blocks; bytes [stage_pos_, size())
+  // logically precede blk_ + pos_.
+  std::vector<unsigned char> stage_;
+  size_t stage_pos_ = 0;
+
+  const unsigned char* peek_slow(size_t n);
+  void consume_slow(size_t n);
 
-  bool next_entry();
   bool fill(); // fetch next data block when buffer is empty
-  bool fail(const char* where);
-};
+  void reset_state(uint64_t base);
 
+  std::unique_ptr<BlockSource> open_plain(const std::string& path,
+                                          bool huge_pages);
+  bool open_native(const std::string& path, const ReaderOpts& opts);
+  std::unique_ptr<BlockSource> open_parallel_xz(const std::string& path,
+                                                unsigned threads);
+  std::unique_ptr<BlockSource> open_parallel_bz2(const std::string& path,
+                                                 unsigned threads);
+};
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include "trace_reader.h"
+
+// -----------------------------------------------------------------------------
+// CBP binary form of one instruction: the macro record TraceReader::
+// readInstr() consumes, rebuilt from the pieces it was cracked into.
+// Re-reading the record yields the same pieces. What cracking throws
+// away comes back in its simplest form: input values, inputs past the
+// third, a store's register-offset flag where no piece tells, and the
+// remainder of a memory size that does not split evenly.
+// -----------------------------------------------------------------------------
+
+// Longest record encode_cbp_record() can produce.
+static constexpr size_t kMaxCbpRecord = TraceReader::kMaxRecordBytes;
+
+// True if the 'n' pieces of one instruction make a record that reads
+// back: one class throughout, apart from a trailing base-register
+// update, and for memory ops a size on every piece that adds up to at
+// most 255 bytes and splits evenly over a store's values. Otherwise
+// false, with a short reason in '*why'.
+bool cbp_encodable(const db_t* pieces, size_t n, const char** why);
+
+// Encode the 'n' pieces of one instruction, in order, at 'out' (room for
+// kMaxCbpRecord bytes); they must pass cbp_encodable(). Returns the end.
+unsigned char* encode_cbp_record(const db_t* pieces, size_t n,
+                                 unsigned char* out);
@@ -0,0 +1,114 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "block_source.h"
+
+class ArchiveWriter;
+
+// -----------------------------------------------------------------------------
+// Columnar CBP (.cbpc). A trace is cut into blocks of kBlockInstrs
+// records, and each block into streams that are predicted and
+// compressed on their own:
+//
+//   pc      PC against the one the previous record leads to
+//   shape   class, memory size and flags, register lists; a per-block
+//           dictionary, referenced as "same as last time at this PC"
+//           or by number
+//   tkn     taken flags of branches
+//   target  taken targets, against the last one at this PC
+//   ea      effective addresses, against last + stride at this PC
+//   val     output values, against the last one in the same slot at
+//           this PC
+//   hi      upper halves of non-integer outputs, likewise
+//
+// Numbers are zigzag LEB128. Every stream then goes through zstd, or
+// deflate in builds without libzstd. Blocks share no state, and a footer
+// lists each block's file offset, first instruction and decoded offset,
+// so a reader can start at any block. Decoding gives back the CBP
+// records byte for byte.
+//
+// File: "CBPC", u32 version, blocks, footer entries, then the trailer
+// { u64 footer offset, u64 blocks, u64 instrs, u64 decoded bytes,
+// "CBPCEND\0" }. Fields are host-endian like the CBP trace itself.
+// -----------------------------------------------------------------------------
+namespace cbpc {
+
+static constexpr uint32_t kBlockInstrs = 1 << 20;
+
+struct BlockInfo {
+  uint64_t off   = 0;    // file offset of the block
+  uint64_t instr = 0;    // instructions before it
+  uint64_t uoff  = 0;    // decoded (CBP) offset of its first record
+};
+
+// True if 'path' starts with the .cbpc magic.
+bool sniff(const std::string& path);
+
+} // namespace cbpc
+
+// -----------------------------------------------------------------------------
+// Builds a .cbpc stream from CBP records and writes it to an (uncompressed)
+// ArchiveWriter.
+// -----------------------------------------------------------------------------
+class CbpcWriter {
+public:
+  // 'level' < 0 picks the default.
+  explicit CbpcWriter(ArchiveWriter& w, int level = -1);
+  ~CbpcWriter();
+  CbpcWriter(const CbpcWriter&) = delete;
+  CbpcWriter& operator=(const CbpcWriter&) = delete;
+
+  // One record, in the layout TraceReader::readInstr() consumes. False
+  // if it is malformed or the output failed.
+  bool add(const unsigned char* rec, size_t n);
+
+  // Write the last block and the footer.
+  bool finish();
+
+  uint64_t instrs() const { return instrs_; }
+  uint64_t bytes()  const { return bytes_; }
+
+private:
+  struct Block;
+  ArchiveWriter& w_;
+  int level_;
+  std::unique_ptr<Block> blk_;
+  std::vector<cbpc::BlockInfo> index_;
+  uint64_t instrs_ = 0, bytes_ = 0, uoff_ = 0;
+
+  bool flush_block();
+  bool out(const void* p, size_t n);
+};
+
+// -----------------------------------------------------------------------------
+// Decoded CBP records of a .cbpc file, one block per next(). Can start at
+// any block (AccessPoint::block) and records block starts as access
+// points.
+// -----------------------------------------------------------------------------
+class CbpcSource : public BlockSource {
+public:
+  CbpcSource();
+  ~CbpcSource() override;
+
+  bool open(const std::string& path, const AccessPoint* at = nullptr);
+  bool next(const unsigned char** p, size_t* n) override;
+  bool compressed() const override { return true; }
+
+  const std::vector<cbpc::BlockInfo>& blocks() const { return index_; }
+  uint64_t instrs() const { return instrs_; }
+  uint64_t bytes()  const { return bytes_; }
+
+private:
+  struct State;
+  MappedFile mf_;
+  std::unique_ptr<State> st_;
+  std::vector<cbpc::BlockInfo> index_;
+  uint64_t instrs_ = 0, bytes_ = 0, footer_ = 0;
+  size_t next_ = 0;                // block to decode next
+  std::vector<unsigned char> rows_;
+
+  bool decode(size_t b);
+};
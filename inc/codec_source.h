@@ -0,0 +1,138 @@
+#pragma once
+#include "block_source.h"
+
+struct z_stream_s;
+
+// -----------------------------------------------------------------------------
+// gzip via raw zlib inflate over a mapped file. Handles concatenated
+// members and can start at an access point recorded by an earlier pass:
+// deflate block boundaries with the preceding 32 KiB window, as in zlib's
+// zran example.
+// -----------------------------------------------------------------------------
+class GzipSource : public BlockSource {
+public:
+  static constexpr size_t kOutBytes = 1 << 20;
+  static constexpr size_t kWindow   = 32768;
+
+  GzipSource();
+  ~GzipSource() override;
+
+  // Start at the beginning of the file, or at 'at' if given.
+  bool open(const std::string& path, const AccessPoint* at = nullptr);
+  bool next(const unsigned char** p, size_t* n) override;
+  bool compressed() const override { return true; }
+
+private:
+  MappedFile mf_;
+  std::unique_ptr<z_stream_s> zs_;
+  bool     init_ = false;
+  bool     done_ = false;
+  uint64_t in_pos_ = 0;    // mapping bytes handed to zlib so far
+  uint64_t uoff_ = 0;      // decompressed bytes produced so far
+  std::vector<unsigned char> out_;
+
+  // Ring of the last kWindow output bytes, kept only while recording.
+  std::vector<unsigned char> win_;
+  uint64_t win_fill_ = 0;
+
+  bool feed();
+  bool next_member();
+  void remember(const unsigned char* p, size_t n);
+  void add_point();
+};
+
+// -----------------------------------------------------------------------------
+// zstd, one frame at a time. Frames are found by walking frame and block
+// headers, so a multi-frame file can be entered at any frame.
+// -----------------------------------------------------------------------------
+class ZstdFrameSource : public BlockSource {
+public:
+  bool open(const std::string& path, const AccessPoint* at = nullptr);
+  bool next(const unsigned char** p, size_t* n) override;
+  bool compressed() const override { return true; }
+
+  // Size of the frame at 'p' (at most 'n' bytes), 0 if malformed.
+  // '*skippable' tells whether it is a skippable frame.
+  static size_t frame_size(const unsigned char* p, size_t n, bool* skippable);
+
+private:
+  MappedFile mf_;
+  std::unique_ptr<LibarchiveSource> cur_;
+  uint64_t pos_ = 0;     // compressed offset of the next frame
+  uint64_t uoff_ = 0;
+  uint32_t frame_ = 0;
+};
+
+// -----------------------------------------------------------------------------
+// Compression of a file as named by its first bytes.
+// -----------------------------------------------------------------------------
+enum class StreamCodec { NONE, GZIP, XZ, BZIP2, ZSTD };
+
+StreamCodec sniff_codec(const std::string& path);
+
+// -----------------------------------------------------------------------------
+// Whole-file streaming decoders over a mapped file, straight on the codec
+// library rather than through libarchive's filter chain. Concatenated
+// streams are decoded back to back, as the command line tools do.
+// -----------------------------------------------------------------------------
+class XzSource : public BlockSource {
+public:
+  static constexpr size_t kOutBytes = 1 << 20;
+
+  XzSource();
+  ~XzSource() override;
+
+  bool open(const std::string& path);
+  bool next(const unsigned char** p, size_t* n) override;
+  bool compressed() const override { return true; }
+
+private:
+  struct State;
+  MappedFile mf_;
+  std::unique_ptr<State> st_;
+  bool done_ = false;
+  std::vector<unsigned char> out_;
+};
+
+class Bz2Source : public BlockSource {
+public:
+  static constexpr size_t kOutBytes = 1 << 20;
+
+  Bz2Source();
+  ~Bz2Source() override;
+
+  bool open(const std::string& path);
+  bool next(const unsigned char** p, size_t* n) override;
+  bool compressed() const override { return true; }
+
+private:
+  struct State;
+  MappedFile mf_;
+  std::unique_ptr<State> st_;
+  bool done_ = false;
+  uint64_t in_pos_ = 0;   // mapping bytes handed to libbz2 so far
+  std::vector<unsigned char> out_;
+
+  bool feed();
+  bool next_stream();
+};
+
+#ifdef CBP_HAVE_ZSTD
+class ZstdSource : public BlockSource {
+public:
+  static constexpr size_t kOutBytes = 1 << 20;
+
+  ZstdSource();
+  ~ZstdSource() override;
+
+  bool open(const std::string& path);
+  bool next(const unsigned char** p, size_t* n) override;
+  bool compressed() const override { return true; }
+
+private:
+  struct State;
+  MappedFile mf_;
+  std::unique_ptr<State> st_;
+  std::vector<unsigned char> out_;
+};
+#endif
@@ -1,10 +1,12 @@
 #pragma once
 #include <string>
 #include <cstdint>
+#include "byte_reader.h"
 
 // Formats & compression 
 enum class BaseFmt {
   CBP_BIN,   // <none> or .cbp
+  CBPC,      // .cbpc (columnar CBP)
   CBP_TEXT,  // .txt
   NDJSON,    // .jsonl
   ASM,       // .asm (output-only)
@@ -19,14 +21,43 @@ struct FileSpec {
   std::string path; // original path
   BaseFmt     fmt = BaseFmt::UNKNOWN;
   Comp        comp = Comp::NONE;
+  bool        tar  = false; // .tar between the format and compression
+};
+
+// Tuning knobs from the command line; defaults reproduce plain behavior.
+struct ConvertOpts {
+  ReaderOpts rd;       // input side
+  // Instruction window [skip, end) of the input; records before 'skip'
+  // are stepped over without being decoded.
+  uint64_t skip = 0;
+  uint64_t end  = ~0ULL;
+  // Shards converted in parallel; 1 = serial, 0 = one per core.
+  unsigned threads = 1;
+  // Output compression level; < 0 = the codec's default.
+  int level = -1;
+  // Threads formatting records (serial conversion only; shards format
+  // their own); 1 = in line, 0 = one per core.
+  unsigned format_threads = 1;
+  // Threads compressing the output; 1 = in line, 0 = one per core.
+  unsigned compress_threads = 1;
+  // Submit output writes through io_uring instead of a writer thread.
+  bool io_uring = false;
+  // .memh: also write the EA and value sidecars next to the output.
+  bool memh_sidecars = false;
 };
 
 struct ConvertPlan {
   FileSpec  in;
   FileSpec  out;
   uint64_t  limit = 0; // 0 = unlimited
+  ConvertOpts opt;
 };
 
+// Rough number of pieces 'plan' will write, from --limit, the window or
+// the trace's index; 0 when there is nothing to go on. Used to size the
+// output ahead of time.
+uint64_t estimate_pieces(const ConvertPlan& plan);
+
 // Single-class converter 
 class Converter {
 public:
@@ -42,21 +73,39 @@ public:
 
   const char* fmt_name(BaseFmt f) const;
 
+  // Formats open_records() can read.
+  static bool has_reader(BaseFmt f);
+
   // Compose a plan from input/output paths + limit
   ConvertPlan make_plan(const std::string& in_path,
                         const std::string& out_path,
-                        uint64_t limit = 0) const;
+                        uint64_t limit = 0,
+                        const ConvertOpts& opt = ConvertOpts()) const;
 
   bool convert(const ConvertPlan& plan, std::string* err);
   bool convert(const std::string& in_path,
                const std::string& out_path,
                uint64_t limit,
                std::string* err);
+  bool convert(const std::string& in_path,
+               const std::string& out_path,
+               uint64_t limit,
+               const ConvertOpts& opt,
+               std::string* err);
 
-  // Perform CBP(binary) -> FORMAT conversion
+  // Perform INPUT -> FORMAT conversion (any format with a reader)
   // Returns false and fills *err on validation/dispatch failure.
   bool cbp_to_text(const ConvertPlan& plan, std::string* err);
   bool cbp_to_asm (const ConvertPlan& plan, std::string* err);
+  bool cbp_to_ndjson(const ConvertPlan& plan, std::string* err);
+  bool cbp_to_cbp (const ConvertPlan& plan, std::string* err);
+  bool cbp_to_cbpc(const ConvertPlan& plan, std::string* err);
+  bool cbp_to_memh(const ConvertPlan& plan, std::string* err);
+
+  // Write a checkpoint index for 'trace' to 'idx_path' (empty = the
+  // "<trace>.cbpidx" sidecar), one checkpoint per ~'span' decoded bytes.
+  bool build_index(const std::string& trace, const std::string& idx_path,
+                   uint64_t span, std::string* err);
 
 private:
   // Helpers
@@ -66,7 +115,7 @@ private:
   // pops .gz/.xz/.bz2/.zst
   Comp     parse_comp_suffix(std::string& stem) const;
 
-  // pops .cbp/.txt/.jsonl/.asm/.stf/.memh
+  // pops .cbpc/.cbp/.txt/.jsonl/.json/.asm/.stf/.memh
   BaseFmt  parse_base_ext(std::string& stem) const;
 
   bool case_insensitive_ext_ = true;
@@ -0,0 +1,94 @@
+#pragma once
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// -----------------------------------------------------------------------------
+// Small in-place formatting helpers shared by the text and asm writers.
+// Each writes at 'p', which must have room, and returns the new end; no
+// terminator is written.
+// -----------------------------------------------------------------------------
+
+// Append a string literal (without its terminator).
+template<size_t N>
+static inline char* put(char* p, const char (&s)[N]) {
+  std::memcpy(p, s, N - 1);
+  return p + N - 1;
+}
+
+static inline char* put(char* p, const char* s) {
+  const size_t n = std::strlen(s);
+  std::memcpy(p, s, n);
+  return p + n;
+}
+
+static inline char* put_dec(char* p, uint64_t x) {
+  return std::to_chars(p, p + 20, x).ptr;
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// The 8 nibbles of 'v' as hex digits, most significant first in memory:
+// spread one nibble per byte, then add '0' or 'a'-10 ('A'-10) without
+// branching.
+template<bool Upper>
+static inline uint64_t hex8(uint32_t v) {
+  constexpr uint64_t kAlpha = (Upper ? 'A' : 'a') - '0' - 10;
+  uint64_t x = v;
+  x = ((x & 0xFFFF0000ULL) << 16) | (x & 0x0000FFFFULL);
+  x = ((x & 0x0000FF000000FF00ULL) << 8) | (x & 0x000000FF000000FFULL);
+  x = ((x & 0x00F000F000F000F0ULL) << 4) | (x & 0x000F000F000F000FULL);
+  const uint64_t alpha = ((x + 0x0606060606060606ULL) >> 4) & 0x0101010101010101ULL;
+  x += 0x3030303030303030ULL + alpha * kAlpha;
+  return __builtin_bswap64(x);
+}
+
+// hex, no leading zeros (except single 0)
+template<bool Upper>
+static inline char* put_hex_case(char* p, uint64_t x) {
+  char digits[16];
+  const uint64_t hi = hex8<Upper>(uint32_t(x >> 32));
+  const uint64_t lo = hex8<Upper>(uint32_t(x));
+  std::memcpy(digits, &hi, 8);
+  std::memcpy(digits + 8, &lo, 8);
+  const int n = x ? (67 - __builtin_clzll(x)) >> 2 : 1;
+  std::memcpy(p, digits + 16 - n, size_t(n));
+  return p + n;
+}
+#else
+template<bool Upper>
+static inline char* put_hex_case(char* p, uint64_t x) {
+  char* e = std::to_chars(p, p + 16, x, 16).ptr;
+  if (Upper)
+    for (char* q = p; q != e; ++q)
+      if (*q >= 'a') *q = char(*q - 'a' + 'A');
+  return e;
+}
+#endif
+
+static inline char* put_hex(char* p, uint64_t x)    { return put_hex_case<false>(p, x); }
+static inline char* put_hex_uc(char* p, uint64_t x) { return put_hex_case<true>(p, x); }
+
+// Always 16 lowercase hex digits.
+static inline char* put_hex16(char* p, uint64_t x) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  const uint64_t hi = hex8<false>(uint32_t(x >> 32));
+  const uint64_t lo = hex8<false>(uint32_t(x));
+  std::memcpy(p, &hi, 8);
+  std::memcpy(p + 8, &lo, 8);
+#else
+  for (int i = 15; i >= 0; --i, x >>= 4) p[i] = "0123456789abcdef"[x & 15];
+#endif
+  return p + 16;
+}
+
+// Always 8 lowercase hex digits.
+static inline char* put_hex8(char* p, uint32_t x) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  const uint64_t d = hex8<false>(x);
+  std::memcpy(p, &d, 8);
+#else
+  for (int i = 7; i >= 0; --i, x >>= 4) p[i] = "0123456789abcdef"[x & 15];
+#endif
+  return p + 8;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "io_archive.h"
+#include "record_source.h"
+#include "trace_reader.h"
+
+// -----------------------------------------------------------------------------
+// Record formatting for the line-oriented outputs. Decoding stays on the
+// calling thread; with several format threads the decoded batches are
+// rendered by a pool into buffers of their own and written in decode
+// order by whichever thread finishes the next one, so the output is the
+// same as the serial one.
+// -----------------------------------------------------------------------------
+
+// Records per decode batch.
+static constexpr size_t kFormatBatch = 4096;
+
+// Render one record at 'out', newline included, in at most the
+// 'max_line' bytes given to format_range(). Returns the end. Must not
+// touch shared state: it is called from several threads at once.
+using LineFn = char* (*)(const db_t& d, char* out);
+
+// Write up to 'limit' pieces from 'src' to 'w', one line each; '*lines'
+// receives the count. 'threads' formats in parallel (0 = one per core,
+// 1 = in line, straight into the writer's chunk).
+bool format_range(RecordSource& src, ArchiveWriter& w, uint64_t limit,
+                  unsigned threads, LineFn fn, size_t max_line,
+                  uint64_t* lines);
@@ -1,44 +1,157 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
+#include "codec_source.h"
+#include "output_sink.h"
 
+// -----------------------------------------------------------------------------
+// Streaming output for every conversion route. The compression follows
+// the path's suffix (.gz/.xz/.bz2/.zst, otherwise none) and is done
+// in-process with zlib, liblzma, libbz2 or libzstd. Output is gathered
+// into kChunkBytes chunks that are encoded and written on worker threads,
+// so the formatter only blocks when the compressors fall behind.
+//
+// With several compress threads, .xz and .zst use the libraries' own
+// multithreaded encoders; .gz and .bz2 chunks are compressed in parallel
+// as independent gzip members / bzip2 streams and written in order, as
+// pigz and pbzip2 do. Chunks, and so members, always end at multiples of
+// kChunkBytes, however the caller's writes fall. The bytes therefore
+// depend only on whether the thread count asked for is 1, not on the
+// count, the host's cores or the write pattern. Either way at most
+// kQueueChunks plus two chunks per thread are held in memory. The
+// encoded bytes go out through an OutputSink, which does the actual I/O
+// in large buffers.
+// -----------------------------------------------------------------------------
 class ArchiveWriter {
 public:
-  ~ArchiveWriter() { close(); }
+  static constexpr size_t kChunkBytes  = 1 << 20;
+  static constexpr size_t kQueueChunks = 4;
 
-  // Open output by extension:
-  //   raw: .jsonl, or compressed: .gz/.xz/.bz2/.zst
-  //   or tar containers: .tar, .tar.gz/.xz/.bz2/.zst
-  // For tar, content is a single entry named "trace.jsonl".
-  bool open(const std::string& path);
+  class Encoder;
 
-  // Append one NDJSON line (adds '\n')
-  bool write_line(const std::string& line);
+  ArchiveWriter();
+  ~ArchiveWriter();
+  ArchiveWriter(const ArchiveWriter&) = delete;
+  ArchiveWriter& operator=(const ArchiveWriter&) = delete;
 
-  void close();
+  // Open 'path' for writing, compressed by its suffix; an empty path is
+  // stdout (uncompressed). 'level' < 0 picks the codec's usual default;
+  // 'threads' == 0 means one per core.
+  bool open(const std::string& path, int level = -1, unsigned threads = 1);
+
+  // Write to a FILE* the caller keeps, e.g. a temporary shard file.
+  bool open(FILE* f, StreamCodec c, int level = -1, unsigned threads = 1);
+
+  static StreamCodec codec_for(const std::string& path);
+
+  // Write through io_uring where possible; takes effect at open().
+  void use_io_uring(bool on) { uring_ = on; }
+  bool io_uring() const { return uring_; }
+
+  // About 'bytes' of uncompressed output are expected; lets the sink
+  // preallocate a plain output file. Compressed sizes are not guessed.
+  void preallocate(uint64_t bytes) {
+    if (fp_ && codec_ == StreamCodec::NONE) sink_.preallocate(bytes);
+  }
+
+  bool write(const void* p, size_t n) {
+    if (len_ + n <= kChunkBytes) {
+      std::memcpy(buf_.data() + len_, p, n);
+      len_ += n;
+      return true;
+    }
+    return write_slow(p, n);
+  }
+  bool write(const std::string& s) { return write(s.data(), s.size()); }
+  bool put(char c) { return write(&c, 1); }
+
+  // At least 'n' (<= kChunkBytes) writable bytes at the current position,
+  // for formatting in place; commit() then takes what was used. The chunk
+  // may run past kChunkBytes meanwhile; commit() cuts it there. Returns
+  // nullptr on failure.
+  char* reserve(size_t n) {
+    if (n > buf_.size() - len_ && !grow(n)) return nullptr;
+    return buf_.data() + len_;
+  }
+  void commit(const char* end) {
+    len_ = size_t(end - buf_.data());
+    if (len_ >= kChunkBytes) flush_chunk();
+  }
+
+  // Append one line (adds '\n').
+  bool write_line(const std::string& line) {
+    return write(line) && put('\n');
+  }
+
+  // Write the plain bytes of 'src', from its start, as if they had come
+  // through write(); joins uncompressed shard outputs so the result is
+  // encoded exactly as one serial run would be.
+  bool append(FILE* src);
+
+  // Finish the stream and flush; closes the file if open() opened it.
+  // Returns false if anything failed along the way.
+  bool close();
+
+  StreamCodec codec() const { return codec_; }
+  int level() const { return level_; }
+  bool failed() const { return failed_; }
+  const std::string& error() const { return err_; }
 
 private:
-  static bool ends_with(const std::string& s, const char* suf);
-  bool write_raw(const void* data, size_t len);
-  bool fail();
-
-  // state
-  std::string path_;
-  struct archive* a_ = nullptr;
-  struct archive_entry* entry_ = nullptr;
-  bool isTar_ = false;
-
-  // streaming tar staging (disk spill)
-  bool staging_ = false;
-  std::string tmpPath_;
-  int   tmpFd_ = -1;
-  FILE* tmpFp_ = nullptr;
-
-
-  // non-tar path: write either to a normal FILE* 
-  // or to a compressor pipe via popen()
-  bool usePipe_ = false;
-  FILE* pipe_ = nullptr;    // when usePipe_ == true
-  FILE* rawFile_ = nullptr; // when writing uncompressed .jsonl
-};
+  struct Chunk {
+    std::vector<char> data;
+    size_t len = 0;
+    uint64_t seq = 0;
+    bool finish = false;   // end the compressed stream after this chunk
+  };
+
+  FILE* fp_ = nullptr;
+  bool  own_ = false;
+  bool  uring_ = false;
+  OutputSink sink_;
+  StreamCodec codec_ = StreamCodec::NONE;
+  int   level_ = -1;
+  bool  members_ = false;  // every chunk is a stream of its own
+  std::vector<std::unique_ptr<Encoder>> enc_;  // one per worker
 
+  std::vector<char> buf_;  // chunk being filled by the formatter
+  size_t len_ = 0;
+
+  // compressor threads
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::deque<Chunk> queue_;
+  std::vector<std::vector<char>> spare_;
+  std::map<uint64_t, std::vector<unsigned char>> done_; // encoded, not written
+  uint64_t seq_ = 0;         // next chunk number handed out
+  uint64_t written_ = 0;     // chunks written so far (in order)
+  size_t   limit_ = 0;       // chunks allowed between seq_ and written_
+  bool writing_ = false, stop_ = false;
+  std::vector<std::thread> workers_;
+
+  std::atomic<bool> failed_{false};
+  std::string err_;
+
+  bool write_slow(const void* p, size_t n);
+  bool flush_chunk() { return fp_ && !failed_ && submit(false); }
+  bool grow(size_t n) {
+    if (!fp_ || failed_) return false;
+    buf_.resize(len_ + n);
+    return true;
+  }
+  // Hand over up to kChunkBytes of buf_, keeping the rest for the next
+  // chunk; blocks if the queue is full.
+  bool submit(bool finish);
+  bool drain();              // wait until everything queued is written
+  void work(size_t w);
+  bool fail(const std::string& e);
+};
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "byte_reader.h"
+#include "record_source.h"
+#include "trace_reader.h"
+
+// -----------------------------------------------------------------------------
+// Common part of the line-per-piece readers (NDJSON, CBP text): lines
+// come out of an ArchiveByteReader, so compressed and tar inputs work,
+// and normally point straight into its blocks; only a line cut by a
+// block end is gathered into a buffer that is reused. Blank lines are
+// skipped, the instruction window is applied by counting pieces with
+// is_last_piece, and a bad line stops the input with file:line and the
+// parser's reason.
+// -----------------------------------------------------------------------------
+class LineSource : public RecordSource {
+public:
+  size_t get_batch(db_t* out, size_t cap) override;
+  bool   set_window(uint64_t first, uint64_t end) override;
+  bool   error() const override { return error_; }
+  std::string where(size_t i) const override;
+
+protected:
+  // 'what' names the format in messages. 'same_pc_pieces' is for formats
+  // without piece boundaries: consecutive lines with the same PC are then
+  // taken as the pieces of one instruction.
+  LineSource(const std::string& path, const ReaderOpts& opts,
+             const char* what, bool same_pc_pieces);
+
+  // Parse the line [s, e), without its newline, into 'd'. On failure
+  // return false with a short reason in '*why'.
+  virtual bool parse(const char* s, const char* e, db_t& d,
+                     const char** why) = 0;
+
+  // Class named [s, s + n), as spelled in cInfo.
+  static bool class_of(const char* s, size_t n, InstClass* c);
+
+private:
+  ArchiveByteReader rdr_;
+  std::string path_;
+  const char* what_;
+  bool infer_last_;
+  bool error_ = false;
+
+  // current block from rdr_, and the part of a line cut by its end
+  const unsigned char* blk_ = nullptr;
+  size_t blk_n_ = 0, pos_ = 0;
+  std::string carry_;
+  uint64_t line_ = 0;       // lines read
+  uint64_t parsed_line_ = 0;  // line of the piece next_parsed() gave
+  uint64_t piece_line_ = 0;   // line of the piece read_piece() gave
+  std::vector<uint64_t> lines_;  // per piece of the last batch
+
+  db_t ahead_;              // next piece, with infer_last_
+  uint64_t ahead_line_ = 0;
+  bool have_ahead_ = false;
+
+  uint64_t instr_ = 0;      // instructions completed so far
+  uint64_t first_ = 0, end_ = ~0ULL;
+
+  bool next_line(const char** s, const char** e);
+  bool next_parsed(db_t& d);
+  bool read_piece(db_t& d);
+  bool next_piece(db_t& d);
+};
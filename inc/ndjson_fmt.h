@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include "trace_reader.h"
+
+// -----------------------------------------------------------------------------
+// NDJSON form of a db_t, one object per line, keys in this order:
+//
+//   {"pc":"0x...","type":"loadOp","ea":"0x...","size":8,
+//    "taken":true,"target":"0x...",
+//    "A":{"bank":1,"idx":5,"val":"0x..."},"B":{...},"C":{...},"D":{...},
+//    "last":false}
+//
+// "ea"/"size" only for loads and stores, "taken"/"target" only for
+// branches, operands only when valid; "bank" is 1 for integer and 2 for
+// floating point registers. "last":false marks a piece that is not the
+// last one of its instruction and is left out otherwise. Addresses and
+// values are "0x" and 16 hex digits.
+// -----------------------------------------------------------------------------
+
+// Longest line format_json_line() can produce, without the newline.
+static constexpr size_t kMaxJsonLine = 512;
+
+// Format one db_t at 'out' (room for kMaxJsonLine bytes, no terminator).
+// Returns the end.
+char* format_json_line(const db_t& d, char* out);
+
+// Same, as a string.
+std::string format_json_line(const db_t& d);
@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include "line_source.h"
+
+// -----------------------------------------------------------------------------
+// NDJSON input, one piece per line in the shape format_json_line()
+// writes (see ndjson_fmt.h). The parser knows that shape: it walks the
+// line once, dispatches on the key, and fills a db_t directly; there is
+// no DOM and nothing is allocated per line. Keys may come in any order
+// and with any spacing (json.dumps style is fine); unknown keys are
+// skipped; hex fields may also be given as plain decimal numbers.
+// -----------------------------------------------------------------------------
+class NdjsonReader : public LineSource {
+public:
+  explicit NdjsonReader(const std::string& path,
+                        const ReaderOpts& opts = ReaderOpts())
+    : LineSource(path, opts, "NDJSON", false) {}
+
+  // Parse the line [s, e) into 'd'. On failure returns false with a
+  // short reason in '*why'.
+  static bool parse_line(const char* s, const char* e, db_t& d,
+                         const char** why);
+
+protected:
+  bool parse(const char* s, const char* e, db_t& d,
+             const char** why) override {
+    return parse_line(s, e, d, why);
+  }
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Byte sink under ArchiveWriter: every route's output reaches the file
+// descriptor through here. Bytes are gathered into two kBufBytes buffers;
+// while one is filled the other is written by a writer thread, or by
+// io_uring when asked for and the kernel allows it, so the caller only
+// waits when the device falls behind by a whole buffer. Writes to regular
+// files are positioned (pwrite), so nothing depends on the descriptor's
+// offset until close() puts it at the end.
+// -----------------------------------------------------------------------------
+class OutputSink {
+public:
+  static constexpr size_t kBufBytes = 4 << 20;
+
+  OutputSink();
+  ~OutputSink();
+  OutputSink(const OutputSink&) = delete;
+  OutputSink& operator=(const OutputSink&) = delete;
+
+  // Write to 'f' from its current position; fclose()d by close() if 'own'.
+  bool open(FILE* f, bool own, bool io_uring = false);
+
+  bool write(const void* p, size_t n);
+
+  // Reserve room for about 'bytes' more output so the file system can
+  // lay it out in one go. Only a hint: ignored for pipes, terminals and
+  // file systems without fallocate; space past the end is released by
+  // close().
+  void preallocate(uint64_t bytes);
+
+  // Write out everything buffered and wait for it.
+  bool flush();
+
+  // Flush and close. Returns false if anything failed along the way.
+  bool close();
+
+  bool is_open() const { return fd_ >= 0; }
+  bool failed() const { return failed_; }
+  bool io_uring() const { return ring_ != nullptr; }
+  const std::string& error() const { return err_; }
+
+private:
+  struct Ring;
+
+  FILE* fp_ = nullptr;
+  int   fd_ = -1;
+  bool  own_ = false;
+  bool  regular_ = false;   // positioned writes; fallocate allowed
+  bool  prealloc_ = false;
+  uint64_t off_ = 0;        // file offset of buf_[cur_][0]
+
+  std::vector<char> buf_[2];
+  int    cur_ = 0;          // buffer being filled
+  size_t len_ = 0;
+
+  // the other buffer, while it is being written
+  std::mutex m_;
+  std::condition_variable cv_;
+  bool     busy_ = false, stop_ = false;
+  const char* pend_ = nullptr;
+  size_t   pend_len_ = 0;
+  uint64_t pend_off_ = 0;
+  std::thread writer_;
+  std::unique_ptr<Ring> ring_;
+
+  std::atomic<bool> failed_{false};
+  std::string err_;
+
+  bool hand_off();            // start writing buf_[cur_], switch buffers
+  bool wait_idle();           // until the other buffer is written
+  bool write_all(const char* p, size_t n, uint64_t off);
+  void run();
+  bool fail(const std::string& e);
+};
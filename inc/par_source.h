@@ -0,0 +1,143 @@
+#pragma once
+#include "block_source.h"
+
+// -----------------------------------------------------------------------------
+// Decodes independent compressed blocks on a thread pool and hands the
+// results out in stream order. At most kWindowPerThread * threads blocks
+// are in flight or buffered, which bounds memory.
+// -----------------------------------------------------------------------------
+class ParallelBlockSource : public BlockSource {
+public:
+  static constexpr unsigned kWindowPerThread = 2;
+
+  ~ParallelBlockSource() override { stop(); }
+
+  bool next(const unsigned char** p, size_t* n) override;
+  bool compressed() const override { return true; }
+
+  size_t jobs() const { return njobs_; }
+
+protected:
+  // Decode job 'j' into 'out'. Runs on a worker thread; must not touch
+  // shared state beyond read-only members. Returns false and sets 'err'
+  // on failure.
+  virtual bool decode_job(size_t j, std::vector<unsigned char>& out,
+                          std::string& err) = 0;
+
+  // Compressed position of job 'j', recorded with its access point.
+  virtual uint64_t job_coff(size_t j) const = 0;
+
+  // Second, serial attempt at a job that failed, made by the consumer.
+  // It may take in the jobs after 'j': on success '*merged' says how
+  // many, and their results are dropped. The default has none to offer.
+  virtual bool recover_job(size_t j, std::vector<unsigned char>& out,
+                           size_t* merged, std::string& err) {
+    (void)j; (void)out; (void)merged; (void)err;
+    return false;
+  }
+
+  // Spawn the workers over jobs [first, njobs).
+  void start(size_t first, size_t njobs, unsigned threads);
+  void stop();
+
+  MappedFile mf_;
+
+private:
+  struct Result {
+    std::vector<unsigned char> data;
+    bool ready = false, ok = true;
+    std::string err;
+  };
+
+  std::vector<Result> window_;     // job j lives in window_[j % size]
+  size_t njobs_ = 0;
+  size_t next_job_ = 0;            // next job a worker picks up
+  size_t cur_ = 0;                 // job the consumer reads next
+  bool   holding_ = false;         // consumer still uses window_[cur_-1]
+  bool   stop_ = false;
+  size_t drop_ = 0;                // jobs a recovered job took in
+  uint64_t uoff_ = 0;              // bytes handed out since start()
+
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::vector<std::thread> workers_;
+
+  void work();
+};
+
+// -----------------------------------------------------------------------------
+// .xz: block list from the stream index; each block decodes on its own.
+// -----------------------------------------------------------------------------
+class ParallelXzSource : public ParallelBlockSource {
+public:
+  // Largest block decoded in one piece.
+  static constexpr uint64_t kMaxBlock = 256ULL << 20;
+
+  struct Block {
+    uint64_t coff;   // compressed offset of the block header
+    uint64_t csize;  // total compressed size incl. header and padding
+    uint64_t unpadded; // compressed size without block padding
+    uint64_t uoff;   // uncompressed offset of the first byte
+    uint64_t usize;  // uncompressed size
+    uint32_t check;  // lzma_check of the enclosing stream
+  };
+
+  // Map 'path' and read its index. Fails (without side effects on the
+  // caller) if the file is not .xz or the index is unusable.
+  bool open_index(const std::string& path);
+
+  // Start decoding at block 'first' on 'threads' workers.
+  void run(size_t first, unsigned threads) { start(first, blocks_.size(), threads); }
+
+  const std::vector<Block>& blocks() const { return blocks_; }
+
+  // Parallel decoding pays off only with several blocks; a huge single
+  // block would also have to be held in memory whole.
+  bool worthwhile() const;
+
+protected:
+  bool decode_job(size_t j, std::vector<unsigned char>& out,
+                  std::string& err) override;
+  uint64_t job_coff(size_t j) const override { return blocks_[j].coff; }
+
+private:
+  std::vector<Block> blocks_;
+};
+
+// -----------------------------------------------------------------------------
+// .bz2: blocks found by scanning for the 48-bit block magic. Each block is
+// decoded by wrapping it in a one-block stream of its own. The magics can
+// also occur by chance inside a block; a block cut short by one fails its
+// CRC and is retried merged with the spans after it, as lbzip2 does.
+// -----------------------------------------------------------------------------
+class ParallelBz2Source : public ParallelBlockSource {
+public:
+  struct Block {
+    uint64_t bit_start; // bit offset of the block magic
+    uint64_t bit_end;   // bit offset of the next block or end-of-stream magic
+  };
+
+  // Map 'path' and find the blocks from bit 'from' on; 'from' must be a
+  // block start when non-zero.
+  bool open_scan(const std::string& path, uint64_t from = 0);
+  void run(size_t first, unsigned threads) { start(first, blocks_.size(), threads); }
+
+  const std::vector<Block>& blocks() const { return blocks_; }
+
+  // Decode one block of a mapped .bz2 file; shared with the index builder.
+  static bool decode_block(const unsigned char* base, const Block& b,
+                           std::vector<unsigned char>& out, std::string& err);
+
+protected:
+  bool decode_job(size_t j, std::vector<unsigned char>& out,
+                  std::string& err) override {
+    return decode_block(mf_.data(), blocks_[j], out, err);
+  }
+  uint64_t job_coff(size_t j) const override { return blocks_[j].bit_start; }
+  bool recover_job(size_t j, std::vector<unsigned char>& out,
+                   size_t* merged, std::string& err) override;
+
+private:
+  std::vector<Block> blocks_;
+  std::vector<uint64_t> marks_;  // every magic found, block or end-of-stream
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+struct db_t;
+struct ConvertPlan;
+
+// -----------------------------------------------------------------------------
+// A stream of cracked pieces, whatever the input format. TraceReader is
+// the CBP binary one; the text-like inputs parse their lines into the
+// same db_t so every writer can take any of them.
+// -----------------------------------------------------------------------------
+class RecordSource {
+public:
+  virtual ~RecordSource() {}
+
+  // Fill up to 'cap' caller-owned slots with the next pieces. Returns the
+  // number filled; 0 at the end of the input or on error.
+  virtual size_t get_batch(db_t* out, size_t cap) = 0;
+
+  // Restrict to instructions [first, end) (0-based). Returns false if the
+  // input is known to end before 'first'; streaming readers may only
+  // find out while reading.
+  virtual bool set_window(uint64_t first, uint64_t end) = 0;
+
+  // Set when the input failed to open or read, or held a bad record.
+  virtual bool error() const = 0;
+
+  // Where piece 'i' of the last non-empty get_batch() came from, as
+  // "file:line"; empty when the input has no lines to point at.
+  virtual std::string where(size_t i) const { (void)i; return std::string(); }
+};
+
+// Open plan.in with the reader for its format; nullptr, with '*err'
+// set, if there is none.
+std::unique_ptr<RecordSource> open_records(const ConvertPlan& plan,
+                                           std::string* err);
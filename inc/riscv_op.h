@@ -0,0 +1,112 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include "trace_reader.h"
+
+// -----------------------------------------------------------------------------
+// Normalized op (reader-agnostic) and the RISC-V instruction chosen for it.
+// The selection rules are the README's: asm and memh outputs both
+// render the same instruction for a piece.
+// -----------------------------------------------------------------------------
+enum class OpKind {
+  ALU, CALL_DIR, CALL_IND, COND_BR, FP, LOAD, RET, SLOW_ALU, STORE, UNCOND_DIR, UNCOND_IND, UNKNOWN
+};
+
+// -----------------------------------------------------------------------------
+struct RegRef {
+  uint32_t idx = 0;         // raw reg index from CBP (may be >31)
+  uint64_t val = 0;         // original value (lower-case hex in comments)
+  bool     is_int = true;
+};
+
+// -----------------------------------------------------------------------------
+// Plain value type: filled per record without touching the heap.
+// -----------------------------------------------------------------------------
+struct Op {
+  uint64_t pc = 0;
+
+  OpKind kind = OpKind::UNKNOWN;
+
+  // Branch/call metadata
+  bool     taken = false;
+  uint64_t target = 0;
+
+  // Memory
+  uint64_t ea = 0;
+  uint32_t size = 0;        // bytes
+
+  // Registers
+  RegRef   inputs[3];       // R1, R2, R3 in docs
+  uint32_t n_in = 0;
+  RegRef   output;          // RD (destination), if has_out
+  bool     has_out = false;
+};
+
+// Fill 'op' from one cracked piece.
+void map_db_to_op(const db_t& d, Op& op);
+
+// -----------------------------------------------------------------------------
+// Helper: register naming & capping rules (from docs).
+// -----------------------------------------------------------------------------
+static inline uint32_t cap_reg(uint32_t raw) {
+  // "Any operands which exceed their encoding range are capped at the maximum value."
+  // For RISC-V integer regs, cap to x31.
+  return std::min<uint32_t>(raw, 31);
+}
+
+// -----------------------------------------------------------------------------
+// RD special cases:
+//   - RD:64 => x31
+//   - RD:0  => x1  (avoid nop optimizations)
+// Inputs: just cap >31 to 31; allow x0.
+// -----------------------------------------------------------------------------
+static inline uint32_t rd_reg(uint32_t rd_raw) {
+  if (rd_raw == 64) return 31;
+  if (rd_raw == 0)  return 1;
+  return cap_reg(rd_raw);
+}
+
+// -----------------------------------------------------------------------------
+// Offsets & masking helpers.
+// JAL: 20-bit signed; BR/JALR: 12-bit signed. We also echo masked hex like examples (e.g., f7c).
+// -----------------------------------------------------------------------------
+static inline int64_t signed_delta(uint64_t pc, uint64_t target) {
+  return (int64_t)target - (int64_t)pc;
+}
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+static inline uint64_t mask_nbits(uint64_t v, unsigned nbits) {
+  const uint64_t mask = (nbits >= 64) ? ~0ull : ((1ull << nbits) - 1);
+  return v & mask;
+}
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+static inline bool fits_signed_nbits(int64_t v, unsigned nbits) {
+  const int64_t minv = -(1ll << (nbits - 1));
+  const int64_t maxv =  (1ll << (nbits - 1)) - 1;
+  return (v >= minv && v <= maxv);
+}
+
+// -----------------------------------------------------------------------------
+// Instruction forms the rules produce. fsl is the Zbt funnel shift used
+// for three-input aluOps; fpOps have no mapping and, like an aluOp of
+// unhandled arity, come out as fence.i.
+// -----------------------------------------------------------------------------
+enum class RvForm : uint8_t {
+  FENCE_I, ADD, FSL, DIVU, JAL, JALR, BEQ, BNE,
+  LBU, LHU, LWU, LD, SB, SH, SW, SD, COUNT
+};
+
+struct RvInst {
+  RvForm  form = RvForm::FENCE_I;
+  uint8_t rd = 0, rs1 = 0, rs2 = 0, rs3 = 0;
+  int32_t imm = 0;          // byte offset; 0 where an offset does not fit
+};
+
+// The instruction the README rules give 'op'.
+RvInst rv_select(const Op& op);
+
+// Its 32-bit machine word.
+uint32_t rv_encode(const RvInst& i);
+
+inline uint32_t rv_encode(const Op& op) { return rv_encode(rv_select(op)); }
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// -----------------------------------------------------------------------------
+// Small scanning helpers shared by the line-oriented readers. Each takes
+// the cursor by reference, stops at 'e', and leaves the cursor after what
+// it consumed. No locale, no errno, no strtoull.
+// -----------------------------------------------------------------------------
+
+struct HexTable {
+  int8_t v[256];
+  constexpr HexTable() : v() {
+    for (int i = 0; i < 256; ++i) v[i] = -1;
+    for (int i = 0; i < 10; ++i) v['0' + i] = int8_t(i);
+    for (int i = 0; i < 6; ++i)  v['a' + i] = v['A' + i] = int8_t(10 + i);
+  }
+};
+static constexpr HexTable kHexVal;
+
+static inline void skip_ws(const char*& p, const char* e) {
+  while (p < e && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+}
+
+// Literal 'lit' at p (then consumed)?
+template<size_t N>
+static inline bool eat(const char*& p, const char* e, const char (&lit)[N]) {
+  if (size_t(e - p) < N - 1) return false;
+  for (size_t i = 0; i < N - 1; ++i)
+    if (p[i] != lit[i]) return false;
+  p += N - 1;
+  return true;
+}
+
+// 1..16 hex digits, optionally after "0x"/"0X".
+static inline bool scan_hex(const char*& p, const char* e, uint64_t* out) {
+  if (e - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+  const char* s = p;
+  uint64_t v = 0;
+  int8_t d;
+  while (p < e && (d = kHexVal.v[(unsigned char)*p]) >= 0) {
+    v = (v << 4) | uint64_t(d);
+    ++p;
+  }
+  *out = v;
+  return p > s && p - s <= 16;
+}
+
+// Unsigned decimal that fits in 64 bits.
+static inline bool scan_dec(const char*& p, const char* e, uint64_t* out) {
+  const char* s = p;
+  uint64_t v = 0;
+  while (p < e && unsigned(*p - '0') < 10) {
+    const uint64_t d = uint64_t(*p - '0');
+    if (v > (~0ULL - d) / 10) return false;
+    v = v * 10 + d;
+    ++p;
+  }
+  *out = v;
+  return p > s;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include "converter.h"
+#include "io_archive.h"
+#include "trace_reader.h"
+
+// -----------------------------------------------------------------------------
+// Sharded conversion: the plan's instruction window is cut into contiguous
+// shards, each converted on its own thread with its own TraceReader and
+// output, and the outputs are stitched together in order. Shard starts
+// come from a checkpoint index: the trace's own when one is present,
+// otherwise a length-only pre-scan held in memory.
+// -----------------------------------------------------------------------------
+
+// Convert everything 'tr' yields into 'w'; '*count' receives the number
+// of pieces written. Called once per shard, concurrently.
+using ShardFn = std::function<bool(TraceReader& tr, ArchiveWriter& w,
+                                   uint64_t* count)>;
+
+enum class ShardResult { SERIAL, OK, FAILED };
+
+// Smallest shard worth a thread of its own, in instructions.
+static constexpr uint64_t kMinShardInstrs = 100000;
+
+// Run 'fn' over shards of plan.in. Returns SERIAL, without writing
+// anything, when the plan cannot or need not be sharded (one thread,
+// a piece limit, a container or non-CBP input, a tiny window); the caller then
+// converts serially. Shard 0 writes straight to 'out', the others to
+// uncompressed temporary files that are fed through 'out' afterwards, so
+// the bytes match a serial run's for every output codec.
+ShardResult run_sharded(const ConvertPlan& plan, ArchiveWriter& out,
+                        const ShardFn& fn, uint64_t* count);
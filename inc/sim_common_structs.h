@@ -43,6 +43,8 @@ enum class InstClass : uint8_t
     ReturnInstClass = 11,
 };
 
+static constexpr uint8_t kNumInstClasses = 12;
+
 static constexpr const char * cInfo[] = {"aluOp", "loadOp", "stOp", "condBrOp", "uncondDirBrOp", "uncondIndBrOp", "fpOp", "slowAluOp", "undefOp", "callDirBrOp", "callIndBrOp", "retBrOp",};
 
 inline bool is_load(InstClass inst_class)
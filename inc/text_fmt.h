@@ -1,7 +1,14 @@
 #pragma once
+#include <cstddef>
 #include <string>
 #include "trace_reader.h"
 
-// Format one db_t like a line from sample text file
-std::string format_text_line(const db_t& d);
+// Longest line format_text_line() can produce, without the newline.
+static constexpr size_t kMaxTextLine = 512;
+
+// Format one db_t like a line from sample text file, written at 'out'
+// (room for kMaxTextLine bytes, no terminator). Returns the end.
+char* format_text_line(const db_t& d, char* out);
 
+// Same, as a string.
+std::string format_text_line(const db_t& d);
@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include "line_source.h"
+
+// -----------------------------------------------------------------------------
+// CBP text input: the lines format_text_line() writes,
+//
+//   [PC: 0x80002af8 type: loadOp ea: 0x800085d0 size: 8 1st input:  (int: 1,
+//    idx: 31 val: deadbeef)  output:  (int: 1, idx: 30 val: 80002b38)   ]
+//
+// and the db_t operator<< form found in the CBP2025 sample traces, which
+// adds "( tkn:1 tar: 0x80002b38)" after the type of branches. Scanning
+// is by hand for exactly this grammar, spacing aside; hex without
+// strtoull or locale. Neither form marks piece boundaries, so pieces
+// are grouped by PC, and a branch without tkn/tar takes its target
+// from the next line (see LineSource).
+// -----------------------------------------------------------------------------
+class TextReader : public LineSource {
+public:
+  explicit TextReader(const std::string& path,
+                      const ReaderOpts& opts = ReaderOpts())
+    : LineSource(path, opts, "text", true) {}
+
+  // Parse the line [s, e) into 'd'. On failure returns false with a
+  // short reason in '*why'.
+  static bool parse_line(const char* s, const char* e, db_t& d,
+                         const char** why);
+
+protected:
+  bool parse(const char* s, const char* e, db_t& d,
+             const char** why) override {
+    return parse_line(s, e, d, why);
+  }
+};
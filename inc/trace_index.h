@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "block_source.h"
+
+// -----------------------------------------------------------------------------
+// Checkpoint index for a CBP trace, kept next to it as "<trace>.cbpidx".
+// Each checkpoint pairs a decompressor access point with the first record
+// that starts at or after it, so a reader can restart there, skip a few
+// bytes and be on an instruction boundary.
+//
+// Access points per input: gzip - deflate block boundaries with their
+// 32 KiB window; xz and bzip2 - block starts; zstd - frame starts;
+// uncompressed - any offset; .cbpc - block starts, taken from its footer
+// without decoding. Single-block .xz and single-frame .zst files
+// therefore only have the point at offset 0.
+// -----------------------------------------------------------------------------
+class TraceIndex {
+public:
+  enum class Codec : uint32_t { RAW, GZIP, XZ, BZIP2, ZSTD, CBPC };
+
+  struct Checkpoint {
+    AccessPoint at;        // where decompression restarts
+    uint32_t skip   = 0;   // bytes from 'at' to the record start
+    uint64_t instr  = 0;   // instructions before that record
+    uint64_t pieces = 0;   // cracked pieces before that record
+  };
+
+  static constexpr uint64_t kDefaultSpan = 16ULL << 20;
+
+  static std::string sidecar(const std::string& trace) {
+    return trace + ".cbpidx";
+  }
+
+  // Decode 'trace' once, recording checkpoints about 'span' decompressed
+  // bytes apart. Without 'count_pieces' records are only walked, which is
+  // faster, and all piece counts stay 0.
+  bool build(const std::string& trace, uint64_t span, std::string* err,
+             bool count_pieces = true);
+
+  bool save(const std::string& path, std::string* err) const;
+
+  // Load 'path'; fails if it does not match the current size and mtime
+  // of 'trace'.
+  bool load(const std::string& path, const std::string& trace,
+            std::string* err);
+
+  // Last checkpoint at or before instruction 'n'; nullptr if none.
+  const Checkpoint* find(uint64_t n) const;
+
+  // A source that starts decoding at 'cp'. Its first byte is at
+  // decompressed offset cp.at.uoff.
+  std::unique_ptr<BlockSource> open_at(const std::string& trace,
+                                       const Checkpoint& cp,
+                                       unsigned threads,
+                                       std::string* err) const;
+
+  Codec    codec()  const { return codec_; }
+  uint64_t instrs() const { return instrs_; }
+  uint64_t pieces() const { return pieces_; }
+  uint64_t bytes()  const { return bytes_; }
+  const std::vector<Checkpoint>& checkpoints() const { return cps_; }
+
+private:
+  Codec    codec_ = Codec::RAW;
+  uint64_t fsize_ = 0, mtime_ = 0, span_ = 0;
+  uint64_t instrs_ = 0, pieces_ = 0, bytes_ = 0;
+  std::vector<Checkpoint> cps_;
+
+  static bool file_stamp(const std::string& path, uint64_t* size,
+                         uint64_t* mtime);
+  static bool sniff(const std::string& path, Codec* c, std::string* err);
+  bool from_footer(const std::string& trace, std::string* err);
+  static std::unique_ptr<BlockSource> open_source(const std::string& trace,
+                                                  Codec c,
+                                                  const AccessPoint* at,
+                                                  unsigned threads,
+                                                  std::string* err);
+};
@@ -4,8 +4,11 @@
 #include <optional>
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include "byte_reader.h"
+#include "record_source.h"
+#include "trace_index.h"
 #include "sim_common_structs.h" // from cbp2025 distro
 
 // -----------------------------------------------------------------------------
@@ -74,10 +77,49 @@ struct db_t {
   }
 };
 
+// -----------------------------------------------------------------------------
+// Fixed-capacity vector with inline storage. clear() only resets the count,
+// so per-instruction decode state never touches the heap.
+// -----------------------------------------------------------------------------
+template<typename T, size_t N>
+struct InlineVec {
+  T      v[N];
+  size_t n = 0;
+
+  void   clear()       { n = 0; }
+  size_t size()  const { return n; }
+  bool   empty() const { return n == 0; }
+  void   push_back(T x) { assert(n < N); v[n++] = x; }
+  void   erase_at(size_t i) {
+    assert(i < n);
+    for (size_t j = i + 1; j < n; ++j) v[j-1] = v[j];
+    --n;
+  }
+
+  T&       operator[](size_t i)       { return v[i]; }
+  const T& operator[](size_t i) const { return v[i]; }
+  const T& at(size_t i) const { assert(i < n); return v[i]; }
+  const T& back()       const { assert(n > 0); return v[n-1]; }
+  T*       begin()       { return v; }
+  T*       end()         { return v + n; }
+  const T* begin() const { return v; }
+  const T* end()   const { return v + n; }
+};
+
 // -----------------------------------------------------------------------------
 // Binary CBP reader (compatible with the sample trace layout).
 // -----------------------------------------------------------------------------
-struct TraceReader {
+struct TraceReader : public RecordSource {
+
+  // Register counts are uint8_t in the format; fp outputs carry two values.
+  static constexpr size_t kMaxRegs = 256;
+  static constexpr size_t kMaxVals = 2 * kMaxRegs;
+
+  // Largest possible encoded record: pc, class, mem fields (ea, size,
+  // base-update, reg-offset), 255 input regs, 255 output regs and two
+  // 64-bit values per output.
+  static constexpr size_t kMaxRecordBytes =
+      8 + 1 + (8 + 1 + 1 + 1) + 1 + 255 + 1 + 255 + 255 * 16;
 
   struct Instr {
     uint64_t mPc{}, mNextPc{}, mEffAddr{};
@@ -85,9 +127,9 @@ struct TraceReader {
     bool mTaken{};
     uint8_t  mMemSize{}, mBaseUpd{}, mHasRegOffset{};
     uint8_t  mNumInRegs{}, mNumOutRegs{};
-    std::vector<uint8_t> mInRegs, mOutRegs;
+    InlineVec<uint8_t, kMaxRegs> mInRegs, mOutRegs;
     std::optional<uint8_t> mBaseUpdReg;
-    std::vector<uint64_t> mOutRegsValues;
+    InlineVec<uint64_t, kMaxVals> mOutRegsValues;
     Instr(){ reset(); }
     void reset(){
       mPc = mNextPc = mEffAddr = 0xdeadbeefULL;
@@ -115,11 +157,44 @@ struct TraceReader {
     }
   };
 
-  explicit TraceReader(const char* path): nInstr(0) { rdr.open(path); }
-  ~TraceReader(){ std::cout << " Read " << nInstr << " instrs " << std::endl; }
+  explicit TraceReader(const char* path, const ReaderOpts& opts = ReaderOpts());
+  // Decode from a ready source (e.g. while building an index).
+  explicit TraceReader(std::unique_ptr<BlockSource> src);
+  ~TraceReader() override;
+
+  db_t*  get_inst();             // allocates a db_t*, caller deletes
+  bool   get_inst(db_t& out);    // next piece into caller storage
+  // Fill up to 'cap' caller-owned slots with the next cracked pieces.
+  // Returns the number filled; 0 at end of trace. No allocation.
+  size_t get_batch(db_t* out, size_t cap) override;
+  bool   readInstr();            // fill mInstr from stream
+  // Step over one record with a length-only parse: no cracking, mInstr
+  // is left untouched.
+  bool   skipInstr();
+  // skipInstr() that also hands out the record's bytes, valid until the
+  // next read from this reader.
+  bool   rawInstr(const unsigned char** p, size_t* n);
+
+  // Position so the next piece comes from instruction 'n' (0-based).
+  // Jumps through the checkpoint index when there is one, otherwise
+  // decodes forward (from the start if 'n' lies behind). Returns false if
+  // the trace ends first.
+  bool   seek(uint64_t n);
 
-  db_t* get_inst();      // allocates a db_t* 
-  bool  readInstr();     // fill mInstr from stream
+  // Restrict decoding to instructions [first, end): seek to 'first', then
+  // report end of trace once 'end' is reached.
+  bool   set_window(uint64_t first, uint64_t end) override;
+
+  // Decompressed offset of the next record.
+  uint64_t offset() const { return rdr.tell(); }
+
+  // Seek with an index already in memory instead of loading one.
+  void use_index(std::shared_ptr<const TraceIndex> idx) {
+    mIndex = std::move(idx); mIndexTried = true;
+  }
+
+  // No progress or summary lines on stdout.
+  void set_quiet(bool q) { mQuiet = q; }
 
   // internal state (matches the original)
   Instr mInstr;
@@ -129,20 +204,58 @@ struct TraceReader {
   uint64_t nInstr=0;
   uint8_t start_fp_reg=0;
 
+  // Set when the input failed to open or decompress, or a record was cut
+  // short or carried a bad class byte.
+  bool error() const override { return mError; }
+
 private:
   ArchiveByteReader rdr;
+  bool mError = false, mBadClass = false;
+  uint64_t mEnd = ~0ULL;         // instruction count to stop at
+
+  std::string mPath;             // empty when built from a source
+  ReaderOpts  mOpts;
+  std::shared_ptr<const TraceIndex> mIndex;
+  bool mIndexTried = false;
+  bool mQuiet = false;
+
+  void load_index();
+
+  // PC -> static decode: a record whose fixed fields (class, memory size
+  // and flags, register lists) match the entry for its PC is not cracked
+  // again. Its pieces are copied from the entry's template, and only the
+  // EA, branch outcome and output values are filled in.
+  struct PcCache;
+  std::unique_ptr<PcCache> mCache;
+  uint32_t mTpl = ~0u;           // template of the current record, if any
+
+  bool cached_record(const unsigned char* p, size_t* len);
+  void cache_record(const unsigned char* p, size_t len);
+  bool check_cached(const unsigned char* p);
+  void next_piece(db_t& out);
+
+  struct SafeSrc;
+  struct PeekSrc;
+  template<class Src> bool decode_record(Src& s);
+  template<class Src> bool skip_record(Src& s);
+  bool bad_record();
 
   // helpers
   template<typename T>
   bool read_raw(T& v) {
-    size_t got = rdr.read(&v, sizeof(T));
-    return got == sizeof(T);
+    const unsigned char* p = rdr.peek(sizeof(T));
+    if (!p) return false;
+    std::memcpy(&v, p, sizeof(T));
+    rdr.consume(sizeof(T));
+    return true;
   }
   bool read_bytes(void* p, size_t n) {
     size_t got = rdr.read(p, n);
     return got == n;
   }
 
-  db_t* populateNewInstr();
+  // '*val' receives the index into mOutRegsValues that D.value came
+  // from, or -1.
+  void populateNewInstr(db_t& inst, int* val = nullptr);
 };
 
@@ -0,0 +1,54 @@
+#!/usr/bin/env bash
+# --------------------------------------------------------------------
+# Decompression throughput per reader backend.
+#
+#   scripts/bench_backends.sh [cbp_conv] [trace...]
+#
+# Each trace is walked end to end with a length-only skip, so the time
+# is dominated by decompression. Reports decoded MB/s (best of RUNS).
+# --------------------------------------------------------------------
+set -euo pipefail
+
+BIN=${1:-./bin/cbp_conv}
+shift || true
+TRACES=("$@")
+[ ${#TRACES[@]} -eq 0 ] && TRACES=(traces/*_trace.gz traces/*_trace.xz traces/*_trace.bz2)
+RUNS=${RUNS:-3}
+SKIP_ALL=999999999999999
+OUT=$(mktemp --suffix=.txt)
+trap 'rm -f "$OUT"' EXIT
+
+decoded_bytes() {
+  case "$1" in
+    *.gz)  gzip  -dc "$1" | wc -c ;;
+    *.xz)  xz    -dc "$1" | wc -c ;;
+    *.bz2) bzip2 -dc "$1" | wc -c ;;
+    *.zst) zstd  -dc "$1" | wc -c ;;
+    *)     wc -c < "$1" ;;
+  esac
+}
+
+best_ms() {
+  local best=
+  for _ in $(seq "$RUNS"); do
+    local t0 t1 ms
+    t0=$(date +%s%N)
+    "$BIN" --in "$1" --out "$OUT" --skip $SKIP_ALL "${@:2}" >/dev/null 2>&1 || true
+    t1=$(date +%s%N)
+    ms=$(( (t1 - t0) / 1000000 ))
+    if [ -z "$best" ] || [ "$ms" -lt "$best" ]; then best=$ms; fi
+  done
+  echo "$best"
+}
+
+printf "%-28s %10s %14s %14s\n" trace MB native_MB/s libarchive_MB/s
+for t in "${TRACES[@]}"; do
+  [ -f "$t" ] || continue
+  bytes=$(decoded_bytes "$t")
+  n=$(best_ms "$t" --backend native --decomp-threads 1)
+  l=$(best_ms "$t" --backend libarchive)
+  awk -v t="$(basename "$t")" -v b="$bytes" -v n="$n" -v l="$l" 'BEGIN {
+    mb = b / 1e6
+    printf "%-28s %10.1f %14.1f %14.1f\n", t, mb,
+           (n ? mb / (n / 1000) : 0), (l ? mb / (l / 1000) : 0) }'
+done
@@ -0,0 +1,321 @@
+#include "block_source.h"
+#include <archive.h>
+#include <archive_entry.h>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool MappedFile::open(const std::string& path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void* m = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (m == MAP_FAILED) return false;
+  p_ = static_cast<const unsigned char*>(m);
+  n_ = size_t(st.st_size);
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+void MappedFile::close() {
+  if (p_) ::munmap(const_cast<unsigned char*>(p_), n_);
+  p_ = nullptr;
+  n_ = 0;
+}
+
+// ---------------------------------------------------------------------
+// Hints only; failures are harmless and ignored.
+// ---------------------------------------------------------------------
+void MappedFile::advise(uint64_t off, bool huge_pages) const {
+  if (!p_) return;
+  const uint64_t page = uint64_t(::sysconf(_SC_PAGESIZE));
+  off -= off % page;
+  if (off >= n_) return;
+  void* a = const_cast<unsigned char*>(p_ + off);
+  const size_t len = n_ - size_t(off);
+  ::madvise(a, len, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+  if (huge_pages) ::madvise(a, len, MADV_HUGEPAGE);
+#else
+  (void)huge_pages;
+#endif
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool MmapSource::open(const std::string& path, uint64_t off, bool huge_pages) {
+  if (!mf_.open(path)) return fail("open " + path);
+  if (off > mf_.size()) return fail("offset past end of " + path);
+  pos_ = off;
+  mf_.advise(off, huge_pages);
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// Signatures libarchive would pick up: gzip, xz, bzip2, zstd (also
+// skippable frames), lz4, compress(1), zip, 7z and ustar.
+// ---------------------------------------------------------------------
+bool MmapSource::plain() const {
+  const unsigned char* d = mf_.data();
+  const size_t n = mf_.size();
+  auto starts = [&](const char* m, size_t len, size_t at = 0) {
+    return n >= at + len && std::memcmp(d + at, m, len) == 0;
+  };
+  if (starts("\x1f\x8b", 2) || starts("\x1f\x9d", 2)
+      || starts("\xfd" "7zXZ\0", 6) || starts("BZh", 3)
+      || starts("\x28\xb5\x2f\xfd", 4) || starts("\x04\x22\x4d\x18", 4)
+      || starts("PK\x03\x04", 4) || starts("7z\xbc\xaf\x27\x1c", 6)
+      || starts("CBPC", 4) || starts("ustar", 5, 257))
+    return false;
+  if (n >= 4 && (d[0] & 0xF0) == 0x50 && d[1] == 0x2A && d[2] == 0x4D
+      && d[3] == 0x18)
+    return false;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// Hand out the rest of the mapping at once, or in slices while recording
+// so access points stay fine-grained.
+// ---------------------------------------------------------------------
+bool MmapSource::next(const unsigned char** p, size_t* n) {
+  if (pos_ >= mf_.size()) return false;
+  if (want_point(pos_)) {
+    AccessPoint ap;
+    ap.uoff = ap.coff = pos_;
+    points_->push_back(std::move(ap));
+  }
+  size_t take = mf_.size() - size_t(pos_);
+  if (points_ && take > kSliceBytes) take = kSliceBytes;
+  *p = mf_.data() + pos_;
+  *n = take;
+  pos_ += take;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool LibarchiveSource::open_with(const std::string& path, bool raw_only) {
+  a_ = archive_read_new();
+  if (!a_) return false;
+
+  archive_read_support_filter_all(a_);
+  if (!raw_only) {
+    archive_read_support_format_all(a_);
+  }
+  archive_read_support_format_raw(a_); // allow raw compressed streams
+
+  int r = archive_read_open_filename(a_, path.c_str(), 1 << 20);
+  if (r != ARCHIVE_OK) {
+    std::fprintf(stderr, "open%s: %s\n",
+                 raw_only ? " (raw-only)" : "",
+                 archive_error_string(a_));
+    archive_read_free(a_);
+    a_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool LibarchiveSource::open(const std::string& path, bool force_raw) {
+  close();
+
+  if (force_raw) {
+    // Caller insists on raw mode
+    if (!open_with(path, true)) return fail("open " + path);
+  } else {
+    // Try normal (formats + raw), then fallback to raw-only
+    if (!open_with(path, false) && !open_with(path, true))
+      return fail("open " + path);
+  }
+
+  if (!next_entry()) return fail("no entry in " + path);
+
+  // Known once the first header has been read.
+  filter_ = archive_filter_code(a_, 0);
+  raw_ = archive_format(a_) == ARCHIVE_FORMAT_RAW;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool LibarchiveSource::open_memory(const void* p, size_t n, int filter) {
+  close();
+  a_ = archive_read_new();
+  if (!a_) return fail("archive_read_new");
+  if (archive_read_append_filter(a_, filter) != ARCHIVE_OK)
+    return fail_archive("append_filter");
+  archive_read_support_format_raw(a_);
+  if (archive_read_open_memory(a_, p, n) != ARCHIVE_OK)
+    return fail_archive("open_memory");
+  if (!next_entry()) return fail("no data in memory stream");
+  filter_ = archive_filter_code(a_, 0);
+  raw_ = true;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool LibarchiveSource::next_entry() {
+  archive_entry* e=nullptr;
+  int r = archive_read_next_header(a_, &e);
+  if (r == ARCHIVE_EOF) return false;
+  if (r != ARCHIVE_OK) {
+    std::fprintf(stderr, "next_header: %s\n", archive_error_string(a_));
+    return fail_archive("next_header");
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool LibarchiveSource::next(const unsigned char** p, size_t* n) {
+  if (!a_) return false;
+  for (;;) {
+    const void* blk=nullptr; size_t sz=0; la_int64_t off=0;
+    int r = archive_read_data_block(a_, &blk, &sz, &off);
+    if (r == ARCHIVE_EOF) {
+      // try next entry (tar)
+      if (next_entry()) continue;
+      return false;
+    }
+    if (r != ARCHIVE_OK) return fail_archive("read_data_block");
+    if (sz == 0) continue;
+    // No copy: libarchive keeps the block alive until the next call.
+    *p = static_cast<const unsigned char*>(blk);
+    *n = sz;
+    return true;
+  }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool LibarchiveSource::fail_archive(const char* where){
+  const char* msg = a_ ? archive_error_string(a_) : nullptr;
+  if (msg) std::fprintf(stderr, "%s: %s\n", where, msg);
+  return fail(std::string(where) + ": " + (msg ? msg : "error"));
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+void LibarchiveSource::close() {
+  if (a_) {
+    archive_read_close(a_);
+    archive_read_free(a_);
+    a_ = nullptr;
+  }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+PrefetchSource::PrefetchSource(std::unique_ptr<BlockSource> inner)
+  : inner_(std::move(inner)), slots_(kSlots)
+{
+  th_ = std::thread(&PrefetchSource::produce, this);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+PrefetchSource::~PrefetchSource() {
+  stop_ = true;
+  wake();
+  if (th_.joinable()) th_.join();
+}
+
+// ---------------------------------------------------------------------
+// Spin briefly, then park. sleepers_ is raised before the predicate is
+// re-checked under the mutex, so a wake() that races with parking is
+// never lost (both sides use seq_cst atomics).
+// ---------------------------------------------------------------------
+template<class Pred>
+void PrefetchSource::wait_until(Pred pred) {
+  for (int i = 0; i < 64; ++i) {
+    if (pred()) return;
+    std::this_thread::yield();
+  }
+  std::unique_lock<std::mutex> lk(m_);
+  ++sleepers_;
+  cv_.wait(lk, pred);
+  --sleepers_;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+void PrefetchSource::wake() {
+  if (sleepers_.load() == 0) return;
+  std::lock_guard<std::mutex> lk(m_);
+  cv_.notify_all();
+}
+
+// ---------------------------------------------------------------------
+// Producer thread: pull blocks from the inner source and pack them into
+// slots of up to kSlotBytes.
+// ---------------------------------------------------------------------
+void PrefetchSource::produce() {
+  const unsigned char* p = nullptr;
+  size_t left = 0;
+  bool more = true;
+
+  while (more && !stop_) {
+    // backpressure: wait for a free slot
+    wait_until([&]{ return stop_ || head_ - tail_ < kSlots; });
+    if (stop_) break;
+
+    Slot& s = slots_[head_ % kSlots];
+    if (s.data.size() < kSlotBytes) s.data.resize(kSlotBytes);
+    s.len = 0;
+
+    while (s.len < kSlotBytes) {
+      if (left == 0) {
+        if (!inner_->next(&p, &left)) { more = false; break; }
+      }
+      size_t take = kSlotBytes - s.len;
+      if (take > left) take = left;
+      std::memcpy(s.data.data() + s.len, p, take);
+      s.len += take;
+      p += take;
+      left -= take;
+    }
+
+    if (s.len > 0) {
+      head_.fetch_add(1);
+      wake();
+    }
+  }
+
+  if (inner_->failed()) { failed_ = true; err_ = inner_->error(); }
+  done_ = true;
+  wake();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool PrefetchSource::next(const unsigned char** p, size_t* n) {
+  if (holding_) {
+    tail_.fetch_add(1);
+    holding_ = false;
+    wake();
+  }
+
+  wait_until([&]{ return head_ > tail_ || done_; });
+  if (head_ == tail_) return false; // done_ and drained; failed_ is set
+
+  const Slot& s = slots_[tail_ % kSlots];
+  *p = s.data.data();
+  *n = s.len;
+  holding_ = true;
+  return true;
+}
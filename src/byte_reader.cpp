@@ -1,6 +1,8 @@
 #include "byte_reader.h"
+#include "cbpc.h"
+#include "codec_source.h"
+#include "par_source.h"
 #include <archive.h>
-#include <archive_entry.h>
 #include <cstdio>
 #include <cstring>
 #include <string>
@@ -9,85 +11,180 @@
 // ---------------------------------------------------------------------
 // ---------------------------------------------------------------------
 bool ArchiveByteReader::open(const std::string& path, bool force_raw) {
-    close();
-
-    auto open_with = [&](bool raw_only) -> bool {
-        a_ = archive_read_new();
-        if (!a_) return false;
-
-        archive_read_support_filter_all(a_);
-        if (!raw_only) {
-            archive_read_support_format_all(a_);
-        }
-        archive_read_support_format_raw(a_); // allow raw compressed streams
-
-        int r = archive_read_open_filename(a_, path.c_str(), 1 << 20);
-        if (r != ARCHIVE_OK) {
-            std::fprintf(stderr, "open%s: %s\n",
-                         raw_only ? " (raw-only)" : "",
-                         archive_error_string(a_));
-            archive_read_free(a_);
-            a_ = nullptr;
-            return false;
-        }
-        return true;
-    };
-
-    if (force_raw) {
-        // Caller insists on raw mode
-        if (!open_with(true)) {
-            eof_ = true;
-            return false;
-        }
-    } else {
-        // Try normal (formats + raw), then fallback to raw-only
-        if (!open_with(false)) {
-            if (!open_with(true)) {
-                eof_ = true;
-                return false;
-            }
-        }
-    }
+  ReaderOpts opts;
+  opts.force_raw = force_raw;
+  return open(path, opts);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ArchiveByteReader::open(const std::string& path, const ReaderOpts& opts) {
+  close();
 
-    if (!next_entry()) {
-        eof_ = true;
-        return false;
+  // .cbpc carries its own compression; every backend reads it the same way
+  if (cbpc::sniff(path)) {
+    auto cs = std::make_unique<CbpcSource>();
+    if (!cs->open(path)) {
+      std::fprintf(stderr, "open: %s\n", cs->error().c_str());
+      return false;
     }
+    if (opts.prefetch) src_ = std::make_unique<PrefetchSource>(std::move(cs));
+    else               src_ = std::move(cs);
+    reset_state(0);
+    return true;
+  }
 
-    eof_ = false;
-    buf_.clear();
-    pos_ = 0;
+  if (opts.plain && (src_ = open_plain(path, opts.huge_pages))) {
+    reset_state(0);
     return true;
+  }
+
+  if (opts.backend == Backend::NATIVE && open_native(path, opts)) return true;
+
+  auto la = std::make_unique<LibarchiveSource>();
+  if (!la->open(path, opts.force_raw)) return false;
+
+  // Overlap decompression with decode/format on compressed inputs.
+  if (opts.prefetch && la->compressed())
+    src_ = std::make_unique<PrefetchSource>(std::move(la));
+  else
+    src_ = std::move(la);
+
+  reset_state(0);
+  return true;
 }
 
 // ---------------------------------------------------------------------
+// Bare compressed files picked by their magic bytes. Multi-block .xz and
+// .bz2 decode in parallel. A tar inside the compression is detected from
+// the first decoded header and handed back to libarchive.
 // ---------------------------------------------------------------------
-bool ArchiveByteReader::next_entry() {
-  archive_entry* e=nullptr;
-  int r = archive_read_next_header(a_, &e);
-  if (r == ARCHIVE_EOF) return false;
-  if (r != ARCHIVE_OK) {
-    // Try to reopen RAW-only once if we somehow got here with a non-RAW handle.
-    std::fprintf(stderr, "next_header: %s\n", archive_error_string(a_));
-    return fail("next_header");
+bool ArchiveByteReader::open_native(const std::string& path,
+                                    const ReaderOpts& opts)
+{
+  unsigned threads = opts.decomp_threads;
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+
+  std::unique_ptr<BlockSource> s;
+  bool parallel = false;
+  switch (sniff_codec(path)) {
+    case StreamCodec::GZIP: {
+      auto gz = std::make_unique<GzipSource>();
+      if (gz->open(path)) s = std::move(gz);
+      break;
+    }
+    case StreamCodec::XZ: {
+      if (threads > 1) s = open_parallel_xz(path, threads);
+      parallel = bool(s);
+      if (!s) {
+        auto xz = std::make_unique<XzSource>();
+        if (xz->open(path)) s = std::move(xz);
+      }
+      break;
+    }
+    case StreamCodec::BZIP2: {
+      if (threads > 1) s = open_parallel_bz2(path, threads);
+      parallel = bool(s);
+      if (!s) {
+        auto bz = std::make_unique<Bz2Source>();
+        if (bz->open(path)) s = std::move(bz);
+      }
+      break;
+    }
+    case StreamCodec::ZSTD: {
+#ifdef CBP_HAVE_ZSTD
+      auto zs = std::make_unique<ZstdSource>();
+      if (zs->open(path)) s = std::move(zs);
+#endif
+      break;
+    }
+    case StreamCodec::NONE:
+      break;
+  }
+  if (!s) return false;
+
+  // parallel sources already decode ahead
+  if (opts.prefetch && !parallel)
+    src_ = std::make_unique<PrefetchSource>(std::move(s));
+  else
+    src_ = std::move(s);
+  reset_state(0);
+
+  if (!opts.force_raw) {
+    const unsigned char* h = peek(512);
+    if (h && std::memcmp(h + 257, "ustar", 5) == 0) {
+      close();
+      return false;
+    }
   }
   return true;
 }
 
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ArchiveByteReader::open(std::unique_ptr<BlockSource> src, uint64_t base,
+                             bool prefetch)
+{
+  close();
+  if (!src) return false;
+  if (prefetch && src->compressed())
+    src_ = std::make_unique<PrefetchSource>(std::move(src));
+  else
+    src_ = std::move(src);
+  reset_state(base);
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+void ArchiveByteReader::reset_state(uint64_t base) {
+  eof_ = false;
+  blk_ = nullptr;
+  blk_sz_ = pos_ = 0;
+  base_ = base;
+  stage_.clear();
+  stage_pos_ = 0;
+}
+
+// ---------------------------------------------------------------------
+// An empty or unmappable file (a pipe, say) goes to libarchive instead.
+// ---------------------------------------------------------------------
+std::unique_ptr<BlockSource>
+ArchiveByteReader::open_plain(const std::string& path, bool huge_pages) {
+  auto ms = std::make_unique<MmapSource>();
+  if (!ms->open(path, 0, huge_pages) || !ms->plain()) return nullptr;
+  return ms;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+std::unique_ptr<BlockSource>
+ArchiveByteReader::open_parallel_xz(const std::string& path, unsigned threads) {
+  auto px = std::make_unique<ParallelXzSource>();
+  if (!px->open_index(path) || !px->worthwhile()) return nullptr;
+  px->run(0, threads);
+  return px;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+std::unique_ptr<BlockSource>
+ArchiveByteReader::open_parallel_bz2(const std::string& path, unsigned threads) {
+  auto pb = std::make_unique<ParallelBz2Source>();
+  if (!pb->open_scan(path) || pb->blocks().size() < 2) return nullptr;
+  pb->run(0, threads);
+  return pb;
+}
+
 // ---------------------------------------------------------------------
 // ---------------------------------------------------------------------
 bool ArchiveByteReader::fill() {
-  if (!a_) return false;
-  const void* blk=nullptr; size_t sz=0; la_int64_t off=0;
-  int r = archive_read_data_block(a_, &blk, &sz, &off);
-  if (r == ARCHIVE_EOF) {
-    // try next entry (tar)
-    if (next_entry()) return fill();
-    eof_ = true; return false;
-  }
-  if (r != ARCHIVE_OK) return fail("read_data_block");
-  buf_.assign(static_cast<const unsigned char*>(blk),
-              static_cast<const unsigned char*>(blk)+sz);
+  if (!src_) return false;
+  const unsigned char* p = nullptr; size_t n = 0;
+  if (!src_->next(&p, &n)) { eof_ = true; return false; }
+  base_ += blk_sz_;
+  blk_ = p;
+  blk_sz_ = n;
   pos_ = 0;
   return true;
 }
@@ -95,40 +192,108 @@ bool ArchiveByteReader::fill() {
 // ---------------------------------------------------------------------
 // ---------------------------------------------------------------------
 size_t ArchiveByteReader::read(void* dst, size_t n) {
-  if (!a_ || eof_ || n==0) return 0;
+  if (!src_ || n==0) return 0;
   unsigned char* out = static_cast<unsigned char*>(dst);
   size_t copied = 0;
+
+  // staged bytes come first
+  if (stage_pos_ < stage_.size()) {
+    size_t avail = stage_.size() - stage_pos_;
+    size_t take = (n < avail) ? n : avail;
+    std::memcpy(out, stage_.data() + stage_pos_, take);
+    stage_pos_ += take;
+    copied += take;
+  }
+
   while (copied < n) {
-    if (pos_ >= buf_.size()) {
-      if (!fill()) break;
+    if (pos_ >= blk_sz_) {
+      if (eof_ || !fill()) break;
     }
-    size_t avail = buf_.size() - pos_;
+    size_t avail = blk_sz_ - pos_;
     size_t take = (n - copied < avail) ? (n - copied) : avail;
-    std::memcpy(out + copied, buf_.data() + pos_, take);
+    std::memcpy(out + copied, blk_ + pos_, take);
     pos_ += take;
     copied += take;
   }
-  if (copied==0 && eof_) return 0;
   return copied;
 }
 
 // ---------------------------------------------------------------------
+// Gather 'n' bytes that straddle a block boundary into stage_.
 // ---------------------------------------------------------------------
-bool ArchiveByteReader::fail(const char* where){
-  if (a_) std::fprintf(stderr, "%s: %s\n", where, archive_error_string(a_));
-  return false;
+const unsigned char* ArchiveByteReader::peek_slow(size_t n) {
+  if (!src_) return nullptr;
+
+  // compact: drop the already consumed prefix of the stage
+  if (stage_pos_ > 0) {
+    stage_.erase(stage_.begin(), stage_.begin() + stage_pos_);
+    stage_pos_ = 0;
+  }
+
+  while (stage_.size() < n) {
+    if (stage_.empty() && blk_sz_ - pos_ >= n) return blk_ + pos_;
+    if (pos_ >= blk_sz_) {
+      if (eof_ || !fill()) return nullptr; // short: bytes stay staged
+      continue;
+    }
+    size_t take = n - stage_.size();
+    if (take > blk_sz_ - pos_) take = blk_sz_ - pos_;
+    stage_.insert(stage_.end(), blk_ + pos_, blk_ + pos_ + take);
+    pos_ += take;
+  }
+  return stage_.data();
 }
 
 // ---------------------------------------------------------------------
 // ---------------------------------------------------------------------
-void ArchiveByteReader::close() {
-  if (a_) {
-    archive_read_close(a_);
-    archive_read_free(a_);
-    a_ = nullptr;
+void ArchiveByteReader::consume_slow(size_t n) {
+  size_t avail = stage_.size() - stage_pos_;
+  if (n <= avail) { stage_pos_ += n; return; }
+  stage_pos_ = stage_.size();
+  pos_ += n - avail;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+uint64_t ArchiveByteReader::skip(uint64_t n) {
+  uint64_t done = 0;
+  while (done < n) {
+    const unsigned char* p = nullptr;
+    size_t avail = contiguous(&p);
+    if (avail == 0) {
+      if (eof_ || !fill()) break;
+      continue;
+    }
+    if (avail > n - done) avail = size_t(n - done);
+    consume(avail);
+    done += avail;
+  }
+  return done;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ArchiveByteReader::next_block(const unsigned char** p, size_t* n) {
+  if (stage_pos_ < stage_.size()) {
+    *p = stage_.data() + stage_pos_;
+    *n = stage_.size() - stage_pos_;
+    stage_pos_ = stage_.size();
+    return true;
+  }
+  if (pos_ >= blk_sz_) {
+    if (eof_ || !fill()) return false;
   }
+  *p = blk_ + pos_;
+  *n = blk_sz_ - pos_;
+  pos_ = blk_sz_;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+void ArchiveByteReader::close() {
+  src_.reset();
+  reset_state(0);
   eof_ = true;
-  buf_.clear();
-  pos_ = 0;
 }
 
@@ -0,0 +1,166 @@
+#include "cbp_fmt.h"
+#include <cstring>
+
+template<typename T>
+static inline unsigned char* put_raw(unsigned char* p, T v) {
+  std::memcpy(p, &v, sizeof(T));
+  return p + sizeof(T);
+}
+
+// -----------------------------------------------------------------------------
+// Output registers and values of a non-store, as populateNewInstr()
+// walks them: one piece per integer output, and a second piece with the
+// upper half for a non-integer output whose upper half is non-zero.
+// -----------------------------------------------------------------------------
+namespace {
+
+struct Outs {
+  uint8_t  n = 0;
+  uint8_t  reg[TraceReader::kMaxRegs];
+  uint64_t lo[TraceReader::kMaxRegs], hi[TraceReader::kMaxRegs];
+};
+
+void gather_outs(const db_t* pc, size_t m, Outs& o) {
+  for (size_t i = 0; i < m && o.n < 255; ) {
+    const db_operand_t& d = pc[i].D;
+    if (!d.valid) { ++i; continue; }
+    const uint8_t r = uint8_t(d.log_reg);
+    o.reg[o.n] = r;
+    o.lo[o.n]  = d.value;
+    o.hi[o.n]  = 0;
+    ++i;
+    if (!reg_is_int(r) && i < m && pc[i].D.valid && pc[i].D.log_reg == r)
+      o.hi[o.n] = pc[i++].D.value;
+    ++o.n;
+  }
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+// The reader cracks a record into at most 255 outputs (or store values)
+// plus the base update, all of the record's class but the last, and
+// splits the memory size evenly over the memory pieces.
+// -----------------------------------------------------------------------------
+bool cbp_encodable(const db_t* pc, size_t n, const char** why)
+{
+  const InstClass cls = pc[0].insn_class;
+  const bool base = is_mem(cls) && n >= 2 && pc[n - 1].insn_class != cls;
+  const size_t m = n - base;
+
+  if (m > 255) { *why = "more than 255 pieces"; return false; }
+  for (size_t i = 1; i < m; ++i)
+    if (pc[i].insn_class != cls) {
+      *why = "pieces of one instruction differ in class";
+      return false;
+    }
+  if (base && (pc[n - 1].insn_class != InstClass::aluInstClass
+               || !pc[n - 1].D.valid)) {
+    *why = "pieces of one instruction differ in class";
+    return false;
+  }
+  if (!is_mem(cls)) return true;
+
+  bool reg_off = false;
+  for (size_t i = 0; i < m; ++i) {
+    if (pc[i].size == 0) { *why = "memory op without a size"; return false; }
+    if (pc[i].size != pc[0].size) {
+      *why = "memory pieces differ in size";
+      return false;
+    }
+    reg_off |= pc[i].C.valid;
+  }
+  const bool flat = m > 1 && pc[1].addr == pc[0].addr;
+  const uint64_t size = flat ? 0 : pc[0].size * m;
+  if (size > 255) { *why = "memory size over 255 bytes"; return false; }
+
+  // a store is read back as one piece per value (one without values)
+  if (is_store(cls)) {
+    size_t vals = 0;
+    for (size_t i = 0; i < m; ++i) vals += (reg_off ? pc[i].C : pc[i].B).valid;
+    if (m != (vals ? vals : 1) || size % m != 0) {
+      *why = "store size does not split over its values";
+      return false;
+    }
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+unsigned char* encode_cbp_record(const db_t* pc, size_t n, unsigned char* p)
+{
+  const db_t& f = pc[0];
+  const InstClass cls = f.insn_class;
+
+  // A base-register update trails a load or store as an alu piece.
+  const bool base = is_mem(cls) && n >= 2 && pc[n - 1].insn_class != cls;
+  const size_t m = n - base;                 // memory pieces
+
+  p = put_raw(p, f.pc);
+  p = put_raw(p, uint8_t(cls));
+
+  bool reg_off = false;
+  if (is_mem(cls)) {
+    // equal addresses: the size was too small to split (factor 0)
+    const bool flat = m > 1 && pc[1].addr == f.addr;
+    const uint64_t size = flat ? 0 : f.size * m;
+    p = put_raw(p, f.addr);
+    p = put_raw(p, uint8_t(size));
+    p = put_raw(p, uint8_t(base));
+    if (is_store(cls)) {
+      for (size_t i = 0; i < m; ++i) reg_off |= pc[i].C.valid;
+      p = put_raw(p, uint8_t(reg_off));
+    }
+  }
+
+  if (is_br(cls)) {
+    // only conditional branches may fall through
+    const bool tkn = f.is_taken || cls != InstClass::condBranchInstClass;
+    p = put_raw(p, uint8_t(tkn));
+    if (tkn) p = put_raw(p, f.next_pc);
+  }
+
+  // inputs: address, offset and one value per piece for a store; the
+  // operands of the first piece otherwise
+  uint8_t* nin = p++;
+  *nin = 0;
+  if (is_store(cls)) {
+    p[(*nin)++] = uint8_t(f.A.log_reg);
+    if (reg_off) p[(*nin)++] = uint8_t(f.B.log_reg);
+    for (size_t i = 0; i < m && *nin < 255; ++i) {
+      const db_operand_t& v = reg_off ? pc[i].C : pc[i].B;
+      if (v.valid) p[(*nin)++] = uint8_t(v.log_reg);
+    }
+  } else {
+    for (const db_operand_t* o : { &f.A, &f.B, &f.C })
+      if (o->valid) p[(*nin)++] = uint8_t(o->log_reg);
+  }
+  p += *nin;
+
+  // outputs, then their values
+  if (is_store(cls)) {
+    p = put_raw(p, uint8_t(base));
+    if (base) {
+      *p++ = uint8_t(pc[n - 1].D.log_reg);
+      p = put_raw(p, pc[n - 1].D.value);
+    }
+    return p;
+  }
+
+  Outs o;
+  gather_outs(pc, m, o);
+  const bool base_out = base && o.n < 255;
+  // a load's base register goes first, where the traces have it; the
+  // reader moves it behind the others either way
+  p = put_raw(p, uint8_t(o.n + base_out));
+  if (base_out) *p++ = uint8_t(pc[n - 1].D.log_reg);
+  std::memcpy(p, o.reg, o.n);
+  p += o.n;
+  if (base_out) p = put_raw(p, pc[n - 1].D.value);
+  for (uint8_t i = 0; i < o.n; ++i) {
+    p = put_raw(p, o.lo[i]);
+    if (!reg_is_int(o.reg[i])) p = put_raw(p, o.hi[i]);
+  }
+  return p;
+}
@@ -1,229 +1,195 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <vector>
-#include <optional>
 #include <algorithm>
 
+#include "converter.h"
+#include "format_pipe.h"
+#include "record_source.h"
+#include "fmt_util.h"
 #include "trace_reader.h"
+#include "riscv_op.h"
+#include "shard.h"
 
-// -----------------------------------------------------------------------------
-// Normalized op (reader-agnostic) — fill from CBP reader in the adapter.
-// -----------------------------------------------------------------------------
-enum class OpKind {
-  ALU, CALL_DIR, CALL_IND, COND_BR, FP, LOAD, RET, SLOW_ALU, STORE, UNCOND_DIR, UNCOND_IND, UNKNOWN
-};
+static constexpr uint64_t kAsmBytesPerPiece = 88;  // typical line, rounded up
 
-// -----------------------------------------------------------------------------
-struct RegRef {
-  uint32_t idx = 0;         // raw reg index from CBP (may be >31)
-  std::string val_hex;      // original hex value (for comments)
-};
+// Longest line the formatters below can produce, indent and comment
+// included, without the newline.
+static constexpr size_t kMaxAsmLine = 512;
 
 // -----------------------------------------------------------------------------
-struct Op {
-  uint64_t pc = 0;
-
-  OpKind kind = OpKind::UNKNOWN;
+// One asm line rendered in place: the indent, the instruction, then the
+// "//" comment with its '/' at column comment_col (at least one space
+// after the instruction). Writers append with the put_* helpers.
+// -----------------------------------------------------------------------------
+class AsmLine {
+public:
+  AsmLine(char* out, int indent_cols, int comment_col)
+    : line_(out), left_(out + indent_cols), p_(left_), col_(comment_col)
+  {
+    std::memset(out, ' ', size_t(indent_cols));
+  }
 
-  // Branch/call metadata
-  bool     taken = false;
-  uint64_t target = 0;
+  template<size_t N>
+  AsmLine& s(const char (&lit)[N]) { p_ = put(p_, lit); return *this; }
+  AsmLine& s(const char* str)      { p_ = put(p_, str); return *this; }
+  AsmLine& c(char ch)              { *p_++ = ch; return *this; }
+  AsmLine& dec(uint64_t v)         { p_ = put_dec(p_, v); return *this; }
+  AsmLine& hex(uint64_t v)         { p_ = put_hex_uc(p_, v); return *this; }
+  AsmLine& hexl(uint64_t v)        { p_ = put_hex(p_, v); return *this; }
+  AsmLine& flag(bool b)            { *p_++ = b ? '1' : '0'; return *this; }
+
+  // Start the comment: trim the instruction, pad to the comment column.
+  AsmLine& comment() {
+    while (p_ > left_ && (p_[-1] == ' ' || p_[-1] == '\t')) --p_;
+    int pad = col_ - int(p_ - line_);
+    if (pad < 1) pad = 1;
+    std::memset(p_, ' ', size_t(pad));
+    p_ += pad;
+    return *this;
+  }
 
-  // Memory
-  uint64_t ea = 0;
-  uint32_t size = 0;        // bytes
+  char* end() const { return p_; }
 
-  // Registers
-  std::vector<RegRef> inputs;     // R1, R2, R3 in docs
-  std::optional<RegRef> output;   // RD (destination)
+private:
+  char* line_;   // physical line start
+  char* left_;   // after the indent
+  char* p_;
+  int   col_;
 };
 
 // -----------------------------------------------------------------------------
-// Helper: register naming & capping rules (from docs).
-// -----------------------------------------------------------------------------
-static inline uint32_t cap_reg(uint32_t raw) {
-  // "Any operands which exceed their encoding range are capped at the maximum value."
-  // For RISC-V integer regs, cap to x31.
-  return std::min<uint32_t>(raw, 31);
-}
-
-// -----------------------------------------------------------------------------
-// RD special cases:
-//   - RD:64 => x31
-//   - RD:0  => x1  (avoid nop optimizations)
-// Inputs: just cap >31 to 31; allow x0.
-// -----------------------------------------------------------------------------
-static inline std::string rd_name(uint32_t rd_raw) {
-  if (rd_raw == 64) return "x31";
-  if (rd_raw == 0)  return "x1";
-  return std::string("x") + std::to_string(cap_reg(rd_raw));
-}
-// -----------------------------------------------------------------------------
-// -----------------------------------------------------------------------------
-static inline std::string rx_name(uint32_t r_raw) {
-  return std::string("x") + std::to_string(cap_reg(r_raw));
-}
-
-// -----------------------------------------------------------------------------
-// Format hex like 0xABC or ABC (docs mix styles; we'll use uppercase hex w/o 0x in comments to match examples)
-// -----------------------------------------------------------------------------
-static inline std::string hex_uc(uint64_t v) {
-  char buf[32];
-  std::snprintf(buf, sizeof(buf), "%llX", (unsigned long long)v);
-  return std::string(buf);
-}
-// -----------------------------------------------------------------------------
-static inline std::string hex_uc_pref(uint64_t v) {
-  char buf[34];
-  std::snprintf(buf, sizeof(buf), "0x%llX", (unsigned long long)v);
-  return std::string(buf);
-}
-
-// -----------------------------------------------------------------------------
-// Offsets & masking helpers.
-// JAL: 20-bit signed; BR/JALR: 12-bit signed. We also echo masked hex like examples (e.g., f7c).
+// Register names per the rules in riscv_op.h.
 // -----------------------------------------------------------------------------
-static inline int64_t signed_delta(uint64_t pc, uint64_t target) {
-  return (int64_t)target - (int64_t)pc;
+static inline void rd_name(AsmLine& l, uint32_t rd_raw) {
+  l.c('x').dec(rd_reg(rd_raw));
 }
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
-static inline uint64_t mask_nbits(uint64_t v, unsigned nbits) {
-  const uint64_t mask = (nbits >= 64) ? ~0ull : ((1ull << nbits) - 1);
-  return v & mask;
-}
-// -----------------------------------------------------------------------------
-// -----------------------------------------------------------------------------
-static inline bool fits_signed_nbits(int64_t v, unsigned nbits) {
-  const int64_t minv = -(1ll << (nbits - 1));
-  const int64_t maxv =  (1ll << (nbits - 1)) - 1;
-  return (v >= minv && v <= maxv);
+static inline void rx_name(AsmLine& l, uint32_t r_raw) {
+  l.c('x').dec(cap_reg(r_raw));
 }
 
 // -------------------------------------------------------------------------
-// ASM formatting per op kind (returns full line including trailing metadata).
-// Note: Where the spec/examples are inconsistent, we follow the commentary
+// ASM formatting per op kind (writes the full line including trailing
+// metadata). Hex in the instruction and PC/TAR/EA/OFF metadata is upper
+// case without 0x to match the doc examples; register values are lower
+// case. Where the spec/examples are inconsistent, we follow the commentary
 // rules and add clear TODOs where you may want to tweak behavior.
 // -------------------------------------------------------------------------
-static std::string fmt_meta_pc(uint64_t pc) {
-  return std::string("//PC:") + hex_uc(pc);
+static inline void fmt_meta_pc(AsmLine& l, uint64_t pc) {
+  l.comment().s("//PC:").hex(pc);
 }
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
-static std::string fmt_reg_meta(const char* tag, const RegRef& r) {
-  // e.g., " RD:64 V:6"  or  " R1:10 V:deadbeef"
-  return std::string(" ") + tag + ":" + std::to_string(r.idx) + " V:" + r.val_hex;
+static inline void fmt_reg_meta(AsmLine& l, const char* tag, const RegRef& r) {
+  // e.g., "  RD:64 V:6"  or  "  R1:10 V:deadbeef"
+  l.s("  ").s(tag).c(':').dec(r.idx).s(" V:").hexl(r.val);
 }
 
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
-static std::string format_alu(const Op& op) {
-  const size_t n_in = op.inputs.size();
-  const bool has_rd = op.output.has_value();
+static void format_alu(const Op& op, AsmLine& l) {
+  const uint32_t n_in = op.n_in;
+  const bool has_rd = op.has_out;
+  const RegRef* in = op.inputs;
 
   // No operands
   if (!has_rd && n_in == 0) {
-    return "fence.i          " + fmt_meta_pc(op.pc);
+    l.s("fence.i");
+    fmt_meta_pc(l, op.pc);
+    return;
   }
 
   // One input (no RD in CBP) => "add x1, xR1" (use x1 as RD per docs)
   if (!has_rd && n_in == 1) {
-    const auto& r1 = op.inputs[0];
-    return "add x1," + rx_name(r1.idx) + "        " + fmt_meta_pc(op.pc)
-         + fmt_reg_meta(" R1", r1);
+    l.s("add x1,");
+    rx_name(l, in[0].idx);
+    fmt_meta_pc(l, op.pc);
+    fmt_reg_meta(l, "R1", in[0]);
+    return;
   }
 
   // Input + RD => "add RD, R1"
-  if (has_rd && n_in == 1) {
-    const auto& r1 = op.inputs[0];
-    const auto& rd = *op.output;
-    return "add " + rd_name(rd.idx) 
-                  + "," + rx_name(r1.idx) 
-                  + "      " 
-                  + fmt_meta_pc(op.pc)
-                  + fmt_reg_meta(" RD", rd)
-                  + fmt_reg_meta(" R1", r1);
-  }
-
   // Two inputs + RD => "add RD, R1, R2"
-  if (has_rd && n_in == 2) {
-    const auto& r1 = op.inputs[0];
-    const auto& r2 = op.inputs[1];
-    const auto& rd = *op.output;
-    return "add " + rd_name(rd.idx) + "," + rx_name(r1.idx) + "," + rx_name(r2.idx)
-         + "   " + fmt_meta_pc(op.pc)
-         + fmt_reg_meta(" RD", rd)
-         + fmt_reg_meta(" R1", r1)
-         + fmt_reg_meta(" R2", r2);
-  }
-
   // Three inputs + RD => use 4-op form shown ("fsl")
-  if (has_rd && n_in == 3) {
-    const auto& r1 = op.inputs[0];
-    const auto& r2 = op.inputs[1];
-    const auto& r3 = op.inputs[2];
-    const auto& rd = *op.output;
-    return "fsl " + rd_name(rd.idx) + "," + rx_name(r1.idx) + "," + rx_name(r2.idx) + "," + rx_name(r3.idx)
-         + " " + fmt_meta_pc(op.pc)
-         + fmt_reg_meta(" RD", rd)
-         + fmt_reg_meta(" R1", r1)
-         + fmt_reg_meta(" R2", r2)
-         + fmt_reg_meta(" R3", r3);
+  if (has_rd && n_in >= 1 && n_in <= 3) {
+    static const char* const tags[3] = { "R1", "R2", "R3" };
+    l.s(n_in == 3 ? "fsl " : "add ");
+    rd_name(l, op.output.idx);
+    for (uint32_t i = 0; i < n_in; ++i) {
+      l.c(',');
+      rx_name(l, in[i].idx);
+    }
+    fmt_meta_pc(l, op.pc);
+    fmt_reg_meta(l, "RD", op.output);
+    for (uint32_t i = 0; i < n_in; ++i) fmt_reg_meta(l, tags[i], in[i]);
+    return;
   }
 
   // Fallback
-  return "fence.i          " + fmt_meta_pc(op.pc) + "  // TODO: unhandled aluOp arity";
+  l.s("fence.i");
+  fmt_meta_pc(l, op.pc);
+  l.s("  // TODO: unhandled aluOp arity");
 }
 
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
-static std::string format_call_dir(const Op& op) {
+static void format_call_dir(const Op& op, AsmLine& l) {
   // Use RD from output if present; else x1 is conventional link 
   // (but example uses x30).
-  const std::string rd = op.output ? rd_name(op.output->idx) : std::string("x1");
   const int64_t d = signed_delta(op.pc, op.target);
   const bool fits = fits_signed_nbits(d, 20);
-  const std::string off = fits ? hex_uc_pref((uint64_t)d) : "0x0";
-  std::string line = "jal " + rd + ", " + off + "     " + fmt_meta_pc(op.pc)
-                   + "  TAR:" + hex_uc(op.target) + " OFF:" + (fits ? hex_uc((uint64_t)d) : "0")
-                   + " TKN:" + (op.taken ? "1" : "0");
-  if (!fits) line += " TOO_LRG_OFF";
-  if (op.output) line += fmt_reg_meta(" RD", *op.output);
-  return line;
+  l.s("jal ");
+  if (op.has_out) rd_name(l, op.output.idx); else l.s("x1");
+  l.s(", 0x");
+  if (fits) l.hex((uint64_t)d); else l.c('0');
+  fmt_meta_pc(l, op.pc);
+  l.s("  TAR:").hex(op.target).s(" OFF:");
+  if (fits) l.hex((uint64_t)d); else l.c('0');
+  l.s(" TKN:").flag(op.taken);
+  if (!fits) l.s(" TOO_LRG_OFF");
+  if (op.has_out) fmt_reg_meta(l, "RD", op.output);
 }
 
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
-static std::string format_call_ind(const Op& op) {
-  const std::string rd = op.output ? rd_name(op.output->idx) : std::string("x1");
-  const std::string rs = (op.inputs.size() >= 1) ? rx_name(op.inputs[0].idx) : "x0";
-  return "jalr " + rd + ", " + rs + ", 0 " + fmt_meta_pc(op.pc)
-       + "  TAR:" + hex_uc(op.target) + " OFF:0x0 TKN:" + (op.taken ? "1" : "0")
-       + (op.output ? fmt_reg_meta(" RD", *op.output) : "")
-       + (op.inputs.size() >= 1 ? fmt_reg_meta(" R1", op.inputs[0]) : "");
+static void format_call_ind(const Op& op, AsmLine& l) {
+  l.s("jalr ");
+  if (op.has_out) rd_name(l, op.output.idx); else l.s("x1");
+  l.s(", ");
+  if (op.n_in >= 1) rx_name(l, op.inputs[0].idx); else l.s("x0");
+  l.s(", 0");
+  fmt_meta_pc(l, op.pc);
+  l.s("  TAR:").hex(op.target).s(" OFF:0x0 TKN:").flag(op.taken);
+  if (op.has_out) fmt_reg_meta(l, "RD", op.output);
+  if (op.n_in >= 1) fmt_reg_meta(l, "R1", op.inputs[0]);
 }
 
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
-static std::string format_cond_br(const Op& op) {
+static void format_cond_br(const Op& op, AsmLine& l) {
   const int64_t d = signed_delta(op.pc, op.target);
   const bool fits = fits_signed_nbits(d, 12);
-  const std::string off = op.taken ? (fits ? hex_uc_pref((uint64_t)d) : "0x0") : "0";
-  std::string insn = op.taken ? "BEQ x0,x0," : "BNE x0,x0,";
-  std::string line = insn + off + "  " + fmt_meta_pc(op.pc)
-                   + "  TAR:" + hex_uc(op.target)
-                   + " OFF:" + (op.taken ? (fits ? hex_uc((uint64_t)d) : "0") : "0")
-                   + " TKN:" + (op.taken ? "1" : "0");
-  if (op.inputs.size() >= 1) line += fmt_reg_meta(" R1", op.inputs[0]);
-  if (op.taken && !fits) line += " TOO_LRG_OFF";
-  return line;
+  l.s(op.taken ? "BEQ x0,x0," : "BNE x0,x0,");
+  if (!op.taken)  l.c('0');
+  else if (fits)  l.s("0x").hex((uint64_t)d);
+  else            l.s("0x0");
+  fmt_meta_pc(l, op.pc);
+  l.s("  TAR:").hex(op.target).s(" OFF:");
+  if (op.taken && fits) l.hex((uint64_t)d); else l.c('0');
+  l.s(" TKN:").flag(op.taken);
+  if (op.n_in >= 1) fmt_reg_meta(l, "R1", op.inputs[0]);
+  if (op.taken && !fits) l.s(" TOO_LRG_OFF");
 }
 
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
-static std::string format_load(const Op& op) {
+static void format_load(const Op& op, AsmLine& l) {
   const char* mnem = "ld";
   switch (op.size) {
     case 1: mnem = "lbu"; break;
@@ -232,32 +198,30 @@ static std::string format_load(const Op& op) {
     case 8: mnem = "ld";  break;
     default: mnem = "ld"; break; // TODO: warn unknown size
   }
-  const std::string rd = op.output ? rd_name(op.output->idx) : "x0";
   // Per examples: use base x0, offset 0; EA appears only in metadata.
-  std::string line = std::string(mnem) 
-                   + "  x0, 0(x0) " 
-                   + "//PC:" + hex_uc(op.pc)
-                   + "  EA:"  + hex_uc(op.ea) 
-                   + " SZ:" + std::to_string(op.size);
-  if (op.output) line += fmt_reg_meta(" RD", *op.output);
-  if (op.inputs.size() >= 1) line += fmt_reg_meta(" R1", op.inputs[0]);
-  return line;
+  l.s(mnem).s("  x0, 0(x0)");
+  fmt_meta_pc(l, op.pc);
+  l.s("  EA:").hex(op.ea).s(" SZ:").dec(op.size);
+  if (op.has_out) fmt_reg_meta(l, "RD", op.output);
+  if (op.n_in >= 1) fmt_reg_meta(l, "R1", op.inputs[0]);
 }
 
-static std::string format_ret(const Op& op) {
+static void format_ret(const Op& op, AsmLine& l) {
   // Example shows jalr x0, x1, 0
-  std::string rs = (op.inputs.size() >= 1) ? rx_name(op.inputs[0].idx) : "x1";
-  return "jalr x0, " + rs + ", 0 //PC:" + hex_uc(op.pc)
-       + "  TAR:" + hex_uc(op.target)
-       + (op.inputs.size() >= 1 ? fmt_reg_meta(" R1", op.inputs[0]) : "");
+  l.s("jalr x0, ");
+  if (op.n_in >= 1) rx_name(l, op.inputs[0].idx); else l.s("x1");
+  l.s(", 0");
+  fmt_meta_pc(l, op.pc);
+  l.s("  TAR:").hex(op.target);
+  if (op.n_in >= 1) fmt_reg_meta(l, "R1", op.inputs[0]);
 }
 
-static std::string format_slow_alu(const Op& op) {
-  (void)op;
-  return "divu x0,x0,x0  //PC:" + hex_uc(op.pc);
+static void format_slow_alu(const Op& op, AsmLine& l) {
+  l.s("divu x0,x0,x0");
+  fmt_meta_pc(l, op.pc);
 }
 
-static std::string format_store(const Op& op) {
+static void format_store(const Op& op, AsmLine& l) {
   const char* mnem = "std";
   switch (op.size) {
     case 1: mnem = "stb"; break;
@@ -266,236 +230,124 @@ static std::string format_store(const Op& op) {
     case 8: mnem = "std"; break;
     default: mnem = "std"; break; // TODO: warn unknown size
   }
-  const std::string rs2 = (op.inputs.size() >= 2) 
-                        ? rx_name(op.inputs[1].idx) : "x0"; // data
-  const std::string rs1 = (op.inputs.size() >= 1) 
-                        ? rx_name(op.inputs[0].idx) : "x0"; // base
-  std::string line = std::string(mnem) 
-                   + " " + rs2 
-                   + ",0(" + rs1 + ") // PC:" 
-                   + hex_uc(op.pc)
-                   + " EA:" + hex_uc(op.ea) 
-                   + " SIZE:" + std::to_string(op.size);
-  if (op.inputs.size() >= 1) line += fmt_reg_meta(" R1", op.inputs[0]);
-  if (op.inputs.size() >= 2) line += fmt_reg_meta(" R2", op.inputs[1]);
-  return line;
+  l.s(mnem).c(' ');
+  if (op.n_in >= 2) rx_name(l, op.inputs[1].idx); else l.s("x0"); // data
+  l.s(",0(");
+  if (op.n_in >= 1) rx_name(l, op.inputs[0].idx); else l.s("x0"); // base
+  l.c(')').comment();
+  l.s("// PC:").hex(op.pc).s(" EA:").hex(op.ea).s(" SIZE:").dec(op.size);
+  if (op.n_in >= 1) fmt_reg_meta(l, "R1", op.inputs[0]);
+  if (op.n_in >= 2) fmt_reg_meta(l, "R2", op.inputs[1]);
 }
 
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
-static std::string format_uncond_dir(const Op& op) {
+static void format_uncond_dir(const Op& op, AsmLine& l) {
   const int64_t d = signed_delta(op.pc, op.target);
   const bool fits = fits_signed_nbits(d, 20);
-  const std::string off = fits ? hex_uc_pref((uint64_t)d) : "0x0";
-  std::string line = "jal x0," + off + " //PC:" + hex_uc(op.pc)
-                   + "  TAR:" + hex_uc(op.target)
-                   + " OFF:" + (fits ? hex_uc((uint64_t)d) : "0")
-                   + " TKN:" + (op.taken ? "1" : "0");
-  if (!fits) line += " TOO_LRG_OFF";
-  return line;
+  l.s("jal x0,0x");
+  if (fits) l.hex((uint64_t)d); else l.c('0');
+  fmt_meta_pc(l, op.pc);
+  l.s("  TAR:").hex(op.target).s(" OFF:");
+  if (fits) l.hex((uint64_t)d); else l.c('0');
+  l.s(" TKN:").flag(op.taken);
+  if (!fits) l.s(" TOO_LRG_OFF");
 }
 
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
-static std::string format_uncond_ind(const Op& op) {
+static void format_uncond_ind(const Op& op, AsmLine& l) {
   const int64_t d = signed_delta(op.pc, op.target);
   // JALR imm is 12-bit signed; examples show hex-masked form like f7c
   const uint64_t masked = mask_nbits((uint64_t)d, 12);
-  std::string rs = (op.inputs.size() >= 1) ? rx_name(op.inputs[0].idx) : "x0";
-  return "jalr x0," + rs + ",0x" + hex_uc(masked) + " //PC:" + hex_uc(op.pc)
-       + "  TAR:" + hex_uc(op.target)
-       + " OFF:" + hex_uc(masked)
-       + " TKN:" + (op.taken ? "1" : "0");
+  l.s("jalr x0,");
+  if (op.n_in >= 1) rx_name(l, op.inputs[0].idx); else l.s("x0");
+  l.s(",0x").hex(masked);
+  fmt_meta_pc(l, op.pc);
+  l.s("  TAR:").hex(op.target).s(" OFF:").hex(masked)
+   .s(" TKN:").flag(op.taken);
 }
 
 // Master formatter
-static std::string format_asm_line(const Op& op) {
+static void format_asm_line(const Op& op, AsmLine& l) {
   switch (op.kind) {
-    case OpKind::ALU:         return format_alu(op);
-    case OpKind::CALL_DIR:    return format_call_dir(op);
-    case OpKind::CALL_IND:    return format_call_ind(op);
-    case OpKind::COND_BR:     return format_cond_br(op);
-    case OpKind::FP:          return "//PC:" + hex_uc(op.pc) 
-                                     + "  // fpOp (no mapping yet)";
-    case OpKind::LOAD:        return format_load(op);
-    case OpKind::RET:         return format_ret(op);
-    case OpKind::SLOW_ALU:    return format_slow_alu(op);
-    case OpKind::STORE:       return format_store(op);
-    case OpKind::UNCOND_DIR:  return format_uncond_dir(op);
-    case OpKind::UNCOND_IND:  return format_uncond_ind(op);
-    default:                  return "//PC:" + hex_uc(op.pc) 
-                                     + "  // UNKNOWN op";
-  }
-}
-
-// lower-case hex (no 0x) to match comment examples
-static inline std::string hex_lower(uint64_t v) {
-  char b[32];
-  std::snprintf(b, sizeof b, "%llx", (unsigned long long)v);
-  return std::string(b);
-}
-
-// -----------------------------------------------------------------------------
-// -----------------------------------------------------------------------------
-static inline OpKind to_kind(InstClass c) {
-  switch (c) {
-    case InstClass::aluInstClass:                  return OpKind::ALU;
-    case InstClass::callDirectInstClass:           return OpKind::CALL_DIR;
-    case InstClass::callIndirectInstClass:         return OpKind::CALL_IND;
-    case InstClass::condBranchInstClass:           return OpKind::COND_BR;
-    case InstClass::fpInstClass:                   return OpKind::FP;
-    case InstClass::loadInstClass:                 return OpKind::LOAD;
-    case InstClass::ReturnInstClass:               return OpKind::RET;
-    case InstClass::slowAluInstClass:              return OpKind::SLOW_ALU;
-    case InstClass::storeInstClass:                return OpKind::STORE;
-    case InstClass::uncondDirectBranchInstClass:   return OpKind::UNCOND_DIR;
-    case InstClass::uncondIndirectBranchInstClass: return OpKind::UNCOND_IND;
-    default:                                       return OpKind::UNKNOWN;
-  }
-}
-
-// -----------------------------------------------------------------------------
-// -----------------------------------------------------------------------------
-static inline bool is_branch_class(InstClass c) {
-  switch (c) {
-    case InstClass::callDirectInstClass:
-    case InstClass::callIndirectInstClass:
-    case InstClass::condBranchInstClass:
-    case InstClass::ReturnInstClass:
-    case InstClass::uncondDirectBranchInstClass:
-    case InstClass::uncondIndirectBranchInstClass:
-      return true;
-    default: return false;
-  }
-}
-
-// -----------------------------------------------------------------------------
-// -----------------------------------------------------------------------------
-static inline void map_db_to_op(const db_t& d, Op& op) {
-  op = {};
-
-  // scalars
-  op.pc   = d.pc;
-  op.kind = to_kind(d.insn_class);
-
-  // branch/call meta
-  if (is_branch_class(d.insn_class)) {
-    // Prefer the field you already have; 
-    // (next_pc != pc+4) was how << prints it
-    op.taken  = d.is_taken;
-    op.target = d.next_pc;
-  } else {
-    op.taken  = false;
-    op.target = 0;
-  }
-
-  // memory meta
-  if (d.insn_class == InstClass::loadInstClass || d.is_load ||
-      d.insn_class == InstClass::storeInstClass || d.is_store) {
-    op.ea   = d.addr;
-    op.size = static_cast<uint32_t>(d.size);
-  } else {
-    op.ea = 0;
-    op.size = 0;
-  }
-
-  // inputs A/B/C (in order), using log_reg/value
-  auto push_in = [&](const db_operand_t& x){
-    if (x.valid) op.inputs.push_back(RegRef{ static_cast<uint32_t>(x.log_reg),
-                                             hex_lower(x.value) });
-  };
-  push_in(d.A);
-  push_in(d.B);
-  push_in(d.C);
-
-  // output D
-  if (d.D.valid) {
-    op.output = RegRef{ static_cast<uint32_t>(d.D.log_reg),
-                        hex_lower(d.D.value) };
+    case OpKind::ALU:         format_alu(op, l); break;
+    case OpKind::CALL_DIR:    format_call_dir(op, l); break;
+    case OpKind::CALL_IND:    format_call_ind(op, l); break;
+    case OpKind::COND_BR:     format_cond_br(op, l); break;
+    case OpKind::FP:          fmt_meta_pc(l, op.pc);
+                              l.s("  // fpOp (no mapping yet)"); break;
+    case OpKind::LOAD:        format_load(op, l); break;
+    case OpKind::RET:         format_ret(op, l); break;
+    case OpKind::SLOW_ALU:    format_slow_alu(op, l); break;
+    case OpKind::STORE:       format_store(op, l); break;
+    case OpKind::UNCOND_DIR:  format_uncond_dir(op, l); break;
+    case OpKind::UNCOND_IND:  format_uncond_ind(op, l); break;
+    default:                  fmt_meta_pc(l, op.pc);
+                              l.s("  // UNKNOWN op"); break;
   }
 }
 
 // -----------------------------------------------------------------------------
+// One asm line, newline included, rendered once in place.
 // -----------------------------------------------------------------------------
-static inline void emit_aligned_asm_line(FILE* ofp,
-                                         const std::string& raw,
-                                         int indent_cols = 4,
-                                         int comment_col = 20)
+static char* asm_line(const db_t& d, char* p)
 {
-  const std::string indent(indent_cols, ' ');
-
-  // Find the first "//"
-  const std::size_t pos = raw.find("//");
-  if (pos == std::string::npos) {
-    // No comment: just indent + raw
-    std::fputs(indent.c_str(), ofp);
-    std::fputs(raw.c_str(), ofp);
-    std::fputc('\n', ofp);
-    return;
-  }
-
-  // Split left side (instr/operands) and comment
-  std::string left = raw.substr(0, pos);
-  // Trim trailing spaces from left
-  while (!left.empty() && (left.back() == ' ' || left.back() == '\t'))
-    left.pop_back();
-
-  const std::string comment = raw.substr(pos); // includes leading "//"
-
-  // Compute padding so that the '/' of '//' lands at column `comment_col`
-  // Columns are counted from the start of the physical line, including indent.
-  const int cols_before = indent_cols + static_cast<int>(left.size());
-  int pad = comment_col - cols_before;
-  if (pad < 1) pad = 1; // at least one space before the comment
-
-  std::fputs(indent.c_str(), ofp);
-  std::fputs(left.c_str(), ofp);
-  for (int i = 0; i < pad; ++i) std::fputc(' ', ofp);
-  std::fputs(comment.c_str(), ofp);
-  std::fputc('\n', ofp);
+  Op op;
+  map_db_to_op(d, op);
+
+  AsmLine line(p, 4, 24);
+  format_asm_line(op, line);
+  p = line.end();
+  *p++ = '\n';
+  return p;
 }
 
 // -----------------------------------------------------------------------------
 // CBP to ASM
 // -----------------------------------------------------------------------------
-bool run_cbp_to_asm(const std::string& in,
-                    const std::string& out,
-                    uint64_t limit)
+bool run_cbp_to_asm(const ConvertPlan& plan)
 {
-  TraceReader tr(in.c_str());
-
-  FILE* ofp = nullptr;
-  if (!out.empty()) {
-    ofp = std::fopen(out.c_str(), "w");
-    if (!ofp) {
-      std::fprintf(stderr, "-E: run_cbp_to_asm Failed to open output: %s\n", 
-                   out.c_str());
-      return false;
-    }
-  } else {
-    ofp = stdout;
+  const std::string& out = plan.out.path;
+
+  ArchiveWriter w;
+  w.use_io_uring(plan.opt.io_uring);
+  if (!w.open(out, plan.opt.level, plan.opt.compress_threads)) {
+    std::fprintf(stderr, "-E: run_cbp_to_asm Failed to open output: %s (%s)\n",
+                 out.c_str(), w.error().c_str());
+    return false;
   }
 
-  uint64_t n = 0;
-
-  std::fputs(".section .text\n", ofp);
-  std::fputs(".global _start\n", ofp);
-  std::fputs("\n", ofp);
-  std::fputs("_start:\n", ofp);
+  w.preallocate(estimate_pieces(plan) * kAsmBytesPerPiece);
 
-  while (limit == ~0ULL || n < limit) {
-    db_t* d = tr.get_inst();
-    if(!d) break;
-
-    Op op{};
-    map_db_to_op(*d, op);
-
-    const std::string line = format_asm_line(op);
-    emit_aligned_asm_line(ofp, line, 4, 24);
+  uint64_t n = 0;
 
-    ++n;
+  w.write(".section .text\n");
+  w.write(".global _start\n");
+  w.write("\n");
+  w.write("_start:\n");
+
+  const ShardResult sr = run_sharded(plan, w,
+      [](TraceReader& tr, ArchiveWriter& sw, uint64_t* cnt) {
+        return format_range(tr, sw, ~0ULL, 1, asm_line,
+                            kMaxAsmLine + 1, cnt);
+      }, &n);
+
+  bool ok = (sr == ShardResult::OK);
+  if (sr == ShardResult::SERIAL) {
+    std::string err;
+    std::unique_ptr<RecordSource> src = open_records(plan, &err);
+    if (!src) std::fprintf(stderr, "-E: %s\n", err.c_str());
+    ok = src
+      && (src->set_window(plan.opt.skip, plan.opt.end) || !src->error())
+      && format_range(*src, w, plan.limit, plan.opt.format_threads,
+                      asm_line, kMaxAsmLine + 1, &n);
   }
 
-  if (ofp && ofp != stdout) std::fclose(ofp);
-  return true;
+  if (!w.close()) {
+    std::fprintf(stderr, "-E: writing %s: %s\n",
+                 out.empty() ? "stdout" : out.c_str(), w.error().c_str());
+    ok = false;
+  }
+  return ok;
 }
@@ -0,0 +1,226 @@
+#include "converter.h"
+#include "cbp_fmt.h"
+#include "cbpc.h"
+#include "format_pipe.h"
+#include "record_source.h"
+#include "trace_reader.h"
+#include "io_archive.h"
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+// Takes one CBP record.
+using RecordFn = std::function<bool(const unsigned char* p, size_t n)>;
+
+// -------------------------------------------------------------------------
+// CBP input, whole: the decompressed bytes go to the writer as they are.
+// -------------------------------------------------------------------------
+static bool copy_bytes(const ConvertPlan& plan, ArchiveWriter& w,
+                       uint64_t* bytes)
+{
+  ArchiveByteReader rdr;
+  if (!rdr.open(plan.in.path, plan.opt.rd)) {
+    std::fprintf(stderr, "-E: cannot open %s\n", plan.in.path.c_str());
+    return false;
+  }
+  const unsigned char* p;
+  size_t n;
+  while (rdr.next_block(&p, &n) && w.write(p, n)) *bytes += n;
+  if (rdr.failed()) {
+    std::fprintf(stderr, "-E: %s: %s\n", plan.in.path.c_str(),
+                 rdr.error().c_str());
+    return false;
+  }
+  return !w.failed();
+}
+
+// -------------------------------------------------------------------------
+// CBP input, windowed: records are found by their length alone and copied.
+// -------------------------------------------------------------------------
+static bool copy_records(const ConvertPlan& plan, const RecordFn& emit,
+                         uint64_t* recs)
+{
+  TraceReader tr(plan.in.path.c_str(), plan.opt.rd);
+  tr.set_quiet(true);
+  if (!tr.set_window(plan.opt.skip, plan.opt.end) && tr.error()) return false;
+
+  const unsigned char* p;
+  size_t n;
+  bool ok = true;
+  while (ok && tr.rawInstr(&p, &n)) {
+    ok = emit(p, n);
+    ++*recs;
+  }
+  return ok && !tr.error();
+}
+
+// -------------------------------------------------------------------------
+// One instruction's pieces as a record. A group no record cracks into
+// (edited or hand-written input) stops the conversion at the piece that
+// ends it, 'at' in the source's last batch, instead of writing a record
+// that would not read back.
+// -------------------------------------------------------------------------
+static bool encode_one(const RecordSource& src, size_t at,
+                       const std::vector<db_t>& ins, uint64_t rec_no,
+                       unsigned char* rec, const RecordFn& emit)
+{
+  const char* why = nullptr;
+  if (!cbp_encodable(ins.data(), ins.size(), &why)) {
+    const std::string where = src.where(at);
+    if (where.empty())
+      std::fprintf(stderr, "-E: instruction %llu: cannot encode as CBP (%s)\n",
+                   (unsigned long long)rec_no, why);
+    else
+      std::fprintf(stderr, "-E: %s: cannot encode as CBP (%s)\n",
+                   where.c_str(), why);
+    return false;
+  }
+  const unsigned char* e = encode_cbp_record(ins.data(), ins.size(), rec);
+  return emit(rec, size_t(e - rec));
+}
+
+// -------------------------------------------------------------------------
+// Any other input: pieces are gathered per instruction and encoded. A
+// piece limit is rounded up to the end of the instruction it falls in.
+// -------------------------------------------------------------------------
+static bool encode_records(RecordSource& src, const RecordFn& emit,
+                           uint64_t limit, uint64_t* recs)
+{
+  std::vector<db_t> batch(kFormatBatch);
+  std::vector<db_t> ins;          // pieces of the current instruction
+  std::vector<unsigned char> rec(kMaxCbpRecord);
+  bool ok = true;
+  size_t last = 0;                // batch slot of the latest piece
+
+  uint64_t n = 0;
+  for (;;) {
+    size_t want = batch.size();
+    if (limit != ~0ULL) {
+      if (n >= limit && ins.empty()) break;
+      if (n >= limit) want = 1;
+      else if (limit - n < want) want = size_t(limit - n);
+    }
+
+    const size_t got = src.get_batch(batch.data(), want);
+    if (got == 0) break;
+    n += got;
+
+    for (size_t i = 0; ok && i < got; ++i) {
+      ins.push_back(batch[i]);
+      if (!batch[i].is_last_piece) continue;
+      ok = encode_one(src, i, ins, *recs, rec.data(), emit);
+      ins.clear();
+      *recs += ok;
+    }
+    last = got - 1;
+    if (!ok) break;
+  }
+
+  // an input that ends inside an instruction still gets its record
+  if (ok && !ins.empty() && !src.error()) {
+    ok = encode_one(src, last, ins, *recs, rec.data(), emit);
+    *recs += ok;
+  }
+  return ok && !src.error();
+}
+
+// -------------------------------------------------------------------------
+// Records of any readable input, in the plan's window: copied from a CBP
+// trace without a piece limit, encoded otherwise.
+// -------------------------------------------------------------------------
+static bool each_record(const ConvertPlan& plan, const RecordFn& emit,
+                        uint64_t* recs)
+{
+  const bool cbp = plan.in.fmt == BaseFmt::CBP_BIN
+                || plan.in.fmt == BaseFmt::CBPC;
+  if (cbp && plan.limit == ~0ULL) return copy_records(plan, emit, recs);
+
+  std::string err;
+  std::unique_ptr<RecordSource> src = open_records(plan, &err);
+  if (!src) std::fprintf(stderr, "-E: %s\n", err.c_str());
+  return src
+    && (src->set_window(plan.opt.skip, plan.opt.end) || !src->error())
+    && encode_records(*src, emit, plan.limit, recs);
+}
+
+// -------------------------------------------------------------------------
+// -> CBP path. CBP (and .cbpc) inputs without a piece limit are
+// recompressed without being decoded; everything else goes through the
+// encoder.
+// -------------------------------------------------------------------------
+bool run_cbp_to_cbp(const ConvertPlan& plan)
+{
+  const std::string& out = plan.out.path;
+
+  ArchiveWriter w;
+  w.use_io_uring(plan.opt.io_uring);
+  if (!w.open(out, plan.opt.level, plan.opt.compress_threads)) {
+    std::fprintf(stderr, "Failed to open output: %s (%s)\n", out.c_str(),
+                 w.error().c_str());
+    return false;
+  }
+
+  const bool whole = (plan.in.fmt == BaseFmt::CBP_BIN
+                      || plan.in.fmt == BaseFmt::CBPC)
+                  && plan.limit == ~0ULL
+                  && plan.opt.skip == 0 && plan.opt.end == ~0ULL;
+
+  bool ok;
+  uint64_t n = 0;
+  if (whole) {
+    ok = copy_bytes(plan, w, &n);
+  } else {
+    ok = each_record(plan, [&](const unsigned char* p, size_t k) {
+           return w.write(p, k);
+         }, &n);
+  }
+
+  if (!w.close()) {
+    std::fprintf(stderr, "-E: writing %s: %s\n",
+                 out.empty() ? "stdout" : out.c_str(), w.error().c_str());
+    ok = false;
+  }
+  if (whole)
+    std::fprintf(stderr, "CBP bytes copied=%llu\n", (unsigned long long)n);
+  else
+    std::fprintf(stderr, "CBP records emitted=%llu\n", (unsigned long long)n);
+  return ok;
+}
+
+// -------------------------------------------------------------------------
+// -> .cbpc path. Same records as the CBP path, split into columns.
+// -------------------------------------------------------------------------
+bool run_cbp_to_cbpc(const ConvertPlan& plan)
+{
+  const std::string& out = plan.out.path;
+
+  ArchiveWriter w;
+  w.use_io_uring(plan.opt.io_uring);
+  if (!w.open(out, -1, 1)) {
+    std::fprintf(stderr, "Failed to open output: %s (%s)\n", out.c_str(),
+                 w.error().c_str());
+    return false;
+  }
+
+  CbpcWriter cw(w, plan.opt.level);
+  uint64_t n = 0;
+  bool ok = each_record(plan, [&](const unsigned char* p, size_t k) {
+              if (cw.add(p, k)) return true;
+              std::fprintf(stderr, "-E: cannot store record %llu in %s\n",
+                           (unsigned long long)cw.instrs(), out.c_str());
+              return false;
+            }, &n);
+  ok = cw.finish() && ok;
+
+  if (!w.close()) {
+    std::fprintf(stderr, "-E: writing %s: %s\n", out.c_str(),
+                 w.error().c_str());
+    ok = false;
+  }
+  std::fprintf(stderr, "CBPC records stored=%llu (%llu bytes)\n",
+               (unsigned long long)n, (unsigned long long)cw.bytes());
+  return ok;
+}
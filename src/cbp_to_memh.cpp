@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "converter.h"
+#include "fmt_util.h"
+#include "format_pipe.h"
+#include "io_archive.h"
+#include "record_source.h"
+#include "riscv_op.h"
+#include "shard.h"
+#include "trace_reader.h"
+
+// -----------------------------------------------------------------------------
+// $readmemh output: one 32-bit RISC-V word per piece, 8 hex digits a
+// line, the instruction format_asm_line() would print for it. The
+// optional sidecars <stem>.ea.memh and <stem>.val.memh hold, line for
+// line, the piece's effective address and its output value as 16 hex
+// digits (0 where there is none), for RTL that loads them alongside.
+// -----------------------------------------------------------------------------
+
+static constexpr uint64_t kMemhBytesPerPiece = 9;
+static constexpr size_t   kMaxMemhLine = 8;
+static constexpr size_t   kMaxMetaLine = 16;
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+static char* memh_line(const db_t& d, char* p)
+{
+  Op op;
+  map_db_to_op(d, op);
+  p = put_hex8(p, rv_encode(op));
+  *p++ = '\n';
+  return p;
+}
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+static char* ea_line(const db_t& d, char* p)
+{
+  const bool mem = d.is_load || d.is_store
+                || d.insn_class == InstClass::loadInstClass
+                || d.insn_class == InstClass::storeInstClass;
+  p = put_hex16(p, mem ? d.addr : 0);
+  *p++ = '\n';
+  return p;
+}
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+static char* val_line(const db_t& d, char* p)
+{
+  p = put_hex16(p, d.D.valid ? d.D.value : 0);
+  *p++ = '\n';
+  return p;
+}
+
+// -----------------------------------------------------------------------------
+// "trace.memh.gz" -> "trace.<tag>.memh.gz"
+// -----------------------------------------------------------------------------
+static std::string sidecar_path(const std::string& out, const char* tag)
+{
+  std::string low(out);
+  std::transform(low.begin(), low.end(), low.begin(),
+                 [](unsigned char c){ return char(std::tolower(c)); });
+  const size_t at = low.rfind(".memh");
+  return out.substr(0, at) + "." + tag + out.substr(at);
+}
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+static bool open_out(ArchiveWriter& w, const std::string& path,
+                     const ConvertPlan& plan)
+{
+  w.use_io_uring(plan.opt.io_uring);
+  if (w.open(path, plan.opt.level, plan.opt.compress_threads)) return true;
+  std::fprintf(stderr, "-E: run_cbp_to_memh Failed to open output: %s (%s)\n",
+               path.c_str(), w.error().c_str());
+  return false;
+}
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+static bool close_out(ArchiveWriter& w, const std::string& path)
+{
+  if (w.close()) return true;
+  std::fprintf(stderr, "-E: writing %s: %s\n",
+               path.empty() ? "stdout" : path.c_str(), w.error().c_str());
+  return false;
+}
+
+// -----------------------------------------------------------------------------
+// Words and both sidecars from one pass over 'src', a decode batch at a
+// time.
+// -----------------------------------------------------------------------------
+static bool memh_range(RecordSource& src, ArchiveWriter& w, ArchiveWriter& ea,
+                       ArchiveWriter& val, uint64_t limit, uint64_t* count)
+{
+  std::vector<db_t> batch(kFormatBatch);
+
+  uint64_t n = 0;
+  while (limit == ~0ULL || n < limit) {
+    size_t want = batch.size();
+    if (limit != ~0ULL && limit - n < want) want = size_t(limit - n);
+
+    const size_t got = src.get_batch(batch.data(), want);
+    if (got == 0) break;
+
+    char* p = w.reserve(got * (kMaxMemhLine + 1));
+    char* q = ea.reserve(got * (kMaxMetaLine + 1));
+    char* r = val.reserve(got * (kMaxMetaLine + 1));
+    if (!p || !q || !r) break;
+    for (size_t i = 0; i < got; ++i) {
+      p = memh_line(batch[i], p);
+      q = ea_line(batch[i], q);
+      r = val_line(batch[i], r);
+    }
+    w.commit(p);
+    ea.commit(q);
+    val.commit(r);
+    n += got;
+    if (w.failed() || ea.failed() || val.failed()) break;
+  }
+  *count = n;
+  return !src.error() && !w.failed() && !ea.failed() && !val.failed();
+}
+
+// -----------------------------------------------------------------------------
+// CBP to MEMH
+// -----------------------------------------------------------------------------
+bool run_cbp_to_memh(const ConvertPlan& plan)
+{
+  const std::string& out = plan.out.path;
+
+  ArchiveWriter w;
+  if (!open_out(w, out, plan)) return false;
+  w.preallocate(estimate_pieces(plan) * kMemhBytesPerPiece);
+
+  uint64_t n = 0;
+  bool ok;
+
+  if (plan.opt.memh_sidecars) {
+    const std::string ea_path  = sidecar_path(out, "ea");
+    const std::string val_path = sidecar_path(out, "val");
+    ArchiveWriter ea, val;
+    ok = open_out(ea, ea_path, plan) && open_out(val, val_path, plan);
+
+    std::string err;
+    std::unique_ptr<RecordSource> src = ok ? open_records(plan, &err) : nullptr;
+    if (ok && !src) std::fprintf(stderr, "-E: %s\n", err.c_str());
+    ok = src
+      && (src->set_window(plan.opt.skip, plan.opt.end) || !src->error())
+      && memh_range(*src, w, ea, val, plan.limit, &n);
+
+    ok = close_out(ea, ea_path) && ok;
+    ok = close_out(val, val_path) && ok;
+  } else {
+    const ShardResult sr = run_sharded(plan, w,
+        [](TraceReader& tr, ArchiveWriter& sw, uint64_t* cnt) {
+          return format_range(tr, sw, ~0ULL, 1, memh_line,
+                              kMaxMemhLine + 1, cnt);
+        }, &n);
+
+    ok = (sr == ShardResult::OK);
+    if (sr == ShardResult::SERIAL) {
+      std::string err;
+      std::unique_ptr<RecordSource> src = open_records(plan, &err);
+      if (!src) std::fprintf(stderr, "-E: %s\n", err.c_str());
+      ok = src
+        && (src->set_window(plan.opt.skip, plan.opt.end) || !src->error())
+        && format_range(*src, w, plan.limit, plan.opt.format_threads,
+                        memh_line, kMaxMemhLine + 1, &n);
+    }
+  }
+
+  return close_out(w, out) && ok;
+}
@@ -0,0 +1,69 @@
+#include "converter.h"
+#include "format_pipe.h"
+#include "record_source.h"
+#include "shard.h"
+#include "trace_reader.h"
+#include "io_archive.h"
+#include "ndjson_fmt.h"
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+
+static constexpr uint64_t kJsonBytesPerPiece = 176;  // typical line, rounded up
+
+// -------------------------------------------------------------------------
+// One NDJSON line, newline included.
+// -------------------------------------------------------------------------
+static char* json_line(const db_t& d, char* p)
+{
+  p = format_json_line(d, p);
+  *p++ = '\n';
+  return p;
+}
+
+// -------------------------------------------------------------------------
+// CBP -> NDJSON path
+// -------------------------------------------------------------------------
+bool run_cbp_to_ndjson(const ConvertPlan& plan)
+{
+  const std::string& out = plan.out.path;
+
+  // Write either to file (compressed by its suffix) or stdout
+  ArchiveWriter w;
+  w.use_io_uring(plan.opt.io_uring);
+  if (!w.open(out, plan.opt.level, plan.opt.compress_threads)) {
+    std::fprintf(stderr, "Failed to open output: %s (%s)\n", out.c_str(),
+                 w.error().c_str());
+    return false;
+  }
+
+  w.preallocate(estimate_pieces(plan) * kJsonBytesPerPiece);
+
+  uint64_t n = 0;
+  const ShardResult sr = run_sharded(plan, w,
+      [](TraceReader& tr, ArchiveWriter& sw, uint64_t* cnt) {
+        return format_range(tr, sw, ~0ULL, 1, json_line,
+                            kMaxJsonLine + 1, cnt);
+      }, &n);
+
+  bool ok = (sr == ShardResult::OK);
+  if (sr == ShardResult::SERIAL) {
+    std::string err;
+    std::unique_ptr<RecordSource> src = open_records(plan, &err);
+    if (!src) std::fprintf(stderr, "-E: %s\n", err.c_str());
+    ok = src
+      && (src->set_window(plan.opt.skip, plan.opt.end) || !src->error())
+      && format_range(*src, w, plan.limit, plan.opt.format_threads,
+                      json_line, kMaxJsonLine + 1, &n);
+  }
+
+  if (!w.close()) {
+    std::fprintf(stderr, "-E: writing %s: %s\n",
+                 out.empty() ? "stdout" : out.c_str(), w.error().c_str());
+    ok = false;
+  }
+  std::fprintf(stderr, "NDJSON lines emitted=%llu\n", (unsigned long long)n);
+  return ok;
+}
@@ -1,46 +1,70 @@
+#include "converter.h"
+#include "format_pipe.h"
+#include "record_source.h"
+#include "shard.h"
 #include "trace_reader.h"
 #include "io_archive.h"
 #include "text_fmt.h"
+#include <memory>
 #include <string>
 #include <cstdint>
 #include <cstdlib>
 #include <cstdio>
+#include <vector>
+
+static constexpr uint64_t kTextBytesPerPiece = 128;  // typical line, rounded up
+
+// -------------------------------------------------------------------------
+// One text line, newline included.
+// -------------------------------------------------------------------------
+static char* text_line(const db_t& d, char* p)
+{
+  p = format_text_line(d, p);
+  *p++ = '\n';
+  return p;
+}
+
 // -------------------------------------------------------------------------
 // CBP -> TEXT path
 // -------------------------------------------------------------------------
-bool run_cbp_to_text(const std::string& in,
-                     const std::string& out, uint64_t limit)
+bool run_cbp_to_text(const ConvertPlan& plan)
 {
-  TraceReader tr(in.c_str());
-
-  // Write either to file (any extension) or stdout
-  FILE* ofp = nullptr;
-  const bool to_file = !out.empty();
-  if (to_file) {
-    ofp = std::fopen(out.c_str(), "w");
-    if (!ofp) {
-      std::fprintf(stderr, "Failed to open output: %s\n", out.c_str());
-      return false;
-    }
-  } else {
-    ofp = stdout;
+  const std::string& out = plan.out.path;
+
+  // Write either to file (compressed by its suffix) or stdout
+  ArchiveWriter w;
+  w.use_io_uring(plan.opt.io_uring);
+  if (!w.open(out, plan.opt.level, plan.opt.compress_threads)) {
+    std::fprintf(stderr, "Failed to open output: %s (%s)\n", out.c_str(),
+                 w.error().c_str());
+    return false;
   }
 
-  uint64_t n = 0;
-  while (limit == ~0ULL || n < limit) {
-    db_t* rec = tr.get_inst();
-    if (!rec) break;
+  w.preallocate(estimate_pieces(plan) * kTextBytesPerPiece);
 
-    const std::string line = format_text_line(*rec);
-    std::fputs(line.c_str(), ofp);
-    std::fputc('\n', ofp);
+  uint64_t n = 0;
+  const ShardResult sr = run_sharded(plan, w,
+      [](TraceReader& tr, ArchiveWriter& sw, uint64_t* cnt) {
+        return format_range(tr, sw, ~0ULL, 1, text_line,
+                            kMaxTextLine + 1, cnt);
+      }, &n);
 
-    delete rec;
-    ++n;
+  bool ok = (sr == ShardResult::OK);
+  if (sr == ShardResult::SERIAL) {
+    std::string err;
+    std::unique_ptr<RecordSource> src = open_records(plan, &err);
+    if (!src) std::fprintf(stderr, "-E: %s\n", err.c_str());
+    ok = src
+      && (src->set_window(plan.opt.skip, plan.opt.end) || !src->error())
+      && format_range(*src, w, plan.limit, plan.opt.format_threads,
+                      text_line, kMaxTextLine + 1, &n);
   }
 
-  if (to_file && ofp && ofp != stdout) std::fclose(ofp);
+  if (!w.close()) {
+    std::fprintf(stderr, "-E: writing %s: %s\n",
+                 out.empty() ? "stdout" : out.c_str(), w.error().c_str());
+    ok = false;
+  }
   std::fprintf(stderr, "Text lines emitted=%llu\n", (unsigned long long)n);
-  return true;
+  return ok;
 }
-
@@ -0,0 +1,603 @@
+#include "cbpc.h"
+#include "io_archive.h"
+#include "trace_reader.h"
+#include <zlib.h>
+#ifdef CBP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+namespace {
+
+const char kMagic[4]    = { 'C','B','P','C' };
+const char kEndMagic[8] = { 'C','B','P','C','E','N','D','\0' };
+constexpr uint32_t kVersion = 1;
+constexpr size_t   kTrailer = 4 * 8 + sizeof kEndMagic;
+
+enum Stream { S_PC, S_SHAPE, S_DICT, S_TKN, S_TGT, S_EA, S_VAL, S_HI, kStreams };
+enum Codec : uint8_t { STORED, DEFLATE, ZSTD };
+
+#ifdef CBP_HAVE_ZSTD
+constexpr Codec kCodec = ZSTD;
+constexpr int   kDefaultLevel = 19;
+#else
+constexpr Codec kCodec = DEFLATE;
+constexpr int   kDefaultLevel = 9;
+#endif
+
+// output values predicted per PC
+constexpr size_t kValSlots = 4;
+
+// -----------------------------------------------------------------------------
+// Stream primitives
+// -----------------------------------------------------------------------------
+inline uint64_t zigzag(uint64_t d)   { return (d << 1) ^ uint64_t(int64_t(d) >> 63); }
+inline uint64_t unzigzag(uint64_t z) { return (z >> 1) ^ (0 - (z & 1)); }
+
+inline void put_var(std::vector<unsigned char>& s, uint64_t v) {
+  while (v >= 0x80) { s.push_back(uint8_t(v) | 0x80); v >>= 7; }
+  s.push_back(uint8_t(v));
+}
+
+// Bounds-checked reader over one decoded stream; a read past the end
+// sets 'bad' and yields zeros.
+struct In {
+  const unsigned char* p = nullptr;
+  const unsigned char* e = nullptr;
+  bool bad = false;
+
+  uint64_t var() {
+    uint64_t v = 0;
+    for (int sh = 0; sh < 64; sh += 7) {
+      if (p >= e) { bad = true; return 0; }
+      const uint8_t b = *p++;
+      v |= uint64_t(b & 0x7f) << sh;
+      if (!(b & 0x80)) return v;
+    }
+    bad = true;
+    return 0;
+  }
+  uint8_t byte() {
+    if (p >= e) { bad = true; return 0; }
+    return *p++;
+  }
+};
+
+// Where the optional groups of a record are, by class.
+struct Layout { bool mem, store, br; };
+inline Layout layout(uint8_t cls) {
+  const InstClass c = InstClass(cls);
+  return { is_mem(c), is_store(c), is_br(c) };
+}
+
+// Second value word for an output register: non-integer registers have
+// one, except a store's single (base-update) output.
+inline bool has_hi(const Layout& L, uint8_t nout, uint8_t reg) {
+  return !(L.store && nout == 1) && !reg_is_int(reg);
+}
+
+// Per-PC prediction state, reset with every block.
+struct PcState {
+  uint32_t shape = ~0u;
+  uint64_t target = 0, ea = 0, stride = 0;
+  uint64_t val[kValSlots] = {};
+  uint64_t hi[kValSlots] = {};
+};
+
+struct PcTable {
+  std::unordered_map<uint64_t, uint32_t> at;
+  std::vector<PcState> st;
+
+  // State for 'pc'; '*fresh' tells whether it was just created.
+  PcState& get(uint64_t pc, bool* fresh) {
+    auto r = at.emplace(pc, uint32_t(st.size()));
+    *fresh = r.second;
+    if (r.second) st.emplace_back();
+    return st[r.first->second];
+  }
+  void clear() { at.clear(); st.clear(); }
+};
+
+bool compress_stream(const std::vector<unsigned char>& in, int level,
+                     std::vector<unsigned char>& out, size_t* n)
+{
+  if (in.empty()) { *n = 0; return true; }
+#ifdef CBP_HAVE_ZSTD
+  out.resize(ZSTD_compressBound(in.size()));
+  const size_t r = ZSTD_compress(out.data(), out.size(), in.data(), in.size(),
+                                 level);
+  if (ZSTD_isError(r)) return false;
+  *n = r;
+#else
+  uLongf zn = compressBound(uLong(in.size()));
+  out.resize(zn);
+  if (compress2(out.data(), &zn, in.data(), uLong(in.size()),
+                level > 9 ? 9 : level) != Z_OK)
+    return false;
+  *n = zn;
+#endif
+  return true;
+}
+
+bool expand_stream(uint8_t codec, const unsigned char* p, size_t n,
+                   std::vector<unsigned char>& out, std::string* err)
+{
+  switch (codec) {
+    case STORED:
+      out.assign(p, p + n);
+      return true;
+    case DEFLATE: {
+      uLongf zn = out.size();
+      if (uncompress(out.data(), &zn, p, uLong(n)) == Z_OK && zn == out.size())
+        return true;
+      *err = "cbpc: bad deflate stream";
+      return false;
+    }
+    case ZSTD:
+#ifdef CBP_HAVE_ZSTD
+      if (ZSTD_decompress(out.data(), out.size(), p, n) == out.size())
+        return true;
+      *err = "cbpc: bad zstd stream";
+#else
+      *err = "cbpc: file uses zstd, which this build lacks";
+#endif
+      return false;
+  }
+  *err = "cbpc: unknown stream codec";
+  return false;
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool cbpc::sniff(const std::string& path) {
+  char h[sizeof kMagic];
+  FILE* f = std::fopen(path.c_str(), "rb");
+  if (!f) return false;
+  const bool ok = std::fread(h, sizeof h, 1, f) == 1
+               && std::memcmp(h, kMagic, sizeof kMagic) == 0;
+  std::fclose(f);
+  return ok;
+}
+
+// ---------------------------------------------------------------------
+// Writer
+// ---------------------------------------------------------------------
+struct CbpcWriter::Block {
+  std::vector<unsigned char> s[kStreams];
+  std::unordered_map<std::string, uint32_t> dict;
+  std::vector<std::string> shapes;
+  PcTable pcs;
+  uint64_t pred_pc = 0, last_ea = 0;
+  uint32_t n = 0;          // records
+  uint64_t bytes = 0;      // their CBP size
+  std::string key;
+
+  void reset() {
+    for (auto& v : s) v.clear();
+    dict.clear();
+    shapes.clear();
+    pcs.clear();
+    pred_pc = last_ea = 0;
+    n = 0;
+    bytes = 0;
+  }
+};
+
+CbpcWriter::CbpcWriter(ArchiveWriter& w, int level)
+  : w_(w), level_(level < 0 ? kDefaultLevel : level), blk_(new Block) {}
+
+CbpcWriter::~CbpcWriter() {}
+
+bool CbpcWriter::out(const void* p, size_t n) {
+  bytes_ += n;
+  return w_.write(p, n);
+}
+
+// ---------------------------------------------------------------------
+// Split one record over the streams. The shape key is the record minus
+// PC, address, branch outcome and values.
+// ---------------------------------------------------------------------
+bool CbpcWriter::add(const unsigned char* rec, size_t n) {
+  if (instrs_ == 0 && bytes_ == 0) {
+    if (!out(kMagic, sizeof kMagic) || !out(&kVersion, sizeof kVersion))
+      return false;
+  }
+  Block& b = *blk_;
+  const unsigned char* p = rec;
+  const unsigned char* e = rec + n;
+  auto need = [&](size_t k) { return size_t(e - p) >= k; };
+
+  uint64_t pc, ea = 0, target = 0;
+  if (!need(9)) return false;
+  std::memcpy(&pc, p, 8);
+  const uint8_t cls = p[8];
+  if (cls >= kNumInstClasses) return false;
+  p += 9;
+  const Layout L = layout(cls);
+
+  b.key.assign(1, char(cls));
+  if (L.mem) {
+    const size_t k = L.store ? 3 : 2;
+    if (!need(8 + k)) return false;
+    std::memcpy(&ea, p, 8);
+    b.key.append(reinterpret_cast<const char*>(p + 8), k);
+    p += 8 + k;
+  }
+  uint8_t tkn = 0;
+  if (L.br) {
+    if (!need(1)) return false;
+    tkn = *p++;
+    if (tkn) {
+      if (!need(8)) return false;
+      std::memcpy(&target, p, 8);
+      p += 8;
+    }
+  }
+  const unsigned char* regs = p;
+  if (!need(1) || !need(1 + size_t(p[0]) + 1)) return false;
+  const uint8_t nin = p[0];
+  const uint8_t nout = p[1 + nin];
+  if (!need(2 + size_t(nin) + nout)) return false;
+  const unsigned char* outs = p + 2 + nin;
+  p = outs + nout;
+  b.key.append(reinterpret_cast<const char*>(regs), size_t(p - regs));
+
+  bool fresh;
+  PcState& st = b.pcs.get(pc, &fresh);
+
+  // pc
+  put_var(b.s[S_PC], zigzag(pc - b.pred_pc));
+  b.pred_pc = tkn ? target : pc + 4;
+
+  // shape
+  if (!fresh && st.shape != ~0u && b.shapes[st.shape] == b.key) {
+    put_var(b.s[S_SHAPE], 0);
+  } else {
+    auto r = b.dict.emplace(b.key, uint32_t(b.shapes.size()));
+    if (r.second) {
+      b.shapes.push_back(b.key);
+      b.s[S_DICT].insert(b.s[S_DICT].end(), b.key.begin(), b.key.end());
+    }
+    st.shape = r.first->second;
+    put_var(b.s[S_SHAPE], uint64_t(st.shape) + 1);
+  }
+
+  // branch outcome
+  if (L.br) {
+    b.s[S_TKN].push_back(tkn);
+    if (tkn) {
+      put_var(b.s[S_TGT], zigzag(target - (fresh ? pc : st.target)));
+      st.target = target;
+    }
+  }
+
+  // address
+  if (L.mem) {
+    const uint64_t pred = fresh ? b.last_ea : st.ea + st.stride;
+    put_var(b.s[S_EA], zigzag(ea - pred));
+    st.stride = fresh ? 0 : ea - st.ea;
+    st.ea = ea;
+    b.last_ea = ea;
+  }
+
+  // values
+  for (uint8_t i = 0; i < nout; ++i) {
+    uint64_t v;
+    if (!need(8)) return false;
+    std::memcpy(&v, p, 8);
+    p += 8;
+    if (i < kValSlots) {
+      put_var(b.s[S_VAL], zigzag(v - st.val[i]));
+      st.val[i] = v;
+    } else {
+      put_var(b.s[S_VAL], zigzag(v));
+    }
+    if (has_hi(L, nout, outs[i])) {
+      if (!need(8)) return false;
+      std::memcpy(&v, p, 8);
+      p += 8;
+      if (i < kValSlots) {
+        put_var(b.s[S_HI], zigzag(v - st.hi[i]));
+        st.hi[i] = v;
+      } else {
+        put_var(b.s[S_HI], v);
+      }
+    }
+  }
+  if (p != e) return false;
+
+  ++b.n;
+  b.bytes += n;
+  ++instrs_;
+  uoff_ += n;
+  return b.n < cbpc::kBlockInstrs || flush_block();
+}
+
+// ---------------------------------------------------------------------
+// Block: u32 instrs, u8 codec, then per stream u32 raw and u32 stored
+// length (equal: stored as is), then the stream bytes.
+// ---------------------------------------------------------------------
+bool CbpcWriter::flush_block() {
+  Block& b = *blk_;
+  if (b.n == 0) return true;
+
+  cbpc::BlockInfo bi;
+  bi.off = bytes_;
+  bi.instr = instrs_ - b.n;
+  bi.uoff = uoff_ - b.bytes;
+  index_.push_back(bi);
+
+  std::vector<unsigned char> z[kStreams];
+  uint32_t len[kStreams][2];
+  for (int i = 0; i < kStreams; ++i) {
+    size_t zn;
+    if (!compress_stream(b.s[i], level_, z[i], &zn)) return false;
+    len[i][0] = uint32_t(b.s[i].size());
+    len[i][1] = zn < b.s[i].size() ? uint32_t(zn) : len[i][0];
+  }
+
+  const uint8_t codec = kCodec;
+  bool ok = out(&b.n, sizeof b.n) && out(&codec, 1) && out(len, sizeof len);
+  for (int i = 0; ok && i < kStreams; ++i) {
+    if (len[i][1] == len[i][0]) ok = out(b.s[i].data(), len[i][0]);
+    else                        ok = out(z[i].data(), len[i][1]);
+  }
+  b.reset();
+  return ok;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool CbpcWriter::finish() {
+  if (instrs_ == 0 && bytes_ == 0) {
+    if (!out(kMagic, sizeof kMagic) || !out(&kVersion, sizeof kVersion))
+      return false;
+  }
+  if (!flush_block()) return false;
+
+  const uint64_t footer = bytes_;
+  bool ok = true;
+  for (const cbpc::BlockInfo& bi : index_)
+    ok = ok && out(&bi.off, 8) && out(&bi.instr, 8) && out(&bi.uoff, 8);
+  const uint64_t nblk = index_.size();
+  return ok && out(&footer, 8) && out(&nblk, 8) && out(&instrs_, 8)
+            && out(&uoff_, 8) && out(kEndMagic, sizeof kEndMagic);
+}
+
+// ---------------------------------------------------------------------
+// Reader
+// ---------------------------------------------------------------------
+struct CbpcSource::State {
+  std::vector<unsigned char> s[kStreams];
+  std::vector<unsigned char> dict_bytes;
+  std::vector<uint32_t> shapes;      // offsets into s[S_DICT]
+  PcTable pcs;
+};
+
+CbpcSource::CbpcSource() : st_(new State) {}
+CbpcSource::~CbpcSource() {}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool CbpcSource::open(const std::string& path, const AccessPoint* at) {
+  if (!mf_.open(path)) return fail("open " + path);
+  const unsigned char* d = mf_.data();
+  const size_t n = mf_.size();
+  uint32_t version = 0;
+  if (n < sizeof kMagic + 4 + kTrailer || std::memcmp(d, kMagic, sizeof kMagic))
+    return fail("not a cbpc file: " + path);
+  std::memcpy(&version, d + 4, 4);
+  if (version != kVersion) return fail("unsupported cbpc version: " + path);
+
+  const unsigned char* t = d + n - kTrailer;
+  uint64_t nblk;
+  std::memcpy(&footer_, t, 8);
+  std::memcpy(&nblk, t + 8, 8);
+  std::memcpy(&instrs_, t + 16, 8);
+  std::memcpy(&bytes_, t + 24, 8);
+  if (std::memcmp(t + 32, kEndMagic, sizeof kEndMagic) != 0
+      || footer_ > n - kTrailer || nblk > (n - kTrailer - footer_) / 24)
+    return fail("cbpc: bad trailer (truncated file?): " + path);
+
+  index_.resize(size_t(nblk));
+  for (size_t i = 0; i < index_.size(); ++i) {
+    const unsigned char* f = d + footer_ + 24 * i;
+    std::memcpy(&index_[i].off, f, 8);
+    std::memcpy(&index_[i].instr, f + 8, 8);
+    std::memcpy(&index_[i].uoff, f + 16, 8);
+    // blocks follow each other; counts and offsets only grow
+    const cbpc::BlockInfo& prev = i ? index_[i - 1] : cbpc::BlockInfo{};
+    const bool first_ok = i ? index_[i].off > prev.off
+                            : index_[i].off == sizeof kMagic + 4
+                              && index_[i].instr == 0 && index_[i].uoff == 0;
+    if (!first_ok || index_[i].off >= footer_
+        || index_[i].instr < prev.instr || index_[i].instr > instrs_
+        || index_[i].uoff < prev.uoff || index_[i].uoff > bytes_)
+      return fail("cbpc: bad footer: " + path);
+  }
+
+  next_ = 0;
+  if (at && at->uoff != 0) {
+    if (at->block >= index_.size() || index_[at->block].uoff != at->uoff)
+      return fail("cbpc: no block at offset " + std::to_string(at->uoff));
+    next_ = at->block;
+  }
+  mf_.advise(next_ < index_.size() ? index_[next_].off : 0, false);
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool CbpcSource::next(const unsigned char** p, size_t* n) {
+  if (failed_ || next_ >= index_.size()) return false;
+  const size_t b = next_++;
+  if (want_point(index_[b].uoff)) {
+    AccessPoint ap;
+    ap.uoff = index_[b].uoff;
+    ap.coff = index_[b].off;
+    ap.block = uint32_t(b);
+    points_->push_back(std::move(ap));
+  }
+  if (!decode(b)) return false;
+  *p = rows_.data();
+  *n = rows_.size();
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// Rebuild block 'b' as CBP records in rows_, mirroring CbpcWriter::add().
+// ---------------------------------------------------------------------
+bool CbpcSource::decode(size_t b) {
+  State& S = *st_;
+  const unsigned char* d = mf_.data();
+  const uint64_t end = b + 1 < index_.size() ? index_[b + 1].off : footer_;
+  const uint64_t uend = b + 1 < index_.size() ? index_[b + 1].uoff : bytes_;
+  const unsigned char* p = d + index_[b].off;
+  const unsigned char* e = d + end;
+  const std::string where = " in block " + std::to_string(b);
+
+  uint32_t ninstr, len[kStreams][2];
+  uint8_t codec;
+  if (size_t(e - p) < 5 + sizeof len) return fail("cbpc: short block" + where);
+  std::memcpy(&ninstr, p, 4);
+  codec = p[4];
+  std::memcpy(len, p + 5, sizeof len);
+  p += 5 + sizeof len;
+
+  const uint64_t iend = b + 1 < index_.size() ? index_[b + 1].instr : instrs_;
+  const uint64_t rows = uend - index_[b].uoff;
+  if (ninstr != iend - index_[b].instr
+      || rows > uint64_t(ninstr) * TraceReader::kMaxRecordBytes)
+    return fail("cbpc: block does not match the footer" + where);
+
+  std::string err;
+  In in[kStreams];
+  for (int i = 0; i < kStreams; ++i) {
+    if (size_t(e - p) < len[i][1]) return fail("cbpc: short block" + where);
+    S.s[i].resize(len[i][0]);
+    const uint8_t c = len[i][1] == len[i][0] ? uint8_t(STORED) : codec;
+    if (len[i][0] && !expand_stream(c, p, len[i][1], S.s[i], &err))
+      return fail(err + where);
+    p += len[i][1];
+    in[i].p = S.s[i].data();
+    in[i].e = in[i].p + S.s[i].size();
+  }
+
+  // dictionary: each shape is self-delimiting
+  S.shapes.clear();
+  const unsigned char* q = in[S_DICT].p;
+  const unsigned char* qe = in[S_DICT].e;
+  while (q < qe) {
+    if (*q >= kNumInstClasses) return fail("cbpc: bad shape" + where);
+    const Layout L = layout(*q);
+    const size_t fixed = 1 + (L.mem ? (L.store ? 3 : 2) : 0);
+    if (size_t(qe - q) < fixed + 1) return fail("cbpc: bad shape" + where);
+    const unsigned char* r = q + fixed;
+    if (size_t(qe - r) < 2 + size_t(r[0])) return fail("cbpc: bad shape" + where);
+    const uint8_t nout = r[1 + r[0]];
+    const size_t total = fixed + 2 + r[0] + nout;
+    if (size_t(qe - q) < total) return fail("cbpc: bad shape" + where);
+    S.shapes.push_back(uint32_t(q - in[S_DICT].p));
+    q += total;
+  }
+
+  rows_.resize(size_t(rows));
+  unsigned char* o = rows_.data();
+  unsigned char* oe = o + rows_.size();
+  S.pcs.clear();
+  uint64_t pred_pc = 0, last_ea = 0;
+  auto room = [&](size_t k) { return size_t(oe - o) >= k; };
+  const std::string too_big = "cbpc: block larger than its index says" + where;
+
+  for (uint32_t k = 0; k < ninstr; ++k) {
+    const uint64_t pc = pred_pc + unzigzag(in[S_PC].var());
+    bool fresh;
+    PcState& st = S.pcs.get(pc, &fresh);
+
+    const uint64_t ref = in[S_SHAPE].var();
+    if (ref) {
+      if (ref > S.shapes.size()) return fail("cbpc: bad shape ref" + where);
+      st.shape = uint32_t(ref - 1);
+    } else if (fresh) {
+      return fail("cbpc: bad shape ref" + where);
+    }
+    const unsigned char* sh = in[S_DICT].p + S.shapes[st.shape];
+    const uint8_t cls = sh[0];
+    const Layout L = layout(cls);
+    const size_t mk = L.mem ? (L.store ? 3 : 2) : 0;
+    const unsigned char* regs = sh + 1 + mk;
+    const uint8_t nin = regs[0];
+    const uint8_t nout = regs[1 + nin];
+    const unsigned char* outs = regs + 2 + nin;
+
+    if (!room(9)) return fail(too_big);
+    std::memcpy(o, &pc, 8);
+    o[8] = cls;
+    o += 9;
+
+    if (L.mem) {
+      const uint64_t pred = fresh ? last_ea : st.ea + st.stride;
+      const uint64_t ea = pred + unzigzag(in[S_EA].var());
+      st.stride = fresh ? 0 : ea - st.ea;
+      st.ea = last_ea = ea;
+      if (!room(8 + mk)) return fail(too_big);
+      std::memcpy(o, &ea, 8);
+      std::memcpy(o + 8, sh + 1, mk);
+      o += 8 + mk;
+    }
+
+    uint8_t tkn = 0;
+    uint64_t target = 0;
+    if (L.br) {
+      tkn = in[S_TKN].byte();
+      if (!room(tkn ? 9 : 1)) return fail(too_big);
+      *o++ = tkn;
+      if (tkn) {
+        target = (fresh ? pc : st.target) + unzigzag(in[S_TGT].var());
+        st.target = target;
+        std::memcpy(o, &target, 8);
+        o += 8;
+      }
+    }
+    pred_pc = tkn ? target : pc + 4;
+
+    const size_t rl = 2 + size_t(nin) + nout;
+    if (!room(rl)) return fail(too_big);
+    std::memcpy(o, regs, rl);
+    o += rl;
+
+    for (uint8_t i = 0; i < nout; ++i) {
+      const bool hi = has_hi(L, nout, outs[i]);
+      if (!room(hi ? 16 : 8)) return fail(too_big);
+      uint64_t v;
+      if (i < kValSlots) {
+        v = st.val[i] + unzigzag(in[S_VAL].var());
+        st.val[i] = v;
+      } else {
+        v = unzigzag(in[S_VAL].var());
+      }
+      std::memcpy(o, &v, 8);
+      o += 8;
+      if (hi) {
+        if (i < kValSlots) {
+          v = st.hi[i] + unzigzag(in[S_HI].var());
+          st.hi[i] = v;
+        } else {
+          v = in[S_HI].var();
+        }
+        std::memcpy(o, &v, 8);
+        o += 8;
+      }
+    }
+  }
+
+  for (const In& s : in)
+    if (s.bad) return fail("cbpc: truncated stream" + where);
+  if (o != oe) return fail("cbpc: block size does not match its index" + where);
+  return true;
+}
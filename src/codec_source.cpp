@@ -0,0 +1,499 @@
+#include "codec_source.h"
+#include <archive.h>
+#include <bzlib.h>
+#include <lzma.h>
+#include <zlib.h>
+#ifdef CBP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include <cstdio>
+#include <cstring>
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+GzipSource::GzipSource() : zs_(new z_stream) {
+  std::memset(zs_.get(), 0, sizeof(z_stream));
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+GzipSource::~GzipSource() {
+  if (init_) inflateEnd(zs_.get());
+}
+
+// ---------------------------------------------------------------------
+// Size of the gzip member header at 'p' (RFC 1952), 0 if malformed.
+// ---------------------------------------------------------------------
+static size_t gzip_header_size(const unsigned char* p, size_t n) {
+  if (n < 10 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8) return 0;
+  const unsigned flg = p[3];
+  size_t pos = 10;
+  if (flg & 4) {                                   // FEXTRA
+    if (pos + 2 > n) return 0;
+    pos += 2 + (size_t(p[pos]) | (size_t(p[pos + 1]) << 8));
+  }
+  for (unsigned bit : { 8u, 16u }) {               // FNAME, FCOMMENT
+    if (!(flg & bit)) continue;
+    while (pos < n && p[pos]) ++pos;
+    ++pos;
+  }
+  if (flg & 2) pos += 2;                           // FHCRC
+  return pos <= n ? pos : 0;
+}
+
+// ---------------------------------------------------------------------
+// Members are inflated raw, with the wrapper parsed here: like
+// libarchive, and unlike zlib's own gzip mode, this skips the CRC-32 of
+// the output, which costs about a quarter of the decode time. From an
+// access point, prime the leftover bits of the previous byte and
+// restore the window.
+// ---------------------------------------------------------------------
+bool GzipSource::open(const std::string& path, const AccessPoint* at) {
+  if (!mf_.open(path)) return fail("open " + path);
+  mf_.advise(at ? at->coff : 0, false);
+  z_stream* zs = zs_.get();
+  if (inflateInit2(zs, -15) != Z_OK) return fail("gzip: inflateInit");
+  init_ = true;
+
+  if (!at) {
+    const size_t hdr = gzip_header_size(mf_.data(), mf_.size());
+    if (hdr == 0) return fail("gzip: bad header in " + path);
+    in_pos_ = hdr;
+    uoff_ = 0;
+  } else {
+    if (at->coff > mf_.size() || (at->bits && at->coff == 0))
+      return fail("gzip: access point outside " + path);
+    if (at->bits) {
+      const int prev = mf_.data()[at->coff - 1];
+      if (inflatePrime(zs, at->bits, prev >> (8 - at->bits)) != Z_OK)
+        return fail("gzip: inflatePrime");
+    }
+    if (!at->window.empty()
+        && inflateSetDictionary(zs, at->window.data(),
+                                uInt(at->window.size())) != Z_OK)
+      return fail("gzip: inflateSetDictionary");
+    in_pos_ = at->coff;
+    uoff_ = at->uoff;
+  }
+  out_.resize(kOutBytes);
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// zlib counts input in uInt; hand the mapping over in bounded pieces.
+// ---------------------------------------------------------------------
+bool GzipSource::feed() {
+  const uint64_t left = mf_.size() - in_pos_;
+  if (left == 0) return false;
+  const uint64_t take = left < (1u << 30) ? left : (1u << 30);
+  zs_->next_in = const_cast<Bytef*>(mf_.data() + in_pos_);
+  zs_->avail_in = uInt(take);
+  in_pos_ += take;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// End of a member: skip its trailer and continue with the next member if
+// one follows.
+// ---------------------------------------------------------------------
+bool GzipSource::next_member() {
+  z_stream* zs = zs_.get();
+  const uint64_t pos = in_pos_ - zs->avail_in + 8;
+  if (pos >= mf_.size()) return false;
+  const size_t hdr = gzip_header_size(mf_.data() + pos, mf_.size() - size_t(pos));
+  if (hdr == 0) return false; // trailing junk
+
+  if (inflateReset(zs) != Z_OK) return fail("gzip: inflateReset");
+  in_pos_ = pos + hdr;
+  zs->avail_in = 0;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+void GzipSource::remember(const unsigned char* p, size_t n) {
+  if (win_.empty()) win_.resize(kWindow);
+  if (n > kWindow) { p += n - kWindow; win_fill_ += n - kWindow; n = kWindow; }
+  const size_t at = size_t(win_fill_ % kWindow);
+  const size_t first = (n < kWindow - at) ? n : kWindow - at;
+  std::memcpy(win_.data() + at, p, first);
+  std::memcpy(win_.data(), p + first, n - first);
+  win_fill_ += n;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+void GzipSource::add_point() {
+  AccessPoint ap;
+  ap.uoff = uoff_;
+  ap.coff = in_pos_ - zs_->avail_in;
+  ap.bits = uint8_t(zs_->data_type & 7);
+
+  const size_t have = win_fill_ < kWindow ? size_t(win_fill_) : kWindow;
+  ap.window.resize(have);
+  const size_t at = size_t(win_fill_ % kWindow);
+  if (have < kWindow) {
+    std::memcpy(ap.window.data(), win_.data(), have);
+  } else {
+    std::memcpy(ap.window.data(), win_.data() + at, kWindow - at);
+    std::memcpy(ap.window.data() + (kWindow - at), win_.data(), at);
+  }
+  points_->push_back(std::move(ap));
+}
+
+// ---------------------------------------------------------------------
+// Fill one output buffer. While recording, inflate stops at every block
+// boundary so a point can be taken there.
+// ---------------------------------------------------------------------
+bool GzipSource::next(const unsigned char** p, size_t* n) {
+  if (!init_ || done_ || failed_) return false;
+  z_stream* zs = zs_.get();
+  const int flush = points_ ? Z_BLOCK : Z_NO_FLUSH;
+
+  size_t have = 0;
+  while (have < out_.size()) {
+    if (zs->avail_in == 0 && !feed()) {
+      if (have) break;
+      return fail("gzip: unexpected end of input");
+    }
+    zs->next_out = out_.data() + have;
+    zs->avail_out = uInt(out_.size() - have);
+    const int r = inflate(zs, flush);
+    const size_t got = (out_.size() - have) - zs->avail_out;
+    if (points_) remember(out_.data() + have, got);
+    have += got;
+    uoff_ += got;
+
+    if (r == Z_STREAM_END) {
+      if (!next_member()) { done_ = true; break; }
+      continue;
+    }
+    if (r == Z_BUF_ERROR && zs->avail_in == 0) continue; // wants input
+    if (r != Z_OK)
+      return fail(std::string("gzip: ") + (zs->msg ? zs->msg : "inflate error"));
+
+    // boundary between two deflate blocks (not after the last one)
+    if (points_ && (zs->data_type & 192) == 128 && want_point(uoff_))
+      add_point();
+  }
+
+  if (have == 0) return false;
+  *p = out_.data();
+  *n = have;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// Walk the frame header and block headers; no decoding.
+// ---------------------------------------------------------------------
+size_t ZstdFrameSource::frame_size(const unsigned char* p, size_t n,
+                                   bool* skippable)
+{
+  if (n < 8) return 0;
+  uint32_t magic;
+  std::memcpy(&magic, p, 4);
+
+  if ((magic & 0xFFFFFFF0u) == 0x184D2A50u) {
+    uint32_t len;
+    std::memcpy(&len, p + 4, 4);
+    *skippable = true;
+    return (uint64_t(len) + 8 <= n) ? size_t(len) + 8 : 0;
+  }
+  if (magic != 0xFD2FB528u) return 0;
+  *skippable = false;
+
+  static const unsigned kDidBytes[4] = { 0, 1, 2, 4 };
+  const uint8_t fhd = p[4];
+  const unsigned fcs_flag = fhd >> 6;
+  const bool single = (fhd >> 5) & 1;
+  const bool checksum = (fhd >> 2) & 1;
+  const unsigned fcs = (fcs_flag == 0) ? (single ? 1 : 0) : (1u << fcs_flag);
+
+  size_t pos = 5 + (single ? 0 : 1) + kDidBytes[fhd & 3] + fcs;
+  for (;;) {
+    if (pos + 3 > n) return 0;
+    const uint32_t bh = uint32_t(p[pos]) | (uint32_t(p[pos+1]) << 8)
+                      | (uint32_t(p[pos+2]) << 16);
+    const bool last = bh & 1;
+    const unsigned type = (bh >> 1) & 3;
+    const size_t size = bh >> 3;
+    if (type == 3) return 0;
+    pos += 3 + (type == 1 ? 1 : size);
+    if (last) break;
+  }
+  if (checksum) pos += 4;
+  return pos <= n ? pos : 0;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ZstdFrameSource::open(const std::string& path, const AccessPoint* at) {
+  if (!mf_.open(path)) return fail("open " + path);
+  if (at) {
+    if (at->coff >= mf_.size()) return fail("zstd: access point outside " + path);
+    pos_ = at->coff;
+    uoff_ = at->uoff;
+    frame_ = at->block;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// Each frame is a complete zstd stream and decodes on its own.
+// ---------------------------------------------------------------------
+bool ZstdFrameSource::next(const unsigned char** p, size_t* n) {
+  if (failed_) return false;
+  for (;;) {
+    if (cur_) {
+      if (cur_->next(p, n)) { uoff_ += *n; return true; }
+      if (cur_->failed()) return fail("zstd: frame " + std::to_string(frame_ - 1)
+                                      + ": " + cur_->error());
+      cur_.reset();
+    }
+    if (pos_ >= mf_.size()) return false;
+
+    bool skippable = false;
+    const size_t fsz = frame_size(mf_.data() + pos_, mf_.size() - size_t(pos_),
+                                  &skippable);
+    if (fsz == 0) return fail("zstd: bad or truncated frame at offset "
+                              + std::to_string(pos_));
+    if (skippable) { pos_ += fsz; continue; }
+
+    if (want_point(uoff_)) {
+      AccessPoint ap;
+      ap.uoff = uoff_;
+      ap.coff = pos_;
+      ap.block = frame_;
+      points_->push_back(std::move(ap));
+    }
+
+    cur_.reset(new LibarchiveSource);
+    if (!cur_->open_memory(mf_.data() + pos_, fsz, ARCHIVE_FILTER_ZSTD))
+      return fail(cur_->error());
+    pos_ += fsz;
+    ++frame_;
+  }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+StreamCodec sniff_codec(const std::string& path) {
+  unsigned char h[6] = {};
+  FILE* f = std::fopen(path.c_str(), "rb");
+  if (!f) return StreamCodec::NONE;
+  const size_t n = std::fread(h, 1, sizeof h, f);
+  std::fclose(f);
+
+  if (n >= 2 && h[0] == 0x1f && h[1] == 0x8b) return StreamCodec::GZIP;
+  if (n >= 6 && std::memcmp(h, "\xfd" "7zXZ\0", 6) == 0) return StreamCodec::XZ;
+  if (n >= 3 && std::memcmp(h, "BZh", 3) == 0) return StreamCodec::BZIP2;
+  if (n >= 4 && std::memcmp(h, "\x28\xb5\x2f\xfd", 4) == 0)
+    return StreamCodec::ZSTD;
+  return StreamCodec::NONE;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+struct XzSource::State {
+  lzma_stream s = LZMA_STREAM_INIT;
+  bool init = false;
+};
+
+XzSource::XzSource() : st_(new State) {}
+
+XzSource::~XzSource() {
+  if (st_->init) lzma_end(&st_->s);
+}
+
+// ---------------------------------------------------------------------
+// The whole mapping is the input; liblzma takes a size_t.
+// ---------------------------------------------------------------------
+bool XzSource::open(const std::string& path) {
+  if (!mf_.open(path)) return fail("open " + path);
+  mf_.advise(0, false);
+  lzma_stream& s = st_->s;
+  if (lzma_stream_decoder(&s, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+    return fail("xz: decoder init");
+  st_->init = true;
+  s.next_in = mf_.data();
+  s.avail_in = mf_.size();
+  out_.resize(kOutBytes);
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool XzSource::next(const unsigned char** p, size_t* n) {
+  if (!st_->init || done_ || failed_) return false;
+  lzma_stream& s = st_->s;
+  s.next_out = out_.data();
+  s.avail_out = out_.size();
+
+  while (s.avail_out) {
+    const lzma_ret r = lzma_code(&s, LZMA_FINISH);
+    if (r == LZMA_STREAM_END) { done_ = true; break; }
+    if (r != LZMA_OK) {
+      if (s.avail_out < out_.size()) break; // hand out what we have first
+      return fail(r == LZMA_BUF_ERROR ? "xz: unexpected end of input"
+                                      : "xz: decode error " + std::to_string(int(r)));
+    }
+  }
+
+  const size_t have = out_.size() - s.avail_out;
+  if (have == 0) return false;
+  *p = out_.data();
+  *n = have;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+struct Bz2Source::State {
+  bz_stream s;
+  bool init = false;
+  State() { std::memset(&s, 0, sizeof s); }
+};
+
+Bz2Source::Bz2Source() : st_(new State) {}
+
+Bz2Source::~Bz2Source() {
+  if (st_->init) BZ2_bzDecompressEnd(&st_->s);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool Bz2Source::open(const std::string& path) {
+  if (!mf_.open(path)) return fail("open " + path);
+  mf_.advise(0, false);
+  if (BZ2_bzDecompressInit(&st_->s, 0, 0) != BZ_OK) return fail("bz2: init");
+  st_->init = true;
+  in_pos_ = 0;
+  out_.resize(kOutBytes);
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// libbz2 counts input in unsigned int, like zlib.
+// ---------------------------------------------------------------------
+bool Bz2Source::feed() {
+  const uint64_t left = mf_.size() - in_pos_;
+  if (left == 0) return false;
+  const uint64_t take = left < (1u << 30) ? left : (1u << 30);
+  st_->s.next_in = reinterpret_cast<char*>(const_cast<unsigned char*>(mf_.data() + in_pos_));
+  st_->s.avail_in = unsigned(take);
+  in_pos_ += take;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// End of a stream: restart the decoder if another one follows.
+// ---------------------------------------------------------------------
+bool Bz2Source::next_stream() {
+  bz_stream& s = st_->s;
+  const uint64_t pos = in_pos_ - s.avail_in;
+  if (pos + 3 > mf_.size() || std::memcmp(mf_.data() + pos, "BZh", 3) != 0)
+    return false; // end of file or trailing junk
+
+  BZ2_bzDecompressEnd(&s);
+  st_->init = false;
+  std::memset(&s, 0, sizeof s);
+  if (BZ2_bzDecompressInit(&s, 0, 0) != BZ_OK) return fail("bz2: init");
+  st_->init = true;
+  in_pos_ = pos;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool Bz2Source::next(const unsigned char** p, size_t* n) {
+  if (!st_->init || done_ || failed_) return false;
+  bz_stream& s = st_->s;
+
+  size_t have = 0;
+  while (have < out_.size()) {
+    if (s.avail_in == 0 && !feed()) {
+      if (have) break;
+      return fail("bz2: unexpected end of input");
+    }
+    s.next_out = reinterpret_cast<char*>(out_.data() + have);
+    s.avail_out = unsigned(out_.size() - have);
+    const int r = BZ2_bzDecompress(&s);
+    have = out_.size() - s.avail_out;
+
+    if (r == BZ_STREAM_END) {
+      if (!next_stream()) {
+        if (failed_) return false;
+        done_ = true;
+        break;
+      }
+      continue;
+    }
+    if (r != BZ_OK) return fail("bz2: decode error " + std::to_string(r));
+  }
+
+  if (have == 0) return false;
+  *p = out_.data();
+  *n = have;
+  return true;
+}
+
+#ifdef CBP_HAVE_ZSTD
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+struct ZstdSource::State {
+  ZSTD_DStream* ds = nullptr;
+  ZSTD_inBuffer in = { nullptr, 0, 0 };
+  bool ended = true;   // between frames
+};
+
+ZstdSource::ZstdSource() : st_(new State) {}
+
+ZstdSource::~ZstdSource() {
+  if (st_->ds) ZSTD_freeDStream(st_->ds);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ZstdSource::open(const std::string& path) {
+  if (!mf_.open(path)) return fail("open " + path);
+  mf_.advise(0, false);
+  st_->ds = ZSTD_createDStream();
+  if (!st_->ds || ZSTD_isError(ZSTD_initDStream(st_->ds)))
+    return fail("zstd: decoder init");
+  st_->in = { mf_.data(), mf_.size(), 0 };
+  out_.resize(kOutBytes);
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// libzstd walks frame after frame, skippable ones included. Output may
+// still be buffered inside the decoder after the input is used up.
+// ---------------------------------------------------------------------
+bool ZstdSource::next(const unsigned char** p, size_t* n) {
+  if (!st_->ds || failed_) return false;
+  ZSTD_inBuffer& in = st_->in;
+  ZSTD_outBuffer out = { out_.data(), out_.size(), 0 };
+
+  while (out.pos < out.size) {
+    const bool no_input = in.pos >= in.size;
+    if (no_input && st_->ended) break;
+
+    const size_t before = out.pos;
+    const size_t r = ZSTD_decompressStream(st_->ds, &out, &in);
+    if (ZSTD_isError(r))
+      return fail(std::string("zstd: ") + ZSTD_getErrorName(r));
+    st_->ended = (r == 0);
+    if (st_->ended) continue;
+
+    if (no_input && out.pos == before) {
+      if (out.pos) break;
+      return fail("zstd: unexpected end of input");
+    }
+  }
+
+  if (out.pos == 0) return false;
+  *p = out_.data();
+  *n = out.pos;
+  return true;
+}
+#endif
@@ -1,14 +1,23 @@
 #include "converter.h"
+#include "trace_index.h"
 
 #include <algorithm>
 #include <cctype>
+#include <cstdio>
 #include <cstring>
 
-extern bool run_cbp_to_text(const std::string& in,
-                            const std::string& out, uint64_t limit);
+extern bool run_cbp_to_text(const ConvertPlan& plan);
 
-extern bool run_cbp_to_asm(const std::string& in,
-                           const std::string& out, uint64_t limit);
+extern bool run_cbp_to_asm(const ConvertPlan& plan);
+
+extern bool run_cbp_to_ndjson(const ConvertPlan& plan);
+
+extern bool run_cbp_to_cbp(const ConvertPlan& plan);
+
+extern bool run_cbp_to_cbpc(const ConvertPlan& plan);
+
+
+extern bool run_cbp_to_memh(const ConvertPlan& plan);
 
 // ------------------------------------
 
@@ -39,18 +48,26 @@ Comp Converter::parse_comp_suffix(std::string& stem) const {
 }
 
 BaseFmt Converter::parse_base_ext(std::string& stem) const {
+  if (strip_suffix(stem, ".cbpc"))  return BaseFmt::CBPC;
   if (strip_suffix(stem, ".cbp"))   return BaseFmt::CBP_BIN;
   if (strip_suffix(stem, ".txt"))   return BaseFmt::CBP_TEXT;
   if (strip_suffix(stem, ".jsonl")) return BaseFmt::NDJSON;
+  if (strip_suffix(stem, ".json"))  return BaseFmt::NDJSON;
   if (strip_suffix(stem, ".asm"))   return BaseFmt::ASM;   // output-only
   if (strip_suffix(stem, ".stf"))   return BaseFmt::STF;   // output-only
   if (strip_suffix(stem, ".memh"))  return BaseFmt::MEMH;  // output-only
   return BaseFmt::UNKNOWN; // no recognized base ext
 }
 
+bool Converter::has_reader(BaseFmt f) {
+  return f == BaseFmt::CBP_BIN || f == BaseFmt::CBPC
+      || f == BaseFmt::NDJSON  || f == BaseFmt::CBP_TEXT;
+}
+
 const char* Converter::fmt_name(BaseFmt f) const {
   switch (f) {
     case BaseFmt::CBP_BIN:  return "CBP_BIN";
+    case BaseFmt::CBPC:     return "CBPC";
     case BaseFmt::CBP_TEXT: return "CBP_TEXT";
     case BaseFmt::NDJSON:   return "NDJSON";
     case BaseFmt::ASM:      return "ASM";
@@ -63,14 +80,26 @@ const char* Converter::fmt_name(BaseFmt f) const {
 // --------------------------------------------------------------------------
 // --------------------------------------------------------------------------
 bool Converter::convert(const ConvertPlan& plan, std::string* err) {
-  // CBP -> text
-  if (plan.in.fmt == BaseFmt::CBP_BIN && plan.out.fmt == BaseFmt::CBP_TEXT) {
-    return cbp_to_text(plan, err);
+  if (plan.out.tar) {
+    if (err) *err = "tar outputs are not supported: " + plan.out.path;
+    return false;
   }
 
-  // CBP -> asm
-  if (plan.in.fmt == BaseFmt::CBP_BIN && plan.out.fmt == BaseFmt::ASM)
-    return cbp_to_asm(plan, err);
+  // Every reader feeds every writer.
+  if (has_reader(plan.in.fmt)) {
+    // -> text
+    if (plan.out.fmt == BaseFmt::CBP_TEXT) return cbp_to_text(plan, err);
+    // -> asm
+    if (plan.out.fmt == BaseFmt::ASM)      return cbp_to_asm(plan, err);
+    // -> NDJSON
+    if (plan.out.fmt == BaseFmt::NDJSON)   return cbp_to_ndjson(plan, err);
+    // -> CBP binary (recompressed as is when the input is CBP already)
+    if (plan.out.fmt == BaseFmt::CBP_BIN)  return cbp_to_cbp(plan, err);
+    // -> columnar CBP
+    if (plan.out.fmt == BaseFmt::CBPC)     return cbp_to_cbpc(plan, err);
+    // -> $readmemh words
+    if (plan.out.fmt == BaseFmt::MEMH)     return cbp_to_memh(plan, err);
+  }
 
   if (err) {
     *err = std::string("route not implemented: ")
@@ -89,6 +118,17 @@ bool Converter::convert(const std::string& in_path,
   return convert(plan, err);
 }
 
+// ------------------------------------------------------------------------
+// ------------------------------------------------------------------------
+bool Converter::convert(const std::string& in_path,
+                        const std::string& out_path,
+                        uint64_t limit,
+                        const ConvertOpts& opt,
+                        std::string* err) {
+  ConvertPlan plan = make_plan(in_path, out_path, limit, opt);
+  return convert(plan, err);
+}
+
 // ------------------------------------------------------------------------
 // ------------------------------------------------------------------------
 FileSpec Converter::parse_path(const std::string& path) const {
@@ -98,8 +138,9 @@ FileSpec Converter::parse_path(const std::string& path) const {
   // Work on a temporary "stem" we can strip suffixes from
   std::string stem = path;
 
-  // 1) Compression (last)
+  // 1) Compression (last), then an optional tar container
   spec.comp = parse_comp_suffix(stem);
+  spec.tar  = strip_suffix(stem, ".tar");
 
   // 2) Base format (middle)
   BaseFmt f = parse_base_ext(stem);
@@ -114,19 +155,48 @@ FileSpec Converter::parse_path(const std::string& path) const {
 // ------------------------------------------------------------------------
 ConvertPlan Converter::make_plan(const std::string& in_path,
                                  const std::string& out_path,
-                                 uint64_t limit) const {
+                                 uint64_t limit,
+                                 const ConvertOpts& opt) const {
   ConvertPlan plan;
   plan.in  = parse_path(in_path);
   plan.out = parse_path(out_path);
   plan.limit = limit;
+  plan.opt = opt;
+  plan.opt.rd.plain = plan.in.comp == Comp::NONE && has_reader(plan.in.fmt);
   return plan;
 }
+
+// ------------------------------------------------------------------------
+// Without an index the window is all there is; pieces per instruction
+// is then taken as 1.125, a little above what typical traces show.
+// ------------------------------------------------------------------------
+uint64_t estimate_pieces(const ConvertPlan& plan) {
+  const bool limited = plan.limit != 0 && plan.limit != ~0ULL;
+
+  TraceIndex idx;
+  std::string err;
+  const std::string idx_path = plan.opt.rd.index.empty()
+                             ? TraceIndex::sidecar(plan.in.path)
+                             : plan.opt.rd.index;
+  const bool have_idx = idx.load(idx_path, plan.in.path, &err)
+                     && idx.instrs() != 0;
+
+  const uint64_t end = have_idx ? std::min(plan.opt.end, idx.instrs())
+                                : plan.opt.end;
+  if (end == ~0ULL) return limited ? plan.limit : 0;
+
+  const uint64_t n = end > plan.opt.skip ? end - plan.opt.skip : 0;
+  uint64_t pieces = n + n / 8;
+  if (have_idx && idx.pieces() != 0)
+    pieces = uint64_t((long double)n * idx.pieces() / idx.instrs());
+  return limited ? std::min(pieces, plan.limit) : pieces;
+}
 // ------------------------------------------------------------------------
 // ------------------------------------------------------------------------
 bool Converter::cbp_to_text(const ConvertPlan& plan, std::string* err) {
-  // Validate route: input must be CBP_BIN; output must be CBP_TEXT
-  if (plan.in.fmt != BaseFmt::CBP_BIN) {
-    if (err) *err = "cbp_to_text: input is not CBP binary (expected <none> or .cbp).";
+  // Validate route: input must be readable; output must be CBP_TEXT
+  if (!has_reader(plan.in.fmt)) {
+    if (err) *err = "cbp_to_text: no reader for the input format.";
     return false;
   }
   if (plan.out.fmt != BaseFmt::CBP_TEXT) {
@@ -135,7 +205,7 @@ bool Converter::cbp_to_text(const ConvertPlan& plan, std::string* err) {
   }
 
   // Dispatch to existing converter (streaming, handles compression by path)
-  const bool ok = run_cbp_to_text(plan.in.path, plan.out.path, plan.limit);
+  const bool ok = run_cbp_to_text(plan);
   if (!ok && err) {
     *err = "run_cbp_to_text failed.";
   }
@@ -145,8 +215,8 @@ bool Converter::cbp_to_text(const ConvertPlan& plan, std::string* err) {
 // ------------------------------------------------------------------------
 // ------------------------------------------------------------------------
 bool Converter::cbp_to_asm(const ConvertPlan& plan, std::string* err) {
-  if (plan.in.fmt != BaseFmt::CBP_BIN) {
-    if (err) *err = "cbp_to_asm: input must be CBP binary.";
+  if (!has_reader(plan.in.fmt)) {
+    if (err) *err = "cbp_to_asm: no reader for the input format.";
     return false;
   }
   if (plan.out.fmt != BaseFmt::ASM) {
@@ -154,7 +224,102 @@ bool Converter::cbp_to_asm(const ConvertPlan& plan, std::string* err) {
     return false;
   }
 
-  const bool ok = run_cbp_to_asm(plan.in.path, plan.out.path, plan.limit);
+  const bool ok = run_cbp_to_asm(plan);
   if (!ok && err) *err = "run_cbp_to_asm failed.";
   return ok;
 }
+
+// ------------------------------------------------------------------------
+// ------------------------------------------------------------------------
+bool Converter::cbp_to_ndjson(const ConvertPlan& plan, std::string* err) {
+  if (!has_reader(plan.in.fmt)) {
+    if (err) *err = "cbp_to_ndjson: no reader for the input format.";
+    return false;
+  }
+  if (plan.out.fmt != BaseFmt::NDJSON) {
+    if (err) *err = "cbp_to_ndjson: output must be .jsonl or .json.";
+    return false;
+  }
+
+  const bool ok = run_cbp_to_ndjson(plan);
+  if (!ok && err) *err = "run_cbp_to_ndjson failed.";
+  return ok;
+}
+
+// ------------------------------------------------------------------------
+// ------------------------------------------------------------------------
+bool Converter::cbp_to_cbp(const ConvertPlan& plan, std::string* err) {
+  if (!has_reader(plan.in.fmt)) {
+    if (err) *err = "cbp_to_cbp: no reader for the input format.";
+    return false;
+  }
+  if (plan.out.fmt != BaseFmt::CBP_BIN) {
+    if (err) *err = "cbp_to_cbp: output must be CBP binary.";
+    return false;
+  }
+
+  const bool ok = run_cbp_to_cbp(plan);
+  if (!ok && err) *err = "run_cbp_to_cbp failed.";
+  return ok;
+}
+
+// ------------------------------------------------------------------------
+// ------------------------------------------------------------------------
+bool Converter::cbp_to_cbpc(const ConvertPlan& plan, std::string* err) {
+  if (!has_reader(plan.in.fmt)) {
+    if (err) *err = "cbp_to_cbpc: no reader for the input format.";
+    return false;
+  }
+  if (plan.out.fmt != BaseFmt::CBPC) {
+    if (err) *err = "cbp_to_cbpc: output must be .cbpc.";
+    return false;
+  }
+  if (plan.out.comp != Comp::NONE || plan.out.path.empty()) {
+    if (err) *err = "cbp_to_cbpc: .cbpc is compressed already; write a plain file.";
+    return false;
+  }
+
+  const bool ok = run_cbp_to_cbpc(plan);
+  if (!ok && err) *err = "run_cbp_to_cbpc failed.";
+  return ok;
+}
+
+// ------------------------------------------------------------------------
+// ------------------------------------------------------------------------
+bool Converter::cbp_to_memh(const ConvertPlan& plan, std::string* err) {
+  if (!has_reader(plan.in.fmt)) {
+    if (err) *err = "cbp_to_memh: no reader for the input format.";
+    return false;
+  }
+  if (plan.out.fmt != BaseFmt::MEMH) {
+    if (err) *err = "cbp_to_memh: output must be .memh.";
+    return false;
+  }
+  if (plan.opt.memh_sidecars && plan.out.path.empty()) {
+    if (err) *err = "cbp_to_memh: --memh-sidecars needs an output file.";
+    return false;
+  }
+
+  const bool ok = run_cbp_to_memh(plan);
+  if (!ok && err) *err = "run_cbp_to_memh failed.";
+  return ok;
+}
+
+// ------------------------------------------------------------------------
+// ------------------------------------------------------------------------
+bool Converter::build_index(const std::string& trace,
+                            const std::string& idx_path,
+                            uint64_t span, std::string* err) {
+  TraceIndex idx;
+  if (!idx.build(trace, span, err)) return false;
+
+  const std::string out = idx_path.empty() ? TraceIndex::sidecar(trace)
+                                           : idx_path;
+  if (!idx.save(out, err)) return false;
+
+  std::fprintf(stderr, "Index %s: %zu checkpoints, %llu instrs, %llu pieces\n",
+               out.c_str(), idx.checkpoints().size(),
+               (unsigned long long)idx.instrs(),
+               (unsigned long long)idx.pieces());
+  return true;
+}
@@ -0,0 +1,188 @@
+#include "format_pipe.h"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ---------------------------------------------------------------------
+// One thread: each line goes straight into the writer's chunk.
+// ---------------------------------------------------------------------
+static bool format_serial(RecordSource& src, ArchiveWriter& w, uint64_t limit,
+                          LineFn fn, size_t max_line, uint64_t* lines)
+{
+  // Pieces are decoded into a reusable batch; no per-record allocation.
+  std::vector<db_t> batch(kFormatBatch);
+
+  uint64_t n = 0;
+  while (limit == ~0ULL || n < limit) {
+    size_t want = batch.size();
+    if (limit != ~0ULL && limit - n < want) want = size_t(limit - n);
+
+    const size_t got = src.get_batch(batch.data(), want);
+    if (got == 0) break;
+
+    for (size_t i = 0; i < got; ++i) {
+      char* p = w.reserve(max_line);
+      if (!p) break;
+      w.commit(fn(batch[i], p));
+    }
+    n += got;
+    if (w.failed()) break;
+  }
+  *lines = n;
+  return !src.error() && !w.failed();
+}
+
+// ---------------------------------------------------------------------
+// Decode -> format pool -> ordered write. Batches cycle through a fixed
+// set, so memory stays at (2 * threads + 2) batches however fast the
+// decoder is.
+// ---------------------------------------------------------------------
+namespace {
+
+struct Batch {
+  std::vector<db_t> recs;
+  size_t   n = 0;
+  std::vector<char> out;
+  size_t   len = 0;
+  uint64_t seq = 0;
+};
+
+class FormatPipe {
+public:
+  FormatPipe(ArchiveWriter& w, LineFn fn, size_t max_line, unsigned threads)
+    : w_(w), fn_(fn), max_line_(max_line)
+  {
+    for (unsigned i = 0; i < 2 * threads + 2; ++i) {
+      all_.emplace_back(new Batch);
+      all_.back()->recs.resize(kFormatBatch);
+      free_.push_back(all_.back().get());
+    }
+    for (unsigned i = 0; i < threads; ++i)
+      pool_.emplace_back(&FormatPipe::work, this);
+  }
+
+  ~FormatPipe() {
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : pool_) t.join();
+  }
+
+  // An empty batch; blocks while all of them are in flight.
+  Batch* take() {
+    std::unique_lock<std::mutex> lk(m_);
+    cv_.wait(lk, [&]{ return !free_.empty(); });
+    Batch* b = free_.back();
+    free_.pop_back();
+    return b;
+  }
+
+  void give_back(Batch* b) {
+    std::lock_guard<std::mutex> lk(m_);
+    free_.push_back(b);
+  }
+
+  void submit(Batch* b) {
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      b->seq = seq_++;
+      todo_.push_back(b);
+    }
+    cv_.notify_all();
+  }
+
+  // Wait until every submitted batch is written.
+  void drain() {
+    std::unique_lock<std::mutex> lk(m_);
+    cv_.wait(lk, [&]{ return written_ == seq_; });
+  }
+
+private:
+  ArchiveWriter& w_;
+  LineFn fn_;
+  size_t max_line_;
+
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::vector<std::unique_ptr<Batch>> all_;
+  std::vector<Batch*> free_;
+  std::deque<Batch*> todo_;
+  std::map<uint64_t, Batch*> done_;   // formatted, not written
+  uint64_t seq_ = 0, written_ = 0;
+  bool writing_ = false, stop_ = false;
+  std::vector<std::thread> pool_;
+
+  void work() {
+    std::unique_lock<std::mutex> lk(m_);
+    for (;;) {
+      cv_.wait(lk, [&]{ return stop_ || !todo_.empty(); });
+      if (todo_.empty()) return;
+      Batch* b = todo_.front();
+      todo_.pop_front();
+      lk.unlock();
+
+      if (b->out.size() < b->n * max_line_) b->out.resize(b->n * max_line_);
+      char* p = b->out.data();
+      for (size_t i = 0; i < b->n; ++i) p = fn_(b->recs[i], p);
+      b->len = size_t(p - b->out.data());
+
+      lk.lock();
+      done_[b->seq] = b;
+      // one thread writes at a time, in order; the others leave theirs
+      if (!writing_) {
+        writing_ = true;
+        for (auto it = done_.find(written_); it != done_.end();
+             it = done_.find(written_)) {
+          Batch* d = it->second;
+          done_.erase(it);
+          lk.unlock();
+          w_.write(d->out.data(), d->len);
+          lk.lock();
+          ++written_;
+          free_.push_back(d);
+        }
+        writing_ = false;
+      }
+      cv_.notify_all();
+    }
+  }
+};
+
+} // namespace
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool format_range(RecordSource& src, ArchiveWriter& w, uint64_t limit,
+                  unsigned threads, LineFn fn, size_t max_line,
+                  uint64_t* lines)
+{
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads <= 1) return format_serial(src, w, limit, fn, max_line, lines);
+
+  FormatPipe pipe(w, fn, max_line, threads);
+  uint64_t n = 0;
+  while (limit == ~0ULL || n < limit) {
+    size_t want = kFormatBatch;
+    if (limit != ~0ULL && limit - n < want) want = size_t(limit - n);
+
+    Batch* b = pipe.take();
+    b->n = src.get_batch(b->recs.data(), want);
+    if (b->n == 0) {
+      pipe.give_back(b);
+      break;
+    }
+    n += b->n;
+    pipe.submit(b);
+    if (w.failed()) break;
+  }
+  pipe.drain();
+
+  *lines = n;
+  return !src.error() && !w.failed();
+}
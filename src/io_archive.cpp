@@ -0,0 +1,500 @@
+#include "io_archive.h"
+#include <bzlib.h>
+#include <lzma.h>
+#include <zlib.h>
+#ifdef CBP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include <cctype>
+
+// -----------------------------------------------------------------------------
+// One compressed stream at a time. encode() appends the encoding of the
+// next piece of input to 'out'; with 'finish' it also ends the stream,
+// and the following call starts a new one.
+// -----------------------------------------------------------------------------
+class ArchiveWriter::Encoder {
+public:
+  static constexpr size_t kOutBytes = 256 << 10;
+
+  virtual ~Encoder() {}
+  virtual bool encode(const char* p, size_t n, bool finish,
+                      std::vector<unsigned char>& out, std::string& err) = 0;
+
+protected:
+  std::vector<unsigned char> obuf_ = std::vector<unsigned char>(kOutBytes);
+
+  void emit(std::vector<unsigned char>& out, size_t n) {
+    out.insert(out.end(), obuf_.begin(), obuf_.begin() + n);
+  }
+};
+
+namespace {
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+class GzipEncoder : public ArchiveWriter::Encoder {
+public:
+  explicit GzipEncoder(int level) : level_(level) { std::memset(&zs_, 0, sizeof zs_); }
+  ~GzipEncoder() override { if (init_) deflateEnd(&zs_); }
+
+  bool encode(const char* p, size_t n, bool finish,
+              std::vector<unsigned char>& out, std::string& err) override
+  {
+    if (!init_) {
+      if (deflateInit2(&zs_, level_, Z_DEFLATED, 15 + 16, 8,
+                       Z_DEFAULT_STRATEGY) != Z_OK) {
+        err = "gzip: deflateInit";
+        return false;
+      }
+      init_ = true;
+    }
+    zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(p));
+    zs_.avail_in = uInt(n);
+    const int flush = finish ? Z_FINISH : Z_NO_FLUSH;
+    do {
+      zs_.next_out = obuf_.data();
+      zs_.avail_out = uInt(obuf_.size());
+      if (deflate(&zs_, flush) == Z_STREAM_ERROR) { err = "gzip: deflate"; return false; }
+      emit(out, obuf_.size() - zs_.avail_out);
+    } while (zs_.avail_out == 0);
+
+    if (finish && deflateReset(&zs_) != Z_OK) { err = "gzip: deflateReset"; return false; }
+    return true;
+  }
+
+private:
+  z_stream zs_;
+  int  level_;
+  bool init_ = false;
+};
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+class XzEncoder : public ArchiveWriter::Encoder {
+public:
+  XzEncoder(int level, unsigned threads, bool mt)
+    : level_(level), threads_(threads), mt_(mt) {}
+  ~XzEncoder() override { if (init_) lzma_end(&s_); }
+
+  bool encode(const char* p, size_t n, bool finish,
+              std::vector<unsigned char>& out, std::string& err) override
+  {
+    if (!init_) {
+      lzma_ret r;
+      if (mt_) {              // independent blocks on liblzma's own threads
+        lzma_mt mt;
+        std::memset(&mt, 0, sizeof mt);
+        mt.threads = threads_;
+        mt.preset = uint32_t(level_);
+        mt.check = LZMA_CHECK_CRC64;
+        // The encoder takes no memory limit of its own: drop threads
+        // until its estimate fits a quarter of RAM, as xz does. Blocks
+        // keep the preset's size, so the output does not change.
+        const uint64_t budget = lzma_physmem() / 4;
+        while (mt.threads > 1 && budget
+               && lzma_stream_encoder_mt_memusage(&mt) > budget)
+          --mt.threads;
+        r = lzma_stream_encoder_mt(&s_, &mt);
+      } else {
+        r = lzma_easy_encoder(&s_, uint32_t(level_), LZMA_CHECK_CRC64);
+      }
+      if (r != LZMA_OK) { err = "xz: encoder init"; return false; }
+      init_ = true;
+    }
+    s_.next_in = reinterpret_cast<const uint8_t*>(p);
+    s_.avail_in = n;
+    const lzma_action action = finish ? LZMA_FINISH : LZMA_RUN;
+    for (;;) {
+      s_.next_out = obuf_.data();
+      s_.avail_out = obuf_.size();
+      const lzma_ret r = lzma_code(&s_, action);
+      emit(out, obuf_.size() - s_.avail_out);
+      if (r == LZMA_STREAM_END) break;
+      if (r != LZMA_OK) { err = "xz: encode error " + std::to_string(int(r)); return false; }
+      if (!finish && s_.avail_in == 0 && s_.avail_out != 0) break;
+    }
+
+    if (finish) {             // the next stream starts from scratch
+      lzma_end(&s_);
+      s_ = LZMA_STREAM_INIT;
+      init_ = false;
+    }
+    return true;
+  }
+
+private:
+  lzma_stream s_ = LZMA_STREAM_INIT;
+  int  level_;
+  unsigned threads_;
+  bool mt_;
+  bool init_ = false;
+};
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+class Bz2Encoder : public ArchiveWriter::Encoder {
+public:
+  explicit Bz2Encoder(int level) : level_(level) { std::memset(&s_, 0, sizeof s_); }
+  ~Bz2Encoder() override { if (init_) BZ2_bzCompressEnd(&s_); }
+
+  bool encode(const char* p, size_t n, bool finish,
+              std::vector<unsigned char>& out, std::string& err) override
+  {
+    if (!init_) {
+      if (BZ2_bzCompressInit(&s_, level_, 0, 0) != BZ_OK) {
+        err = "bz2: init";
+        return false;
+      }
+      init_ = true;
+    }
+    s_.next_in = const_cast<char*>(p);
+    s_.avail_in = unsigned(n);
+    for (;;) {
+      s_.next_out = reinterpret_cast<char*>(obuf_.data());
+      s_.avail_out = unsigned(obuf_.size());
+      const int r = BZ2_bzCompress(&s_, finish ? BZ_FINISH : BZ_RUN);
+      emit(out, obuf_.size() - s_.avail_out);
+      if (finish) {
+        if (r == BZ_STREAM_END) break;
+        if (r != BZ_FINISH_OK) { err = "bz2: encode error " + std::to_string(r); return false; }
+      } else {
+        if (r != BZ_RUN_OK) { err = "bz2: encode error " + std::to_string(r); return false; }
+        if (s_.avail_in == 0) break;
+      }
+    }
+
+    if (finish) {
+      BZ2_bzCompressEnd(&s_);
+      std::memset(&s_, 0, sizeof s_);
+      init_ = false;
+    }
+    return true;
+  }
+
+private:
+  bz_stream s_;
+  int  level_;
+  bool init_ = false;
+};
+
+#ifdef CBP_HAVE_ZSTD
+// ---------------------------------------------------------------------
+// A finished frame leaves the context ready for the next one. Worker
+// threads are libzstd's; a library built without them ignores the
+// request and compresses inline.
+// ---------------------------------------------------------------------
+class ZstdEncoder : public ArchiveWriter::Encoder {
+public:
+  ZstdEncoder(int level, unsigned threads, bool mt) : cctx_(ZSTD_createCCtx()) {
+    if (!cctx_) return;
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level);
+    if (mt) ZSTD_CCtx_setParameter(cctx_, ZSTD_c_nbWorkers, int(threads));
+  }
+  ~ZstdEncoder() override { ZSTD_freeCCtx(cctx_); }
+
+  bool encode(const char* p, size_t n, bool finish,
+              std::vector<unsigned char>& out, std::string& err) override
+  {
+    if (!cctx_) { err = "zstd: out of memory"; return false; }
+    ZSTD_inBuffer in = { p, n, 0 };
+    const ZSTD_EndDirective mode = finish ? ZSTD_e_end : ZSTD_e_continue;
+    for (;;) {
+      ZSTD_outBuffer o = { obuf_.data(), obuf_.size(), 0 };
+      const size_t r = ZSTD_compressStream2(cctx_, &o, &in, mode);
+      if (ZSTD_isError(r)) { err = std::string("zstd: ") + ZSTD_getErrorName(r); return false; }
+      emit(out, o.pos);
+      if (finish ? r == 0 : in.pos == in.size) break;
+    }
+    return true;
+  }
+
+private:
+  ZSTD_CCtx* cctx_;
+};
+#endif
+
+// ---------------------------------------------------------------------
+// Level range and default per codec, as their command line tools have it.
+// ---------------------------------------------------------------------
+struct LevelRange { int lo, hi, dflt; const char* name; };
+
+LevelRange level_range(StreamCodec c) {
+  switch (c) {
+    case StreamCodec::GZIP:  return { 0, 9, 6, ".gz" };
+    case StreamCodec::XZ:    return { 0, 9, 6, ".xz" };
+    case StreamCodec::BZIP2: return { 1, 9, 9, ".bz2" };
+#ifdef CBP_HAVE_ZSTD
+    case StreamCodec::ZSTD:  return { 1, ZSTD_maxCLevel(), 3, ".zst" };
+#else
+    case StreamCodec::ZSTD:  return { 1, 19, 3, ".zst" };
+#endif
+    default:                 return { 0, 0, 0, "" };
+  }
+}
+
+ArchiveWriter::Encoder* make_encoder(StreamCodec c, int level, unsigned threads,
+                                     bool mt) {
+  switch (c) {
+    case StreamCodec::GZIP:  return new GzipEncoder(level);
+    case StreamCodec::XZ:    return new XzEncoder(level, threads, mt);
+    case StreamCodec::BZIP2: return new Bz2Encoder(level);
+#ifdef CBP_HAVE_ZSTD
+    case StreamCodec::ZSTD:  return new ZstdEncoder(level, threads, mt);
+#endif
+    default:                 return nullptr;
+  }
+}
+
+bool ends_with_nocase(const std::string& s, const char* suf) {
+  const size_t n = std::strlen(suf);
+  if (s.size() < n) return false;
+  for (size_t i = 0; i < n; ++i)
+    if (std::tolower(static_cast<unsigned char>(s[s.size() - n + i])) != suf[i])
+      return false;
+  return true;
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+ArchiveWriter::ArchiveWriter() {}
+
+ArchiveWriter::~ArchiveWriter() { close(); }
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+StreamCodec ArchiveWriter::codec_for(const std::string& path) {
+  if (ends_with_nocase(path, ".gz"))  return StreamCodec::GZIP;
+  if (ends_with_nocase(path, ".xz"))  return StreamCodec::XZ;
+  if (ends_with_nocase(path, ".bz2")) return StreamCodec::BZIP2;
+  if (ends_with_nocase(path, ".zst")) return StreamCodec::ZSTD;
+  return StreamCodec::NONE;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ArchiveWriter::open(const std::string& path, int level, unsigned threads) {
+  close();
+  if (path.empty()) return open(stdout, StreamCodec::NONE, level);
+
+  FILE* f = std::fopen(path.c_str(), "wb");
+  if (!f) return fail("cannot create " + path);
+  if (!open(f, codec_for(path), level, threads)) {
+    std::fclose(f);
+    std::remove(path.c_str());
+    return false;
+  }
+  own_ = true;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ArchiveWriter::open(FILE* f, StreamCodec c, int level, unsigned threads) {
+  close();
+  failed_ = false;
+  err_.clear();
+  // Any count but 1 picks the parallel layout, however many threads the
+  // host then gives it, so the bytes do not depend on the machine.
+  const bool parallel = threads != 1;
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+
+  members_ = false;
+  if (c != StreamCodec::NONE) {
+    const LevelRange lr = level_range(c);
+    if (level < 0) level = lr.dflt;
+    if (level < lr.lo || level > lr.hi)
+      return fail("level " + std::to_string(level) + " out of range for "
+                  + lr.name + " (" + std::to_string(lr.lo) + "-"
+                  + std::to_string(lr.hi) + ")");
+#ifndef CBP_HAVE_ZSTD
+    if (c == StreamCodec::ZSTD)
+      return fail("zstd output needs a build with libzstd");
+#endif
+    members_ = parallel
+            && (c == StreamCodec::GZIP || c == StreamCodec::BZIP2);
+    const unsigned nworkers = members_ ? threads : 1;
+    for (unsigned w = 0; w < nworkers; ++w)
+      enc_.emplace_back(make_encoder(c, level, members_ ? 1 : threads,
+                                     parallel));
+  }
+
+  if (!sink_.open(f, false, uring_)) {
+    enc_.clear();
+    return fail(sink_.error());
+  }
+  fp_ = f;
+  own_ = false;
+  codec_ = c;
+  level_ = level;
+  buf_.resize(kChunkBytes);
+  len_ = 0;
+  seq_ = written_ = 0;
+  limit_ = kQueueChunks + 2 * enc_.size();
+  stop_ = writing_ = false;
+  for (size_t w = 0; w < enc_.size(); ++w)
+    workers_.emplace_back(&ArchiveWriter::work, this, w);
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ArchiveWriter::write_slow(const void* p, size_t n) {
+  if (!fp_ || failed_) return false;
+  const char* s = static_cast<const char*>(p);
+  while (n) {
+    size_t take = len_ < kChunkBytes ? kChunkBytes - len_ : 0;
+    if (take > n) take = n;
+    std::memcpy(buf_.data() + len_, s, take);
+    len_ += take;
+    s += take;
+    n -= take;
+    if (len_ >= kChunkBytes && !submit(false)) return false;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// Uncompressed output goes straight to the sink, which overlaps the I/O.
+// ---------------------------------------------------------------------
+bool ArchiveWriter::submit(bool finish) {
+  if (enc_.empty()) {
+    if (len_ && !sink_.write(buf_.data(), len_)) return fail(sink_.error());
+    len_ = 0;
+    return true;
+  }
+  // an empty chunk only matters as the end of a single stream
+  if (len_ == 0 && (members_ || !finish)) return !failed_;
+  // chunks end at fixed offsets, so the last one may need two goes
+  if (finish && len_ > kChunkBytes && !submit(false)) return false;
+
+  std::unique_lock<std::mutex> lk(m_);
+  cv_.wait(lk, [&]{ return seq_ - written_ < limit_ || failed_; });
+  if (failed_) return false;
+
+  Chunk c;
+  c.data.swap(buf_);
+  c.len = len_ < kChunkBytes ? len_ : kChunkBytes;
+  c.seq = seq_++;
+  c.finish = finish;
+  if (!spare_.empty()) {
+    buf_.swap(spare_.back());
+    spare_.pop_back();
+  } else {
+    buf_.resize(kChunkBytes);
+  }
+  // what a reserve() ran past the cut starts the next chunk
+  len_ -= c.len;
+  if (len_) std::memcpy(buf_.data(), c.data.data() + c.len, len_);
+  queue_.push_back(std::move(c));
+  cv_.notify_all();
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ArchiveWriter::drain() {
+  if (!fp_) return !failed_;
+  submit(true);
+  if (!enc_.empty()) {
+    std::unique_lock<std::mutex> lk(m_);
+    cv_.wait(lk, [&]{ return written_ == seq_; });
+  }
+  return !failed_;
+}
+
+// ---------------------------------------------------------------------
+// Compressor thread 'w': encode chunks as they come, then write out
+// whatever is next in order. One worker writes at a time; the others
+// leave their results in done_ for it.
+// ---------------------------------------------------------------------
+void ArchiveWriter::work(size_t w) {
+  std::unique_lock<std::mutex> lk(m_);
+  for (;;) {
+    cv_.wait(lk, [&]{ return stop_ || !queue_.empty(); });
+    if (queue_.empty()) return;
+
+    Chunk c = std::move(queue_.front());
+    queue_.pop_front();
+    lk.unlock();
+
+    std::vector<unsigned char> out;
+    std::string e;
+    const bool ok = failed_
+                 || enc_[w]->encode(c.data.data(), c.len, members_ || c.finish,
+                                    out, e);
+
+    lk.lock();
+    if (!ok && !failed_) { err_ = e; failed_ = true; }
+    spare_.push_back(std::move(c.data));
+    done_[c.seq] = std::move(out);
+
+    if (!writing_) {
+      writing_ = true;
+      for (auto it = done_.find(written_); it != done_.end();
+           it = done_.find(written_)) {
+        std::vector<unsigned char> v = std::move(it->second);
+        done_.erase(it);
+        lk.unlock();
+        const bool wok = failed_ || v.empty()
+                      || sink_.write(v.data(), v.size());
+        lk.lock();
+        if (!wok && !failed_) { err_ = sink_.error(); failed_ = true; }
+        ++written_;
+      }
+      writing_ = false;
+    }
+    cv_.notify_all();
+  }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ArchiveWriter::append(FILE* src) {
+  if (!fp_ || failed_) return false;
+  std::vector<char> tmp(kChunkBytes);
+  std::rewind(src);
+  size_t n;
+  while ((n = std::fread(tmp.data(), 1, tmp.size(), src)) > 0)
+    if (!write(tmp.data(), n)) return false;
+  if (std::ferror(src)) return fail("read error on shard output");
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ArchiveWriter::close() {
+  if (!fp_) return !failed_;
+  drain();
+
+  if (!workers_.empty()) {
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : workers_) t.join();
+    workers_.clear();
+  }
+  if (!sink_.close()) fail(sink_.error());
+  if (own_ && std::fclose(fp_) != 0) fail("write error");
+
+  fp_ = nullptr;
+  own_ = false;
+  enc_.clear();
+  queue_.clear();
+  spare_.clear();
+  done_.clear();
+  buf_.clear();
+  len_ = 0;
+  return !failed_;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ArchiveWriter::fail(const std::string& e) {
+  if (!failed_) { err_ = e; failed_ = true; }
+  return false;
+}
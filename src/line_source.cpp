@@ -0,0 +1,155 @@
+#include "line_source.h"
+#include "scan_util.h"
+#include <cstdio>
+#include <cstring>
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+LineSource::LineSource(const std::string& path, const ReaderOpts& opts,
+                       const char* what, bool same_pc_pieces)
+  : path_(path), what_(what), infer_last_(same_pc_pieces)
+{
+  if (!rdr_.open(path, opts)) {
+    std::fprintf(stderr, "-E: cannot open %s\n", path.c_str());
+    error_ = true;
+  }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool LineSource::class_of(const char* s, size_t n, InstClass* c) {
+  for (uint8_t i = 0; i < kNumInstClasses; ++i)
+    if (std::strlen(cInfo[i]) == n && std::memcmp(cInfo[i], s, n) == 0) {
+      *c = InstClass(i);
+      return true;
+    }
+  return false;
+}
+
+// ---------------------------------------------------------------------
+// Next line without its newline. Lines normally point straight into
+// the reader's block; only one cut by a block end is gathered in carry_.
+// ---------------------------------------------------------------------
+bool LineSource::next_line(const char** s, const char** e) {
+  carry_.clear();
+  for (;;) {
+    if (pos_ < blk_n_) {
+      const char* b = reinterpret_cast<const char*>(blk_) + pos_;
+      const size_t n = blk_n_ - pos_;
+      const char* nl = static_cast<const char*>(std::memchr(b, '\n', n));
+      if (nl) {
+        pos_ += size_t(nl - b) + 1;
+        if (carry_.empty()) { *s = b; *e = nl; }
+        else {
+          carry_.append(b, size_t(nl - b));
+          *s = carry_.data(); *e = *s + carry_.size();
+        }
+        ++line_;
+        return true;
+      }
+      carry_.append(b, n);
+      pos_ = blk_n_;
+    }
+    if (!rdr_.next_block(&blk_, &blk_n_)) {
+      blk_n_ = pos_ = 0;
+      if (rdr_.failed()) {
+        std::fprintf(stderr, "-E: %s: %s\n", path_.c_str(),
+                     rdr_.error().c_str());
+        error_ = true;
+        return false;
+      }
+      if (carry_.empty()) return false;
+      *s = carry_.data(); *e = *s + carry_.size();   // no final newline
+      ++line_;
+      return true;
+    }
+    pos_ = 0;
+  }
+}
+
+// ---------------------------------------------------------------------
+// Next non-blank line, parsed.
+// ---------------------------------------------------------------------
+bool LineSource::next_parsed(db_t& d) {
+  const char *s, *e;
+  while (!error_ && next_line(&s, &e)) {
+    const char* p = s;
+    skip_ws(p, e);
+    if (p == e) continue;                      // blank line
+
+    const char* why = nullptr;
+    if (!parse(p, e, d, &why)) {
+      std::fprintf(stderr, "-E: %s:%llu: bad %s record (%s)\n",
+                   path_.c_str(), (unsigned long long)line_, what_, why);
+      error_ = true;
+      return false;
+    }
+    parsed_line_ = line_;
+    return true;
+  }
+  return false;
+}
+
+// ---------------------------------------------------------------------
+// Next piece with is_last_piece settled: with infer_last_ a piece is the
+// last of its instruction unless the line after it has the same PC. A
+// branch that came without a target then gets the next PC, taken when
+// that is not the fall-through (the rule operator<< prints tkn by).
+// ---------------------------------------------------------------------
+bool LineSource::read_piece(db_t& d) {
+  if (!infer_last_) {
+    if (!next_parsed(d)) return false;
+    piece_line_ = parsed_line_;
+    return true;
+  }
+  if (!have_ahead_) {
+    if (!(have_ahead_ = next_parsed(ahead_))) return false;
+    ahead_line_ = parsed_line_;
+  }
+  d = ahead_;
+  piece_line_ = ahead_line_;
+  have_ahead_ = next_parsed(ahead_);
+  ahead_line_ = parsed_line_;
+  d.is_last_piece = !have_ahead_ || ahead_.pc != d.pc;
+  if (d.is_last_piece && have_ahead_ && is_br(d.insn_class) && d.next_pc == 0) {
+    d.next_pc  = ahead_.pc;
+    d.is_taken = ahead_.pc != d.pc + 4;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool LineSource::next_piece(db_t& d) {
+  while (!error_ && instr_ < end_ && read_piece(d)) {
+    const uint64_t at = instr_;
+    if (d.is_last_piece) ++instr_;
+    if (at >= first_) return true;
+  }
+  return false;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+size_t LineSource::get_batch(db_t* out, size_t cap) {
+  if (lines_.size() < cap) lines_.resize(cap);
+  size_t n = 0;
+  while (n < cap && next_piece(out[n])) lines_[n++] = piece_line_;
+  return n;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+std::string LineSource::where(size_t i) const {
+  if (i >= lines_.size()) return std::string();
+  return path_ + ":" + std::to_string(lines_[i]);
+}
+
+// ---------------------------------------------------------------------
+// Pieces before 'first' are parsed and dropped in next_piece().
+// ---------------------------------------------------------------------
+bool LineSource::set_window(uint64_t first, uint64_t end) {
+  first_ = first;
+  end_ = end;
+  return !error_;
+}
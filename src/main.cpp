@@ -1,4 +1,5 @@
 #include "converter.h"
+#include "trace_index.h"
 
 #include <algorithm>
 #include <cerrno>
@@ -29,15 +30,75 @@ static inline bool starts_with(const char* s, const char* p) {
 }
 
 // -------------------------------------------------------------------------
+// Unsigned integer in decimal or 0x hex. Returns false on junk/overflow.
 // -------------------------------------------------------------------------
-static bool parse_args(int argc, char** argv,
-                       std::string& in, std::string& out, uint64_t& limit,
-                       std::string& err)
+static bool parse_u64(const char* s, uint64_t& v) {
+  if (!*s) return false;
+  errno = 0;
+  char* end = nullptr;
+  unsigned long long x = std::strtoull(s, &end, 0);
+  if (errno || end == s || *end != '\0') return false;
+  v = static_cast<uint64_t>(x);
+  return true;
+}
+
+// -------------------------------------------------------------------------
+// "A:B" or "A:" (to the end), A < B.
+// -------------------------------------------------------------------------
+static bool parse_range(const char* s, uint64_t& a, uint64_t& b) {
+  const char* colon = std::strchr(s, ':');
+  if (!colon) return false;
+  const std::string first(s, size_t(colon - s));
+  if (!parse_u64(first.c_str(), a)) return false;
+  if (colon[1] == '\0') { b = ~0ULL; return true; }
+  return parse_u64(colon + 1, b) && a < b;
+}
+
+// -------------------------------------------------------------------------
+// Match "--name <v>" or "--name=<v>". Returns 1 with *val set on a match,
+// 0 if argv[i] is a different option, -1 on a missing/empty value.
+// -------------------------------------------------------------------------
+static int match_opt(int argc, char** argv, int& i, const char* name,
+                     const char** val, std::string& err)
+{
+  const char* a = argv[i];
+  const size_t n = std::strlen(name);
+  if (std::strncmp(a, name, n) != 0) return 0;
+
+  if (a[n] == '\0') {
+    if (++i >= argc) { err = std::string("missing value for ") + name; return -1; }
+    *val = argv[i];
+    return 1;
+  }
+  if (a[n] == '=') {
+    *val = a + n + 1;
+    if (!**val) { err = std::string("empty value for ") + name + "="; return -1; }
+    return 1;
+  }
+  return 0;
+}
+
+// -------------------------------------------------------------------------
+// Command line state.
+// -------------------------------------------------------------------------
+struct Args {
+  std::string in, out;
+  uint64_t    limit = ~0ULL;
+  ConvertOpts opt;
+  std::string build_index;                        // trace to index
+  uint64_t    index_span = TraceIndex::kDefaultSpan;
+};
+
+// -------------------------------------------------------------------------
+// -------------------------------------------------------------------------
+static bool parse_args(int argc, char** argv, Args& args, std::string& err)
 {
-  in.clear(); out.clear(); limit = ~0ULL;
+  bool have_skip = false, have_range = false;
 
   for (int i = 1; i < argc; ++i) {
     const char* a = argv[i];
+    const char* v = nullptr;
+    int m;
 
     // --help / -h early out
     if (std::strcmp(a, "-h") == 0 || std::strcmp(a, "--help") == 0) {
@@ -45,46 +106,151 @@ static bool parse_args(int argc, char** argv,
       return false; // caller will call usage() and exit 0
     }
 
-    // --in <path>  or  --in=<path>
-    if (std::strcmp(a, "--in") == 0) {
-      if (++i >= argc) { err = "missing value for --in"; return false; }
-      in = argv[i];
+    // --huge-pages  (hint for mapped uncompressed inputs)
+    if (std::strcmp(a, "--huge-pages") == 0) {
+      args.opt.rd.huge_pages = true;
       continue;
-    } else if (starts_with(a, "--in=")) {
-      in = a + 5;
-      if (in.empty()) { err = "empty value for --in="; return false; }
+    }
+
+    // --io-uring  (asynchronous output writes)
+    if (std::strcmp(a, "--io-uring") == 0) {
+      args.opt.io_uring = true;
       continue;
     }
 
-    // --out <path>  or  --out=<path>
-    if (std::strcmp(a, "--out") == 0) {
-      if (++i >= argc) { err = "missing value for --out"; return false; }
-      out = argv[i];
+    // --memh-sidecars  (EA and value files next to a .memh output)
+    if (std::strcmp(a, "--memh-sidecars") == 0) {
+      args.opt.memh_sidecars = true;
       continue;
-    } else if (starts_with(a, "--out=")) {
-      out = a + 6;
-      if (out.empty()) { err = "empty value for --out="; return false; }
+    }
+
+    // --in <path>  or  --in=<path>
+    if ((m = match_opt(argc, argv, i, "--in", &v, err)) != 0) {
+      if (m < 0) return false;
+      args.in = v;
+      continue;
+    }
+
+    // --out <path>  or  --out=<path>
+    if ((m = match_opt(argc, argv, i, "--out", &v, err)) != 0) {
+      if (m < 0) return false;
+      args.out = v;
       continue;
     }
 
     // --limit <n>  or  --limit=<n>  (accepts 10/0x10)
-    if (std::strcmp(a, "--limit") == 0) {
-      if (++i >= argc) { err = "missing value for --limit"; return false; }
-      const char* s = argv[i];
-      errno = 0;
-      char* end = nullptr;
-      unsigned long long v = std::strtoull(s, &end, 0);
-      if (errno || end == s || *end != '\0') { err = "bad --limit value"; return false; }
-      limit = static_cast<uint64_t>(v);
-      continue;
-    } else if (starts_with(a, "--limit=")) {
-      const char* s = a + 8;
-      if (!*s) { err = "empty value for --limit="; return false; }
-      errno = 0;
-      char* end = nullptr;
-      unsigned long long v = std::strtoull(s, &end, 0);
-      if (errno || end == s || *end != '\0') { err = "bad --limit value"; return false; }
-      limit = static_cast<uint64_t>(v);
+    if ((m = match_opt(argc, argv, i, "--limit", &v, err)) != 0) {
+      if (m < 0) return false;
+      if (!parse_u64(v, args.limit)) { err = "bad --limit value"; return false; }
+      continue;
+    }
+
+    // --skip <n>  (instructions to step over)
+    if ((m = match_opt(argc, argv, i, "--skip", &v, err)) != 0) {
+      if (m < 0) return false;
+      if (!parse_u64(v, args.opt.skip)) { err = "bad --skip value"; return false; }
+      have_skip = true;
+      continue;
+    }
+
+    // --range <a>:<b>  (instructions [a, b); b may be omitted)
+    if ((m = match_opt(argc, argv, i, "--range", &v, err)) != 0) {
+      if (m < 0) return false;
+      if (!parse_range(v, args.opt.skip, args.opt.end)) {
+        err = "bad --range value (expected A:B with A < B)";
+        return false;
+      }
+      have_range = true;
+      continue;
+    }
+
+    // --decomp-threads <n>  (0 = one per core, 1 = serial)
+    if ((m = match_opt(argc, argv, i, "--decomp-threads", &v, err)) != 0) {
+      uint64_t n = 0;
+      if (m < 0) return false;
+      if (!parse_u64(v, n) || n > 1024) { err = "bad --decomp-threads value"; return false; }
+      args.opt.rd.decomp_threads = unsigned(n);
+      continue;
+    }
+
+    // --backend native|libarchive
+    if ((m = match_opt(argc, argv, i, "--backend", &v, err)) != 0) {
+      if (m < 0) return false;
+      if (std::strcmp(v, "native") == 0)          args.opt.rd.backend = Backend::NATIVE;
+      else if (std::strcmp(v, "libarchive") == 0) args.opt.rd.backend = Backend::LIBARCHIVE;
+      else { err = "bad --backend value (native|libarchive)"; return false; }
+      continue;
+    }
+
+    // --pc-cache on|off|verify
+    if ((m = match_opt(argc, argv, i, "--pc-cache", &v, err)) != 0) {
+      if (m < 0) return false;
+      if (std::strcmp(v, "on") == 0)          args.opt.rd.pc_cache = PcCacheMode::ON;
+      else if (std::strcmp(v, "off") == 0)    args.opt.rd.pc_cache = PcCacheMode::OFF;
+      else if (std::strcmp(v, "verify") == 0) args.opt.rd.pc_cache = PcCacheMode::VERIFY;
+      else { err = "bad --pc-cache value (on|off|verify)"; return false; }
+      continue;
+    }
+
+    // --level <n>  (output compression level)
+    if ((m = match_opt(argc, argv, i, "--level", &v, err)) != 0) {
+      uint64_t n = 0;
+      if (m < 0) return false;
+      if (!parse_u64(v, n) || n > 22) { err = "bad --level value"; return false; }
+      args.opt.level = int(n);
+      continue;
+    }
+
+    // --compress-threads <n>  (1 = default, 0 = one per core)
+    if ((m = match_opt(argc, argv, i, "--compress-threads", &v, err)) != 0) {
+      uint64_t n = 0;
+      if (m < 0) return false;
+      if (!parse_u64(v, n) || n > 1024) { err = "bad --compress-threads value"; return false; }
+      args.opt.compress_threads = unsigned(n);
+      continue;
+    }
+
+    // --format-threads <n>  (0 = one per core)
+    if ((m = match_opt(argc, argv, i, "--format-threads", &v, err)) != 0) {
+      uint64_t n = 0;
+      if (m < 0) return false;
+      if (!parse_u64(v, n) || n > 1024) { err = "bad --format-threads value"; return false; }
+      args.opt.format_threads = unsigned(n);
+      continue;
+    }
+
+    // --threads <n>  (parallel shards; 0 = one per core)
+    if ((m = match_opt(argc, argv, i, "--threads", &v, err)) != 0) {
+      uint64_t n = 0;
+      if (m < 0) return false;
+      if (!parse_u64(v, n) || n > 1024) { err = "bad --threads value"; return false; }
+      args.opt.threads = unsigned(n);
+      continue;
+    }
+
+    // --build-index <trace>  (writes <trace>.cbpidx, or --out)
+    if ((m = match_opt(argc, argv, i, "--build-index", &v, err)) != 0) {
+      if (m < 0) return false;
+      args.build_index = v;
+      continue;
+    }
+
+    // --index-span <MiB>  (decoded bytes between checkpoints)
+    if ((m = match_opt(argc, argv, i, "--index-span", &v, err)) != 0) {
+      uint64_t mb = 0;
+      if (m < 0) return false;
+      if (!parse_u64(v, mb) || mb == 0 || mb > (1u << 20)) {
+        err = "bad --index-span value";
+        return false;
+      }
+      args.index_span = mb << 20;
+      continue;
+    }
+
+    // --index <file>  (checkpoint index to use instead of <in>.cbpidx)
+    if ((m = match_opt(argc, argv, i, "--index", &v, err)) != 0) {
+      if (m < 0) return false;
+      args.opt.rd.index = v;
       continue;
     }
 
@@ -93,18 +259,20 @@ static bool parse_args(int argc, char** argv,
     return false;
   }
 
-  if (in.empty())  { err = "missing --in";  return false; }
-  if (out.empty()) { err = "missing --out"; return false; }
+  if (have_skip && have_range) { err = "--skip and --range are exclusive"; return false; }
+  if (!args.build_index.empty()) return true;
+  if (args.in.empty())  { err = "missing --in";  return false; }
+  if (args.out.empty()) { err = "missing --out"; return false; }
   return true;
 }
 
 // -------------------------------------------------------------------------
 // -------------------------------------------------------------------------
 int main(int argc, char** argv) {
-  std::string in, out, perr;
-  uint64_t limit = ~0ULL;
+  Args args;
+  std::string perr;
 
-  if (!parse_args(argc, argv, in, out, limit, perr)) {
+  if (!parse_args(argc, argv, args, perr)) {
     if (perr.empty()) { usage(argv[0]); return 0; }  // -h/--help path
     std::fprintf(stderr, "-E: %s\n", perr.c_str());
     usage(argv[0]);
@@ -113,10 +281,12 @@ int main(int argc, char** argv) {
 
   Converter conv;
   std::string err;
-  if (!conv.convert(in, out, limit, &err)) {
+  const bool ok = args.build_index.empty()
+    ? conv.convert(args.in, args.out, args.limit, args.opt, &err)
+    : conv.build_index(args.build_index, args.out, args.index_span, &err);
+  if (!ok) {
     std::fprintf(stderr, "-E: %s\n", err.c_str());
     return 1;
   }
   return 0;
 }
-
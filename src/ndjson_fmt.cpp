@@ -0,0 +1,91 @@
+#include "ndjson_fmt.h"
+#include "fmt_util.h"
+
+// Key fragment with its length, so the hot path is one memcpy each.
+struct Frag {
+  const char* s;
+  size_t n;
+};
+
+template<size_t N>
+static constexpr Frag frag(const char (&s)[N]) { return Frag{ s, N - 1 }; }
+
+static inline char* put(char* p, const Frag& f) {
+  std::memcpy(p, f.s, f.n);
+  return p + f.n;
+}
+
+// ","type":"<name>"", indexed by InstClass; pc is already open before it
+static constexpr Frag kType[kNumInstClasses] = {
+  frag("\",\"type\":\"aluOp\""),
+  frag("\",\"type\":\"loadOp\""),
+  frag("\",\"type\":\"stOp\""),
+  frag("\",\"type\":\"condBrOp\""),
+  frag("\",\"type\":\"uncondDirBrOp\""),
+  frag("\",\"type\":\"uncondIndBrOp\""),
+  frag("\",\"type\":\"fpOp\""),
+  frag("\",\"type\":\"slowAluOp\""),
+  frag("\",\"type\":\"undefOp\""),
+  frag("\",\"type\":\"callDirBrOp\""),
+  frag("\",\"type\":\"callIndBrOp\""),
+  frag("\",\"type\":\"retBrOp\""),
+};
+
+static constexpr Frag kOperand[4] = {
+  frag(",\"A\":{\"bank\":"),
+  frag(",\"B\":{\"bank\":"),
+  frag(",\"C\":{\"bank\":"),
+  frag(",\"D\":{\"bank\":"),
+};
+
+static inline char* add_operand(char* p, const Frag& key,
+                                const db_operand_t& o)
+{
+  if (!o.valid) return p;
+  p = put(p, key);
+  *p++ = o.is_int ? '1' : '2';
+  p = put(p, ",\"idx\":");
+  p = put_dec(p, o.log_reg);
+  p = put(p, ",\"val\":\"0x");
+  p = put_hex16(p, o.value);
+  return put(p, "\"}");
+}
+
+char* format_json_line(const db_t& d, char* p)
+{
+  p = put(p, "{\"pc\":\"0x");
+  p = put_hex16(p, d.pc);
+  const unsigned c = unsigned(d.insn_class);
+  p = put(p, kType[c < kNumInstClasses ? c : unsigned(InstClass::undefInstClass)]);
+
+  // memory metadata
+  if (d.is_load || d.is_store) {
+    p = put(p, ",\"ea\":\"0x");
+    p = put_hex16(p, d.addr);
+    p = put(p, "\",\"size\":");
+    p = put_dec(p, d.size);
+  }
+
+  // branch outcome
+  if (is_br(d.insn_class)) {
+    p = d.is_taken ? put(p, ",\"taken\":true,\"target\":\"0x")
+                   : put(p, ",\"taken\":false,\"target\":\"0x");
+    p = put_hex16(p, d.next_pc);
+    *p++ = '"';
+  }
+
+  p = add_operand(p, kOperand[0], d.A);
+  p = add_operand(p, kOperand[1], d.B);
+  p = add_operand(p, kOperand[2], d.C);
+  p = add_operand(p, kOperand[3], d.D);
+
+  if (!d.is_last_piece) p = put(p, ",\"last\":false");
+  *p++ = '}';
+  return p;
+}
+
+std::string format_json_line(const db_t& d)
+{
+  char buf[kMaxJsonLine];
+  return std::string(buf, format_json_line(d, buf));
+}
@@ -0,0 +1,158 @@
+#include "ndjson_reader.h"
+#include "scan_util.h"
+#include <cstdio>
+#include <cstring>
+
+// ---------------------------------------------------------------------
+// Value parsers. Each starts at the first byte of the value.
+// ---------------------------------------------------------------------
+namespace {
+
+// "0x..." or a bare decimal number
+bool json_u64(const char*& p, const char* e, uint64_t* v) {
+  if (p < e && *p == '"') {
+    ++p;
+    if (!scan_hex(p, e, v) || p >= e || *p != '"') return false;
+    ++p;
+    return true;
+  }
+  return scan_dec(p, e, v);
+}
+
+bool json_bool(const char*& p, const char* e, bool* v) {
+  if (eat(p, e, "true"))  { *v = true;  return true; }
+  if (eat(p, e, "false")) { *v = false; return true; }
+  return false;
+}
+
+// Key or string value without escapes (none occur in this schema); the
+// result points into the line.
+bool json_key(const char*& p, const char* e, const char** s, size_t* n) {
+  if (p >= e || *p != '"') return false;
+  const char* q = static_cast<const char*>(std::memchr(p + 1, '"', size_t(e - p - 1)));
+  if (!q) return false;
+  *s = p + 1;
+  *n = size_t(q - p - 1);
+  p = q + 1;
+  return true;
+}
+
+// Any value, for keys this reader does not use.
+bool json_skip(const char*& p, const char* e) {
+  int depth = 0;
+  while (p < e) {
+    const char c = *p;
+    if (c == '"') {
+      for (++p; p < e && *p != '"'; ++p)
+        if (*p == '\\') ++p;
+      if (p >= e) return false;
+      ++p;
+    } else if (c == '{' || c == '[') {
+      ++depth; ++p;
+    } else if (c == '}' || c == ']') {
+      if (depth == 0) return true;
+      --depth; ++p;
+    } else if (c == ',' && depth == 0) {
+      return true;
+    } else {
+      ++p;
+    }
+  }
+  return depth == 0;
+}
+
+// Walk the members of an object, calling on_key(key, len) with p at each
+// value; on_key consumes the value.
+template<class F>
+bool json_object(const char*& p, const char* e, F on_key) {
+  skip_ws(p, e);
+  if (p >= e || *p != '{') return false;
+  ++p;
+  skip_ws(p, e);
+  if (p < e && *p == '}') { ++p; return true; }
+  for (;;) {
+    const char* k;
+    size_t kn;
+    skip_ws(p, e);
+    if (!json_key(p, e, &k, &kn)) return false;
+    skip_ws(p, e);
+    if (p >= e || *p != ':') return false;
+    ++p;
+    skip_ws(p, e);
+    if (!on_key(k, kn)) return false;
+    skip_ws(p, e);
+    if (p >= e) return false;
+    if (*p == '}') { ++p; return true; }
+    if (*p != ',') return false;
+    ++p;
+  }
+}
+
+bool json_operand(const char*& p, const char* e, db_operand_t& o) {
+  uint64_t bank = 1;
+  o.valid = true;
+  const bool ok = json_object(p, e, [&](const char* k, size_t n) {
+    if (n == 4 && std::memcmp(k, "bank", 4) == 0) return scan_dec(p, e, &bank);
+    if (n == 3 && std::memcmp(k, "idx", 3) == 0)  return scan_dec(p, e, &o.log_reg);
+    if (n == 3 && std::memcmp(k, "val", 3) == 0)  return json_u64(p, e, &o.value);
+    return json_skip(p, e);
+  });
+  o.is_int = bank != 2;
+  return ok;
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool NdjsonReader::parse_line(const char* p, const char* e, db_t& d,
+                              const char** why)
+{
+  d = db_t{};
+  d.is_last_piece = true;
+  bool have_pc = false, have_type = false, bad_type = false;
+
+  const bool ok = json_object(p, e, [&](const char* k, size_t n) {
+    switch (n) {
+      case 1:
+        if (*k >= 'A' && *k <= 'D') {
+          db_operand_t* ops[4] = { &d.A, &d.B, &d.C, &d.D };
+          return json_operand(p, e, *ops[*k - 'A']);
+        }
+        break;
+      case 2:
+        if (k[0] == 'p' && k[1] == 'c') { have_pc = true; return json_u64(p, e, &d.pc); }
+        if (k[0] == 'e' && k[1] == 'a') return json_u64(p, e, &d.addr);
+        break;
+      case 4:
+        if (std::memcmp(k, "type", 4) == 0) {
+          const char* s;
+          size_t sn;
+          if (!json_key(p, e, &s, &sn)) return false;
+          const bool known = class_of(s, sn, &d.insn_class);
+          bad_type = !known;
+          have_type = true;
+          return known;
+        }
+        if (std::memcmp(k, "size", 4) == 0) return json_u64(p, e, &d.size);
+        if (std::memcmp(k, "last", 4) == 0) return json_bool(p, e, &d.is_last_piece);
+        break;
+      case 5:
+        if (std::memcmp(k, "taken", 5) == 0) return json_bool(p, e, &d.is_taken);
+        break;
+      case 6:
+        if (std::memcmp(k, "target", 6) == 0) return json_u64(p, e, &d.next_pc);
+        break;
+    }
+    return json_skip(p, e);
+  });
+
+  if (!ok) { *why = bad_type ? "unknown type" : "malformed"; return false; }
+  skip_ws(p, e);
+  if (p != e) { *why = "trailing characters"; return false; }
+  if (!have_pc || !have_type) { *why = "missing pc or type"; return false; }
+
+  d.is_load  = d.insn_class == InstClass::loadInstClass;
+  d.is_store = d.insn_class == InstClass::storeInstClass;
+  return true;
+}
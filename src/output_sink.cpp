@@ -0,0 +1,324 @@
+#include "output_sink.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define CBP_HAVE_IO_URING 1
+#endif
+
+// ---------------------------------------------------------------------
+// Minimal io_uring through the raw system calls (no liburing): a two
+// entry ring with at most one write in flight, which is all the double
+// buffering needs.
+// ---------------------------------------------------------------------
+#ifdef CBP_HAVE_IO_URING
+struct OutputSink::Ring {
+  int fd = -1;
+  void*  sq_ptr = MAP_FAILED;
+  void*  cq_ptr = MAP_FAILED;
+  size_t sq_sz = 0, cq_sz = 0, sqes_sz = 0;
+  io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+  unsigned *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+  unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+  io_uring_cqe* cqes = nullptr;
+
+  ~Ring() {
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_sz);
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_sz);
+    if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_sz);
+    if (fd >= 0) ::close(fd);
+  }
+
+  bool init() {
+    io_uring_params p;
+    std::memset(&p, 0, sizeof p);
+    fd = int(syscall(__NR_io_uring_setup, 2, &p));
+    if (fd < 0) return false;
+
+    sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sq_sz = cq_sz = (sq_sz > cq_sz ? sq_sz : cq_sz);
+
+    sq_ptr = mmap(nullptr, sq_sz, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) return false;
+    cq_ptr = single ? sq_ptr
+           : mmap(nullptr, cq_sz, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) return false;
+    sqes_sz = p.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(
+        mmap(nullptr, sqes_sz, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED) return false;
+
+    char* sq = static_cast<char*>(sq_ptr);
+    char* cq = static_cast<char*>(cq_ptr);
+    sq_tail  = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask  = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    cq_head  = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail  = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask  = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes     = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    return true;
+  }
+
+  bool submit_write(int out, const char* p, size_t n, uint64_t off) {
+    const unsigned tail = *sq_tail;
+    const unsigned i = tail & *sq_mask;
+    io_uring_sqe& e = sqes[i];
+    std::memset(&e, 0, sizeof e);
+    e.opcode = IORING_OP_WRITE;
+    e.fd     = out;
+    e.addr   = reinterpret_cast<uint64_t>(p);
+    e.len    = unsigned(n);
+    e.off    = off;
+    sq_array[i] = i;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    long r;
+    do r = syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0);
+    while (r < 0 && errno == EINTR);
+    return r == 1;
+  }
+
+  // Result of the one write in flight: bytes written or -errno.
+  int64_t wait() {
+    for (;;) {
+      const unsigned head = *cq_head;
+      if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        const int64_t res = cqes[head & *cq_mask].res;
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return res;
+      }
+      const long r = syscall(__NR_io_uring_enter, fd, 0, 1,
+                             IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (r < 0 && errno != EINTR) return -errno;
+    }
+  }
+};
+#else
+struct OutputSink::Ring {
+  bool init() { return false; }
+  bool submit_write(int, const char*, size_t, uint64_t) { return false; }
+  int64_t wait() { return -ENOSYS; }
+};
+#endif
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+OutputSink::OutputSink() {}
+
+OutputSink::~OutputSink() { close(); }
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool OutputSink::open(FILE* f, bool own, bool io_uring) {
+  close();
+  failed_ = false;
+  err_.clear();
+
+  // anything the caller put through stdio goes first
+  if (std::fflush(f) != 0) return fail("write error");
+  fp_ = f;
+  fd_ = fileno(f);
+  own_ = own;
+
+  struct stat st;
+  regular_ = fstat(fd_, &st) == 0 && S_ISREG(st.st_mode);
+  off_ = 0;
+  if (regular_) {
+    const off_t pos = lseek(fd_, 0, SEEK_CUR);
+    if (pos < 0) regular_ = false; else off_ = uint64_t(pos);
+  }
+  prealloc_ = false;
+
+  for (auto& b : buf_) b.resize(kBufBytes);
+  cur_ = 0;
+  len_ = 0;
+  busy_ = stop_ = false;
+
+  // io_uring only for regular files; everything else gets the thread
+  if (io_uring && regular_) {
+    ring_.reset(new Ring);
+    if (!ring_->init()) ring_.reset();
+  }
+  if (!ring_) writer_ = std::thread(&OutputSink::run, this);
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool OutputSink::write(const void* p, size_t n) {
+  if (fd_ < 0 || failed_) return false;
+  const char* s = static_cast<const char*>(p);
+  while (n) {
+    size_t take = kBufBytes - len_;
+    if (take > n) take = n;
+    std::memcpy(buf_[cur_].data() + len_, s, take);
+    len_ += take;
+    s += take;
+    n -= take;
+    if (len_ == kBufBytes && !hand_off()) return false;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// KEEP_SIZE leaves the file size alone, so a short estimate costs
+// nothing and a long one is trimmed by close().
+// ---------------------------------------------------------------------
+void OutputSink::preallocate(uint64_t bytes) {
+#ifdef FALLOC_FL_KEEP_SIZE
+  if (fd_ < 0 || !regular_ || bytes == 0) return;
+  if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, off_t(off_ + len_), off_t(bytes)) == 0)
+    prealloc_ = true;
+#else
+  (void)bytes;
+#endif
+}
+
+// ---------------------------------------------------------------------
+// Write buf_[cur_] behind the one still in flight, if any, and carry on
+// filling the other.
+// ---------------------------------------------------------------------
+bool OutputSink::hand_off() {
+  if (len_ == 0) return !failed_;
+  if (!wait_idle()) return false;
+
+  const char* p = buf_[cur_].data();
+  if (ring_) {
+    if (!ring_->submit_write(fd_, p, len_, off_)) {
+      // the ring refused; finish the job by hand from here on
+      ring_.reset();
+      writer_ = std::thread(&OutputSink::run, this);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lk(m_);
+    pend_ = p;
+    pend_len_ = len_;
+    pend_off_ = off_;
+    busy_ = true;
+  }
+  if (!ring_) cv_.notify_all();
+
+  off_ += len_;
+  len_ = 0;
+  cur_ ^= 1;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool OutputSink::wait_idle() {
+  if (ring_) {
+    if (busy_) {
+      const int64_t r = ring_->wait();
+      busy_ = false;
+      // short or refused writes are finished synchronously
+      const size_t done = r > 0 ? size_t(r) : 0;
+      if (r < 0 && r != -EINVAL && r != -EOPNOTSUPP && r != -EAGAIN)
+        return fail(std::string("write error: ") + std::strerror(int(-r)));
+      if (done < pend_len_
+          && !write_all(pend_ + done, pend_len_ - done, pend_off_ + done))
+        return false;
+    }
+    return !failed_;
+  }
+  std::unique_lock<std::mutex> lk(m_);
+  cv_.wait(lk, [&]{ return !busy_; });
+  return !failed_;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool OutputSink::write_all(const char* p, size_t n, uint64_t off) {
+  while (n) {
+    const ssize_t r = regular_ ? ::pwrite(fd_, p, n, off_t(off))
+                               : ::write(fd_, p, n);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0)
+      return fail(std::string("write error: ")
+                  + std::strerror(r < 0 ? errno : EIO));
+    p += r;
+    n -= size_t(r);
+    off += uint64_t(r);
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// Writer thread: one pending buffer at a time.
+// ---------------------------------------------------------------------
+void OutputSink::run() {
+  std::unique_lock<std::mutex> lk(m_);
+  for (;;) {
+    cv_.wait(lk, [&]{ return busy_ || stop_; });
+    if (!busy_) return;
+    const char* p = pend_;
+    const size_t n = pend_len_;
+    const uint64_t off = pend_off_;
+    lk.unlock();
+    if (!failed_) write_all(p, n, off);
+    lk.lock();
+    busy_ = false;
+    cv_.notify_all();
+  }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool OutputSink::flush() {
+  if (fd_ < 0) return !failed_;
+  hand_off();
+  wait_idle();
+  return !failed_;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool OutputSink::close() {
+  if (fd_ < 0) return !failed_;
+  flush();
+
+  if (writer_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    writer_.join();
+  }
+  ring_.reset();
+
+  if (regular_) {
+    // drop preallocated space past the end; leave the offset there
+    if (prealloc_ && !failed_ && ftruncate(fd_, off_t(off_)) != 0)
+      fail(std::string("truncate: ") + std::strerror(errno));
+    lseek(fd_, off_t(off_), SEEK_SET);
+  }
+  if (own_ && std::fclose(fp_) != 0) fail("write error");
+
+  fp_ = nullptr;
+  fd_ = -1;
+  own_ = false;
+  for (auto& b : buf_) std::vector<char>().swap(b);
+  len_ = 0;
+  return !failed_;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool OutputSink::fail(const std::string& e) {
+  std::lock_guard<std::mutex> lk(m_);
+  if (!failed_) { err_ = e; failed_ = true; }
+  return false;
+}
@@ -0,0 +1,386 @@
+#include "par_source.h"
+#include <bzlib.h>
+#include <lzma.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+void ParallelBlockSource::start(size_t first, size_t njobs, unsigned threads) {
+  stop();
+  const size_t todo = (njobs > first) ? njobs - first : 0;
+  if (threads < 1) threads = 1;
+  if (threads > todo) threads = unsigned(todo ? todo : 1);
+
+  window_.assign(size_t(threads) * kWindowPerThread, Result());
+  njobs_ = njobs;
+  next_job_ = cur_ = first;
+  holding_ = false;
+  stop_ = false;
+  drop_ = 0;
+  uoff_ = 0;
+
+  for (unsigned t = 0; t < threads; ++t)
+    workers_.emplace_back(&ParallelBlockSource::work, this);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+void ParallelBlockSource::stop() {
+  {
+    std::lock_guard<std::mutex> lk(m_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& t : workers_) t.join();
+  workers_.clear();
+}
+
+// ---------------------------------------------------------------------
+// Worker: claim the next job once its window slot has been released by
+// the consumer, decode it outside the lock, publish.
+// ---------------------------------------------------------------------
+void ParallelBlockSource::work() {
+  const size_t W = window_.size();
+  for (;;) {
+    size_t j;
+    {
+      std::unique_lock<std::mutex> lk(m_);
+      // slot j % W is free once the consumer moved past job j - W
+      const auto released = [&]{ return cur_ - (holding_ ? 1 : 0); };
+      cv_.wait(lk, [&]{
+        return stop_ || next_job_ >= njobs_ || next_job_ < released() + W;
+      });
+      if (stop_ || next_job_ >= njobs_) return;
+      j = next_job_++;
+    }
+
+    Result& r = window_[j % W];
+    std::string err;
+    const bool ok = decode_job(j, r.data, err);
+
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      r.ok = ok;
+      r.err = err;
+      r.ready = true;
+    }
+    cv_.notify_all();
+  }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ParallelBlockSource::next(const unsigned char** p, size_t* n) {
+  const size_t W = window_.size();
+  std::unique_lock<std::mutex> lk(m_);
+
+  for (;;) {
+    if (holding_) {
+      window_[(cur_ - 1) % W].ready = false;
+      holding_ = false;
+      cv_.notify_all();
+    }
+    // jobs a recovered one took in: wait for them, drop the result
+    for (; drop_ > 0 && cur_ < njobs_; --drop_) {
+      Result& r = window_[cur_ % W];
+      cv_.wait(lk, [&]{ return r.ready; });
+      r.ready = false;
+      ++cur_;
+      cv_.notify_all();
+    }
+    if (cur_ >= njobs_ || failed_) return false;
+
+    Result& r = window_[cur_ % W];
+    cv_.wait(lk, [&]{ return r.ready; });
+    ++cur_;
+    holding_ = true;
+
+    if (!r.ok) {
+      // the held slot is the consumer's alone; retry without the lock
+      size_t merged = 0;
+      lk.unlock();
+      const bool ok = recover_job(cur_ - 1, r.data, &merged, r.err);
+      lk.lock();
+      if (!ok) return fail(r.err);
+      drop_ = merged;
+    }
+    if (r.data.empty()) continue;
+
+    // every block start is a restart point
+    if (want_point(uoff_)) {
+      AccessPoint ap;
+      ap.uoff = uoff_;
+      ap.coff = job_coff(cur_ - 1);
+      ap.block = uint32_t(cur_ - 1);
+      points_->push_back(std::move(ap));
+    }
+    uoff_ += r.data.size();
+
+    *p = r.data.data();
+    *n = r.data.size();
+    return true;
+  }
+}
+
+// ---------------------------------------------------------------------
+// Read the combined index of all streams in the file.
+// ---------------------------------------------------------------------
+bool ParallelXzSource::open_index(const std::string& path) {
+  static const unsigned char kMagic[6] = { 0xFD, '7', 'z', 'X', 'Z', 0x00 };
+  if (!mf_.open(path)) return false;
+  const unsigned char* d = mf_.data();
+  const size_t n = mf_.size();
+  if (n < 32 || std::memcmp(d, kMagic, sizeof kMagic) != 0) return false;
+
+  lzma_stream s = LZMA_STREAM_INIT;
+  lzma_index* idx = nullptr;
+  if (lzma_file_info_decoder(&s, &idx, UINT64_MAX, n) != LZMA_OK) return false;
+
+  // Whole file is mapped; a seek request is just a pointer move.
+  s.next_in = d;
+  s.avail_in = n;
+  lzma_ret r;
+  for (;;) {
+    r = lzma_code(&s, LZMA_RUN);
+    if (r != LZMA_SEEK_NEEDED) break;
+    s.next_in = d + s.seek_pos;
+    s.avail_in = n - size_t(s.seek_pos);
+  }
+  lzma_end(&s);
+  if (r != LZMA_STREAM_END) return false;
+
+  blocks_.clear();
+  lzma_index_iter it;
+  lzma_index_iter_init(&it, idx);
+  while (!lzma_index_iter_next(&it, LZMA_INDEX_ITER_BLOCK)) {
+    Block b;
+    b.coff     = it.block.compressed_file_offset;
+    b.csize    = it.block.total_size;
+    b.unpadded = it.block.unpadded_size;
+    b.uoff     = it.block.uncompressed_file_offset;
+    b.usize    = it.block.uncompressed_size;
+    b.check    = uint32_t(it.stream.flags->check);
+    blocks_.push_back(b);
+  }
+  lzma_index_end(idx, nullptr);
+  return !blocks_.empty();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ParallelXzSource::worthwhile() const {
+  if (blocks_.size() < 2) return false;
+  for (const auto& b : blocks_)
+    if (b.usize > kMaxBlock) return false;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool ParallelXzSource::decode_job(size_t j, std::vector<unsigned char>& out,
+                                  std::string& err)
+{
+  const Block& b = blocks_[j];
+  const uint8_t* in = mf_.data() + b.coff;
+
+  lzma_filter filters[LZMA_FILTERS_MAX + 1];
+  lzma_block blk;
+  std::memset(&blk, 0, sizeof blk);
+  blk.version = 1;
+  blk.check = lzma_check(b.check);
+  blk.filters = filters;
+  blk.header_size = lzma_block_header_size_decode(in[0]);
+
+  if (lzma_block_header_decode(&blk, nullptr, in) != LZMA_OK) {
+    err = "xz: bad block header";
+    return false;
+  }
+
+  lzma_ret r = lzma_block_compressed_size(&blk, b.unpadded);
+  if (r == LZMA_OK) {
+    out.resize(b.usize);
+    size_t in_pos = blk.header_size, out_pos = 0;
+    r = lzma_block_buffer_decode(&blk, nullptr, in, &in_pos, b.csize,
+                                 out.data(), &out_pos, out.size());
+    if (r == LZMA_OK && out_pos != b.usize) r = LZMA_DATA_ERROR;
+  }
+  for (size_t i = 0; filters[i].id != LZMA_VLI_UNKNOWN; ++i)
+    std::free(filters[i].options);
+
+  if (r != LZMA_OK) {
+    err = "xz: block " + std::to_string(j) + " failed to decode";
+    return false;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// bzip2 bit helpers. The format is a big-endian bit stream.
+// ---------------------------------------------------------------------
+namespace {
+
+constexpr uint64_t kBz2BlockMagic = 0x314159265359ULL;
+constexpr uint64_t kBz2EosMagic   = 0x177245385090ULL;
+constexpr uint64_t kMask48        = (1ULL << 48) - 1;
+
+// Well above the largest compressed block (900k symbols at level 9); a
+// merge that grows past it is not finding the block's end.
+constexpr uint64_t kMaxBlockBits  = 2ULL * 900000 * 8;
+
+uint64_t get_bits(const unsigned char* d, uint64_t pos, unsigned n) {
+  uint64_t v = 0;
+  for (unsigned i = 0; i < n; ++i, ++pos)
+    v = (v << 1) | ((d[pos >> 3] >> (7 - (pos & 7))) & 1);
+  return v;
+}
+
+struct BitWriter {
+  std::vector<unsigned char>& out;
+  uint32_t acc = 0;
+  unsigned nacc = 0; // pending bits in acc (< 8)
+
+  void put(uint64_t v, unsigned n) {
+    while (n--) {
+      acc = (acc << 1) | uint32_t((v >> n) & 1);
+      if (++nacc == 8) { out.push_back(uint8_t(acc)); acc = 0; nacc = 0; }
+    }
+  }
+  // Append source bits [from, to); the writer must be byte aligned.
+  void copy(const unsigned char* d, uint64_t from, uint64_t to) {
+    const uint64_t nbits = to - from;
+    const unsigned sh = unsigned(from & 7);
+    const unsigned char* s = d + (from >> 3);
+    const size_t nbytes = size_t(nbits >> 3);
+    const size_t base = out.size();
+    out.resize(base + nbytes);
+    unsigned char* o = out.data() + base;
+    if (sh == 0) {
+      std::memcpy(o, s, nbytes);
+    } else {
+      for (size_t i = 0; i < nbytes; ++i)
+        o[i] = uint8_t((s[i] << sh) | (s[i+1] >> (8 - sh)));
+    }
+    const unsigned rest = unsigned(nbits & 7);
+    if (rest) put(get_bits(d, from + nbytes * 8, rest), rest);
+  }
+  void flush() { if (nacc) put(0, 8 - nacc); }
+};
+
+} // namespace
+
+// ---------------------------------------------------------------------
+// Locate every block by its magic. A block runs up to the next block
+// magic or the end-of-stream magic, so concatenated streams work too.
+// All magics are kept: one that turns out to lie inside a block is
+// merged over by recover_job().
+// ---------------------------------------------------------------------
+bool ParallelBz2Source::open_scan(const std::string& path, uint64_t from) {
+  if (!mf_.open(path)) return false;
+  const unsigned char* d = mf_.data();
+  const size_t n = mf_.size();
+  if (n < 14 || d[0] != 'B' || d[1] != 'Z' || d[2] != 'h'
+      || d[3] < '1' || d[3] > '9') return false;
+  if (from / 8 >= n) return false;
+
+  struct Mark { uint64_t bit; bool eos; };
+  std::vector<Mark> marks;
+
+  uint64_t w = 0;
+  const size_t i0 = size_t(from / 8);
+  for (size_t i = i0; i < n; ++i) {
+    w = (w << 8) | d[i];
+    if (i < i0 + 5) continue;
+    const uint64_t end = uint64_t(i + 1) * 8;
+    for (unsigned k = 8; k-- > 0; ) {  // earliest start first
+      if (end < 48 + k || end - k - 48 < from) continue;
+      const uint64_t v = (w >> k) & kMask48;
+      if (v == kBz2BlockMagic || v == kBz2EosMagic)
+        marks.push_back({ end - k - 48, v == kBz2EosMagic });
+    }
+  }
+
+  blocks_.clear();
+  marks_.clear();
+  for (size_t i = 0; i + 1 < marks.size(); ++i) {
+    if (!marks[i].eos) blocks_.push_back({ marks[i].bit, marks[i+1].bit });
+  }
+  for (const Mark& m : marks) marks_.push_back(m.bit);
+  // a trailing block magic without a terminator means a truncated file
+  if (!marks.empty() && !marks.back().eos) return false;
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// Wrap one block as "BZh9" + block + end-of-stream marker whose combined
+// CRC equals the block CRC, then run it through libbz2.
+// ---------------------------------------------------------------------
+bool ParallelBz2Source::decode_block(const unsigned char* base, const Block& b,
+                                     std::vector<unsigned char>& out,
+                                     std::string& err)
+{
+  std::vector<unsigned char> in;
+  in.reserve(size_t((b.bit_end - b.bit_start) / 8 + 16));
+  in.insert(in.end(), { 'B', 'Z', 'h', '9' });
+
+  BitWriter bw{in};
+  bw.copy(base, b.bit_start, b.bit_end);
+  const uint64_t crc = get_bits(base, b.bit_start + 48, 32);
+  bw.put(kBz2EosMagic, 48);
+  bw.put(crc, 32);
+  bw.flush();
+
+  bz_stream s;
+  std::memset(&s, 0, sizeof s);
+  if (BZ2_bzDecompressInit(&s, 0, 0) != BZ_OK) { err = "bz2: init"; return false; }
+
+  s.next_in = reinterpret_cast<char*>(in.data());
+  s.avail_in = unsigned(in.size());
+  if (out.size() < (1u << 20)) out.resize(1u << 20);
+  size_t produced = 0;
+  int r;
+  for (;;) {
+    if (produced == out.size()) out.resize(out.size() * 2);
+    s.next_out = reinterpret_cast<char*>(out.data() + produced);
+    s.avail_out = unsigned(out.size() - produced);
+    r = BZ2_bzDecompress(&s);
+    produced = out.size() - s.avail_out;
+    if (r != BZ_OK) break;
+    if (s.avail_in == 0 && s.avail_out != 0) { r = BZ_UNEXPECTED_EOF; break; }
+  }
+  BZ2_bzDecompressEnd(&s);
+  out.resize(produced);
+
+  if (r != BZ_STREAM_END) {
+    err = "bz2: block at bit " + std::to_string(b.bit_start)
+        + " failed to decode (" + std::to_string(r) + ")";
+    return false;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// Block 'j' failed: its end may be a magic that occurs by chance in the
+// block's bits, so extend it to each later magic in turn until it
+// decodes. The blocks that started inside the merged span were false
+// starts and are dropped.
+// ---------------------------------------------------------------------
+bool ParallelBz2Source::recover_job(size_t j, std::vector<unsigned char>& out,
+                                    size_t* merged, std::string& err)
+{
+  Block b = blocks_[j];
+  std::string e;
+  auto m = std::upper_bound(marks_.begin(), marks_.end(), b.bit_end);
+  for (; m != marks_.end() && *m - b.bit_start <= kMaxBlockBits; ++m) {
+    b.bit_end = *m;
+    if (!decode_block(mf_.data(), b, out, e)) continue;
+
+    size_t k = j + 1;
+    while (k < blocks_.size() && blocks_[k].bit_start < b.bit_end) ++k;
+    *merged = k - j - 1;
+    return true;
+  }
+  (void)err;  // keep the first attempt's message
+  return false;
+}
@@ -0,0 +1,27 @@
+#include "record_source.h"
+#include "converter.h"
+#include "ndjson_reader.h"
+#include "text_reader.h"
+#include "trace_reader.h"
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+std::unique_ptr<RecordSource> open_records(const ConvertPlan& plan,
+                                           std::string* err)
+{
+  const std::string& in = plan.in.path;
+  switch (plan.in.fmt) {
+    case BaseFmt::CBP_BIN:
+    case BaseFmt::CBPC:
+      return std::unique_ptr<RecordSource>(
+          new TraceReader(in.c_str(), plan.opt.rd));
+    case BaseFmt::NDJSON:
+      return std::unique_ptr<RecordSource>(new NdjsonReader(in, plan.opt.rd));
+    case BaseFmt::CBP_TEXT:
+      return std::unique_ptr<RecordSource>(new TextReader(in, plan.opt.rd));
+    default:
+      break;
+  }
+  if (err) *err = "no reader for " + in;
+  return nullptr;
+}
@@ -0,0 +1,226 @@
+#include "riscv_op.h"
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+static inline OpKind to_kind(InstClass c) {
+  switch (c) {
+    case InstClass::aluInstClass:                  return OpKind::ALU;
+    case InstClass::callDirectInstClass:           return OpKind::CALL_DIR;
+    case InstClass::callIndirectInstClass:         return OpKind::CALL_IND;
+    case InstClass::condBranchInstClass:           return OpKind::COND_BR;
+    case InstClass::fpInstClass:                   return OpKind::FP;
+    case InstClass::loadInstClass:                 return OpKind::LOAD;
+    case InstClass::ReturnInstClass:               return OpKind::RET;
+    case InstClass::slowAluInstClass:              return OpKind::SLOW_ALU;
+    case InstClass::storeInstClass:                return OpKind::STORE;
+    case InstClass::uncondDirectBranchInstClass:   return OpKind::UNCOND_DIR;
+    case InstClass::uncondIndirectBranchInstClass: return OpKind::UNCOND_IND;
+    default:                                       return OpKind::UNKNOWN;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+static inline bool is_branch_class(InstClass c) {
+  switch (c) {
+    case InstClass::callDirectInstClass:
+    case InstClass::callIndirectInstClass:
+    case InstClass::condBranchInstClass:
+    case InstClass::ReturnInstClass:
+    case InstClass::uncondDirectBranchInstClass:
+    case InstClass::uncondIndirectBranchInstClass:
+      return true;
+    default: return false;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+void map_db_to_op(const db_t& d, Op& op) {
+  op = {};
+
+  // scalars
+  op.pc   = d.pc;
+  op.kind = to_kind(d.insn_class);
+
+  // branch/call meta
+  if (is_branch_class(d.insn_class)) {
+    // Prefer the field you already have;
+    // (next_pc != pc+4) was how << prints it
+    op.taken  = d.is_taken;
+    op.target = d.next_pc;
+  } else {
+    op.taken  = false;
+    op.target = 0;
+  }
+
+  // memory meta
+  if (d.insn_class == InstClass::loadInstClass || d.is_load ||
+      d.insn_class == InstClass::storeInstClass || d.is_store) {
+    op.ea   = d.addr;
+    op.size = static_cast<uint32_t>(d.size);
+  } else {
+    op.ea = 0;
+    op.size = 0;
+  }
+
+  // inputs A/B/C (in order), using log_reg/value
+  auto push_in = [&](const db_operand_t& x){
+    if (x.valid) op.inputs[op.n_in++] = RegRef{ static_cast<uint32_t>(x.log_reg),
+                                                x.value, x.is_int };
+  };
+  push_in(d.A);
+  push_in(d.B);
+  push_in(d.C);
+
+  // output D
+  if (d.D.valid) {
+    op.output  = RegRef{ static_cast<uint32_t>(d.D.log_reg), d.D.value,
+                         d.D.is_int };
+    op.has_out = true;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+static inline RvInst rv(RvForm f, uint32_t rd, uint32_t rs1, uint32_t rs2,
+                        int64_t imm = 0, uint32_t rs3 = 0) {
+  RvInst i;
+  i.form = f;
+  i.rd  = uint8_t(rd);
+  i.rs1 = uint8_t(rs1);
+  i.rs2 = uint8_t(rs2);
+  i.rs3 = uint8_t(rs3);
+  i.imm = int32_t(imm);
+  return i;
+}
+
+// -----------------------------------------------------------------------------
+// Same choices, register for register, as format_asm_line() prints.
+// -----------------------------------------------------------------------------
+RvInst rv_select(const Op& op) {
+  const RegRef* in = op.inputs;
+  const uint32_t r1 = op.n_in >= 1 ? cap_reg(in[0].idx) : 0;
+  const uint32_t r2 = op.n_in >= 2 ? cap_reg(in[1].idx) : 0;
+  const uint32_t r3 = op.n_in >= 3 ? cap_reg(in[2].idx) : 0;
+  const uint32_t rd = op.has_out ? rd_reg(op.output.idx) : 1;
+  const int64_t  d  = signed_delta(op.pc, op.target);
+
+  switch (op.kind) {
+    case OpKind::ALU:
+      if (!op.has_out && op.n_in == 1) return rv(RvForm::ADD, 1, r1, 0);
+      if (op.has_out && op.n_in >= 1 && op.n_in <= 2)
+        return rv(RvForm::ADD, rd, r1, r2);
+      // "fsl rd, rs1, rs3, rs2": the asm's second operand is rs3
+      if (op.has_out && op.n_in == 3)
+        return rv(RvForm::FSL, rd, r1, r3, 0, r2);
+      return rv(RvForm::FENCE_I, 0, 0, 0);
+
+    case OpKind::CALL_DIR:
+      return rv(RvForm::JAL, rd, 0, 0, fits_signed_nbits(d, 20) ? d : 0);
+
+    case OpKind::CALL_IND:
+      return rv(RvForm::JALR, rd, r1, 0);
+
+    case OpKind::COND_BR:
+      if (!op.taken) return rv(RvForm::BNE, 0, 0, 0);
+      return rv(RvForm::BEQ, 0, 0, 0, fits_signed_nbits(d, 12) ? d : 0);
+
+    case OpKind::LOAD:
+      switch (op.size) {
+        case 1:  return rv(RvForm::LBU, 0, 0, 0);
+        case 2:  return rv(RvForm::LHU, 0, 0, 0);
+        case 4:  return rv(RvForm::LWU, 0, 0, 0);
+        default: return rv(RvForm::LD,  0, 0, 0);
+      }
+
+    case OpKind::RET:
+      return rv(RvForm::JALR, 0, op.n_in >= 1 ? r1 : 1, 0);
+
+    case OpKind::SLOW_ALU:
+      return rv(RvForm::DIVU, 0, 0, 0);
+
+    case OpKind::STORE:
+      switch (op.size) {
+        case 1:  return rv(RvForm::SB, 0, r1, r2);
+        case 2:  return rv(RvForm::SH, 0, r1, r2);
+        case 4:  return rv(RvForm::SW, 0, r1, r2);
+        default: return rv(RvForm::SD, 0, r1, r2);
+      }
+
+    case OpKind::UNCOND_DIR:
+      return rv(RvForm::JAL, 0, 0, 0, fits_signed_nbits(d, 20) ? d : 0);
+
+    case OpKind::UNCOND_IND:
+      // the 12-bit field takes the low bits of the offset, as asm prints it
+      return rv(RvForm::JALR, 0, r1, 0,
+                int64_t(mask_nbits(uint64_t(d), 12) ^ 0x800) - 0x800);
+
+    default:
+      return rv(RvForm::FENCE_I, 0, 0, 0);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Fixed bits (opcode, funct3, funct7/funct2) and operand layout per form.
+// -----------------------------------------------------------------------------
+namespace {
+
+enum class RvType : uint8_t { R, R4, I, S, B, J };
+
+struct FormInfo {
+  uint32_t base;
+  RvType   type;
+};
+
+constexpr FormInfo kForms[size_t(RvForm::COUNT)] = {
+  { 0x0000100f, RvType::I  },   // fence.i
+  { 0x00000033, RvType::R  },   // add
+  { 0x04001033, RvType::R4 },   // fsl
+  { 0x02005033, RvType::R  },   // divu
+  { 0x0000006f, RvType::J  },   // jal
+  { 0x00000067, RvType::I  },   // jalr
+  { 0x00000063, RvType::B  },   // beq
+  { 0x00001063, RvType::B  },   // bne
+  { 0x00004003, RvType::I  },   // lbu
+  { 0x00005003, RvType::I  },   // lhu
+  { 0x00006003, RvType::I  },   // lwu
+  { 0x00003003, RvType::I  },   // ld
+  { 0x00000023, RvType::S  },   // sb
+  { 0x00001023, RvType::S  },   // sh
+  { 0x00002023, RvType::S  },   // sw
+  { 0x00003023, RvType::S  },   // sd
+};
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+uint32_t rv_encode(const RvInst& i) {
+  const FormInfo& f = kForms[size_t(i.form)];
+  const uint32_t imm = uint32_t(i.imm);
+  const uint32_t rd  = uint32_t(i.rd)  << 7;
+  const uint32_t rs1 = uint32_t(i.rs1) << 15;
+  const uint32_t rs2 = uint32_t(i.rs2) << 20;
+
+  switch (f.type) {
+    case RvType::R:
+      return f.base | rd | rs1 | rs2;
+    case RvType::R4:
+      return f.base | rd | rs1 | rs2 | (uint32_t(i.rs3) << 27);
+    case RvType::I:
+      return f.base | rd | rs1 | ((imm & 0xfff) << 20);
+    case RvType::S:
+      return f.base | rs1 | rs2 | ((imm & 0x1f) << 7)
+           | (((imm >> 5) & 0x7f) << 25);
+    case RvType::B:
+      return f.base | rs1 | rs2
+           | (((imm >> 11) & 0x1)  << 7)  | (((imm >> 1) & 0xf) << 8)
+           | (((imm >> 5)  & 0x3f) << 25) | (((imm >> 12) & 0x1) << 31);
+    case RvType::J:
+      return f.base | rd | (imm & 0xff000)
+           | (((imm >> 11) & 0x1)   << 20) | (((imm >> 1) & 0x3ff) << 21)
+           | (((imm >> 20) & 0x1)   << 31);
+  }
+  return f.base;
+}
@@ -0,0 +1,124 @@
+#include "shard.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ---------------------------------------------------------------------
+// Existing index first; otherwise walk the trace once without decoding.
+// ---------------------------------------------------------------------
+static std::shared_ptr<const TraceIndex> shard_index(const ConvertPlan& plan) {
+  const std::string& in = plan.in.path;
+  const std::string idx_path = plan.opt.rd.index.empty()
+                             ? TraceIndex::sidecar(in) : plan.opt.rd.index;
+  std::string err;
+  auto idx = std::make_shared<TraceIndex>();
+
+  if (FILE* f = std::fopen(idx_path.c_str(), "rb")) {
+    std::fclose(f);
+    if (idx->load(idx_path, in, &err)) return idx;
+    std::fprintf(stderr, "-W: ignoring index: %s\n", err.c_str());
+  }
+  if (idx->build(in, TraceIndex::kDefaultSpan, &err, false)) return idx;
+  std::fprintf(stderr, "-W: cannot shard (%s); converting serially\n",
+               err.c_str());
+  return nullptr;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+ShardResult run_sharded(const ConvertPlan& plan, ArchiveWriter& out,
+                        const ShardFn& fn, uint64_t* count)
+{
+  unsigned threads = plan.opt.threads;
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads < 2 || plan.limit != ~0ULL) return ShardResult::SERIAL;
+  if (plan.in.fmt != BaseFmt::CBP_BIN && plan.in.fmt != BaseFmt::CBPC)
+    return ShardResult::SERIAL;
+
+  std::shared_ptr<const TraceIndex> idx = shard_index(plan);
+  if (!idx) return ShardResult::SERIAL;
+
+  const uint64_t first = plan.opt.skip;
+  const uint64_t end = std::min(plan.opt.end, idx->instrs());
+  if (first >= end) return ShardResult::SERIAL;
+
+  uint64_t k = (end - first) / kMinShardInstrs;
+  if (k > threads) k = threads;
+  if (k < 2) return ShardResult::SERIAL;
+  const unsigned nshards = unsigned(k);
+
+  // Shards after the first go to temporary files next to the output.
+  const bool to_file = !plan.out.path.empty();
+  std::vector<FILE*> outs(nshards, nullptr);
+  std::vector<std::string> names(nshards);
+  std::vector<std::unique_ptr<ArchiveWriter>> ws(nshards);
+  bool ok = true;
+  for (unsigned s = 1; s < nshards && ok; ++s) {
+    if (to_file) {
+      names[s] = plan.out.path + ".part" + std::to_string(s);
+      outs[s] = std::fopen(names[s].c_str(), "w+b");
+    } else {
+      outs[s] = std::tmpfile();
+    }
+    ws[s].reset(new ArchiveWriter);
+    ws[s]->use_io_uring(out.io_uring());
+    // plain text; 'out' compresses it when the parts are joined
+    if (!outs[s] || !ws[s]->open(outs[s], StreamCodec::NONE)) {
+      std::fprintf(stderr, "-E: cannot create shard output %s\n",
+                   to_file ? names[s].c_str() : "(tmpfile)");
+      ok = false;
+    }
+  }
+
+  std::vector<uint64_t> counts(nshards, 0);
+  std::vector<char> oks(nshards, 0);
+  if (ok) {
+    ReaderOpts rd = plan.opt.rd;
+    rd.decomp_threads = 1;  // the shards are the parallelism
+
+    std::vector<std::thread> pool;
+    for (unsigned s = 0; s < nshards; ++s) {
+      pool.emplace_back([&, s]{
+        const uint64_t a = first + (end - first) * s / nshards;
+        const uint64_t b = first + (end - first) * (s + 1) / nshards;
+        TraceReader tr(plan.in.path.c_str(), rd);
+        tr.set_quiet(true);
+        tr.use_index(idx);
+        ArchiveWriter& w = s ? *ws[s] : out;
+        oks[s] = tr.set_window(a, b) && fn(tr, w, &counts[s]) && !tr.error();
+      });
+    }
+    for (auto& t : pool) t.join();
+  }
+
+  // Stitch in order; shard 0 is already in place.
+  uint64_t total = 0;
+  for (unsigned s = 0; s < nshards; ++s) {
+    if (ok && !oks[s]) {
+      std::fprintf(stderr, "-E: shard %u failed\n", s);
+      ok = false;
+    }
+    if (s > 0 && outs[s]) {
+      if (!ws[s]->close() && ok) {
+        std::fprintf(stderr, "-E: shard %u output: %s\n", s,
+                     ws[s]->error().c_str());
+        ok = false;
+      }
+      if (ok && !out.append(outs[s])) {
+        std::fprintf(stderr, "-E: failed to append shard %u: %s\n", s,
+                     out.error().c_str());
+        ok = false;
+      }
+      std::fclose(outs[s]);
+      if (to_file) std::remove(names[s].c_str());
+    }
+    total += counts[s];
+  }
+
+  *count = total;
+  std::cout << " Read " << end << " instrs " << std::endl;
+  return ok ? ShardResult::OK : ShardResult::FAILED;
+}
@@ -1,8 +1,5 @@
 #include "text_fmt.h"
-#include <sstream>
-#include <iomanip>
-#include <algorithm>
-#include <cctype>
+#include "fmt_util.h"
 
 static inline const char* type_name(const db_t& d) {
   switch (d.insn_class) {
@@ -20,65 +17,58 @@ static inline const char* type_name(const db_t& d) {
   }
 }
 
-// lowercase 0x + no leading zeros (except single 0)
-static inline std::string norm_hex_0x(uint64_t x) {
-  std::ostringstream os;
-  os << std::hex << std::nouppercase << x;
-  std::string body = os.str();
-  // remove leading zeros by converting through integer already; just ensure "0"
-  if (body.empty()) body = "0";
-  return std::string("0x") + body;
+static inline char* add_operand(char* p, const db_operand_t& o) {
+  p = put(p, "(int: ");
+  *p++ = o.is_int ? '1' : '2';
+  p = put(p, ", idx: ");
+  p = put_dec(p, o.log_reg);
+  p = put(p, " val: ");
+  p = put_hex(p, o.value);
+  return put(p, ")  ");
 }
 
-// hex body with no 0x, lowercase, no leading zeros
-static inline std::string hex_body(uint64_t x) {
-  std::ostringstream os;
-  os << std::hex << std::nouppercase << x;
-  std::string s = os.str();
-  if (s.empty()) return "0";
-  // remove all leading zeros but keep one if all zeros
-  auto it = std::find_if(s.begin(), s.end(), [](char c){ return c!='0'; });
-  if (it == s.end()) return "0";
-  return std::string(it, s.end());
-}
-
-static inline void add_input(std::ostringstream& oss,
-                             const char* ordinal,
-                             const db_operand_t& o)
+static inline char* add_input(char* p, const char* ordinal,
+                              const db_operand_t& o)
 {
-  if (!o.valid) return;
-  oss << ordinal << " input:  "
-      << "(int: " << (o.is_int ? 1 : 2)
-      << ", idx: " << std::dec << o.log_reg
-      << " val: " << hex_body(o.value) << ")  ";
+  if (!o.valid) return p;
+  p = put(p, ordinal);
+  p = put(p, " input:  ");
+  return add_operand(p, o);
 }
 
-std::string format_text_line(const db_t& d)
+char* format_text_line(const db_t& d, char* p)
 {
-  std::ostringstream oss;
-  oss << "[PC: " << norm_hex_0x(d.pc)
-      << " type: " << type_name(d) << ' ';
+  p = put(p, "[PC: 0x");
+  p = put_hex(p, d.pc);
+  p = put(p, " type: ");
+  p = put(p, type_name(d));
+  *p++ = ' ';
 
   // memory metadata
   if (d.is_load || d.is_store) {
-    oss << "ea: "   << norm_hex_0x(d.addr) << ' '
-        << "size: " << std::dec << d.size << ' ';
+    p = put(p, "ea: 0x");
+    p = put_hex(p, d.addr);
+    p = put(p, " size: ");
+    p = put_dec(p, d.size);
+    *p++ = ' ';
   }
 
   // inputs A/B/C
-  add_input(oss, "1st", d.A);
-  add_input(oss, "2nd", d.B);
-  add_input(oss, "3rd", d.C);
+  p = add_input(p, "1st", d.A);
+  p = add_input(p, "2nd", d.B);
+  p = add_input(p, "3rd", d.C);
 
   // output D
   if (d.D.valid) {
-    oss << "output:  "
-        << "(int: " << (d.D.is_int ? 1 : 2)
-        << ", idx: " << std::dec << d.D.log_reg
-        << " val: " << hex_body(d.D.value) << ")  ";
+    p = put(p, "output:  ");
+    p = add_operand(p, d.D);
   }
 
-  oss << " ]";
-  return oss.str();
+  return put(p, " ]");
 }
 
+std::string format_text_line(const db_t& d)
+{
+  char buf[kMaxTextLine];
+  return std::string(buf, format_text_line(d, buf));
+}
@@ -0,0 +1,108 @@
+#include "text_reader.h"
+#include "scan_util.h"
+#include <cstring>
+
+// ---------------------------------------------------------------------
+// Pieces of the grammar. Each skips the spacing in front of it.
+// ---------------------------------------------------------------------
+namespace {
+
+template<size_t N>
+bool tok(const char*& p, const char* e, const char (&lit)[N]) {
+  skip_ws(p, e);
+  return eat(p, e, lit);
+}
+
+bool hex_field(const char*& p, const char* e, uint64_t* v) {
+  skip_ws(p, e);
+  return scan_hex(p, e, v);
+}
+
+bool dec_field(const char*& p, const char* e, uint64_t* v) {
+  skip_ws(p, e);
+  return scan_dec(p, e, v);
+}
+
+// "(int: 1, idx: 8 val: deadbeef)". The bank is 1 for int and 2 for fp
+// in format_text_line(); operator<< prints is_int, so 0 is fp too.
+bool operand(const char*& p, const char* e, db_operand_t& o) {
+  uint64_t bank;
+  if (!tok(p, e, "(") || !tok(p, e, "int:") || !dec_field(p, e, &bank)
+      || !tok(p, e, ",") || !tok(p, e, "idx:") || !dec_field(p, e, &o.log_reg)
+      || !tok(p, e, "val:") || !hex_field(p, e, &o.value) || !tok(p, e, ")"))
+    return false;
+  o.valid = true;
+  o.is_int = bank == 1;
+  return true;
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool TextReader::parse_line(const char* p, const char* e, db_t& d,
+                            const char** why)
+{
+  d = db_t{};
+  d.is_last_piece = true;
+
+  if (!tok(p, e, "[") || !tok(p, e, "PC:") || !hex_field(p, e, &d.pc)) {
+    *why = "missing PC";
+    return false;
+  }
+  if (!tok(p, e, "type:")) { *why = "missing type"; return false; }
+  skip_ws(p, e);
+  const char* s = p;
+  while (p < e && *p != ' ' && *p != '\t' && *p != ']') ++p;
+  if (!class_of(s, size_t(p - s), &d.insn_class)) {
+    *why = "unknown type";
+    return false;
+  }
+  d.is_load  = d.insn_class == InstClass::loadInstClass;
+  d.is_store = d.insn_class == InstClass::storeInstClass;
+
+  if (tok(p, e, "ea:")) {
+    if (!hex_field(p, e, &d.addr) || !tok(p, e, "size:")
+        || !dec_field(p, e, &d.size)) {
+      *why = "bad ea/size";
+      return false;
+    }
+  }
+
+  // "( tkn:1 tar: 0x...)" is an operand-free group; "(int:" would be one
+  skip_ws(p, e);
+  if (p < e && *p == '(') {
+    const char* q = p + 1;
+    uint64_t tkn;
+    if (tok(q, e, "tkn:")) {
+      if (!dec_field(q, e, &tkn) || !tok(q, e, "tar:")
+          || !hex_field(q, e, &d.next_pc) || !tok(q, e, ")")) {
+        *why = "bad tkn/tar";
+        return false;
+      }
+      d.is_taken = tkn != 0;
+      p = q;
+    }
+  }
+
+  db_operand_t* const ins[3] = { &d.A, &d.B, &d.C };
+  for (int i = 0; i < 3; ++i) {
+    static const char ord[3][4] = { "1st", "2nd", "3rd" };
+    skip_ws(p, e);
+    if (size_t(e - p) < 3 || std::memcmp(p, ord[i], 3) != 0) continue;
+    p += 3;
+    if (!tok(p, e, "input:") || !operand(p, e, *ins[i])) {
+      *why = "bad input operand";
+      return false;
+    }
+  }
+  if (tok(p, e, "output:") && !operand(p, e, d.D)) {
+    *why = "bad output operand";
+    return false;
+  }
+
+  if (!tok(p, e, "]")) { *why = "malformed"; return false; }
+  skip_ws(p, e);
+  if (p != e) { *why = "trailing characters"; return false; }
+  return true;
+}
@@ -0,0 +1,326 @@
+#include "trace_index.h"
+#include "cbpc.h"
+#include "codec_source.h"
+#include "par_source.h"
+#include "trace_reader.h"
+#include <archive.h>
+#include <zlib.h>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace {
+
+const char kMagic[8] = { 'C','B','P','I','D','X','\0','\1' };
+constexpr uint32_t kVersion = 1;
+
+// Fixed-width little helpers over FILE*; the format is host-endian like
+// the CBP trace itself.
+template<typename T> bool put(FILE* f, T v) {
+  return std::fwrite(&v, sizeof v, 1, f) == 1;
+}
+template<typename T> bool get(FILE* f, T& v) {
+  return std::fread(&v, sizeof v, 1, f) == 1;
+}
+
+bool set_err(std::string* err, const std::string& e) {
+  if (err) *err = e;
+  return false;
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool TraceIndex::file_stamp(const std::string& path, uint64_t* size,
+                            uint64_t* mtime)
+{
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) return false;
+  *size = uint64_t(st.st_size);
+  *mtime = uint64_t(st.st_mtime);
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// The reader's own magic-byte sniffing, so an index is built for the
+// codec the reader will decode. Containers are refused since their
+// payload offsets are not trace offsets: a tar inside a native codec is
+// spotted from its header, as the reader does; only files no magic
+// matches go to libarchive, which is also what the reader does with them.
+// ---------------------------------------------------------------------
+bool TraceIndex::sniff(const std::string& path, Codec* c, std::string* err) {
+  if (cbpc::sniff(path)) { *c = Codec::CBPC; return true; }
+
+  switch (sniff_codec(path)) {
+    case StreamCodec::GZIP:  *c = Codec::GZIP;  break;
+    case StreamCodec::XZ:    *c = Codec::XZ;    break;
+    case StreamCodec::BZIP2: *c = Codec::BZIP2; break;
+    case StreamCodec::ZSTD:  *c = Codec::ZSTD;  break;
+    case StreamCodec::NONE: {
+      LibarchiveSource la;
+      if (!la.open(path, false)) return set_err(err, "cannot open " + path);
+      if (!la.raw()) return set_err(err, "cannot index a container: " + path);
+      if (la.filter() != ARCHIVE_FILTER_NONE)
+        return set_err(err, "unsupported compression for indexing: " + path);
+      *c = Codec::RAW;
+      return true;
+    }
+  }
+
+  ReaderOpts o;
+  o.force_raw = true;
+  o.prefetch = false;
+  o.decomp_threads = 1;
+  ArchiveByteReader rdr;
+  if (!rdr.open(path, o)) return set_err(err, "cannot open " + path);
+  const unsigned char* h = rdr.peek(512);
+  if (h && std::memcmp(h + 257, "ustar", 5) == 0)
+    return set_err(err, "cannot index a container: " + path);
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// Sources that can both record access points and resume from them.
+// 'at' == nullptr (or a point at offset 0) starts at the beginning.
+// ---------------------------------------------------------------------
+std::unique_ptr<BlockSource>
+TraceIndex::open_source(const std::string& trace, Codec c,
+                        const AccessPoint* at, unsigned threads,
+                        std::string* err)
+{
+  if (at && at->uoff == 0) at = nullptr;
+  if (threads < 1) threads = 1;
+
+  switch (c) {
+    case Codec::RAW: {
+      auto s = std::make_unique<MmapSource>();
+      if (!s->open(trace, at ? at->coff : 0)) break;
+      return s;
+    }
+    case Codec::GZIP: {
+      auto s = std::make_unique<GzipSource>();
+      if (!s->open(trace, at)) { set_err(err, s->error()); return nullptr; }
+      return s;
+    }
+    case Codec::XZ: {
+      auto s = std::make_unique<ParallelXzSource>();
+      if (s->open_index(trace) && (at || s->worthwhile())) {
+        if (at && at->block >= s->blocks().size()) break;
+        s->run(at ? at->block : 0, threads);
+        return s;
+      }
+      if (at) break;
+      // one big block: stream it, the only access point is the start
+      auto xz = std::make_unique<XzSource>();
+      if (!xz->open(trace)) break;
+      return xz;
+    }
+    case Codec::BZIP2: {
+      auto s = std::make_unique<ParallelBz2Source>();
+      if (!s->open_scan(trace, at ? at->coff : 0)) break;
+      s->run(0, threads);
+      return s;
+    }
+    case Codec::ZSTD: {
+      auto s = std::make_unique<ZstdFrameSource>();
+      if (!s->open(trace, at)) { set_err(err, s->error()); return nullptr; }
+      return s;
+    }
+    case Codec::CBPC: {
+      auto s = std::make_unique<CbpcSource>();
+      if (!s->open(trace, at)) { set_err(err, s->error()); return nullptr; }
+      return s;
+    }
+  }
+  set_err(err, "cannot position " + trace + " at offset "
+               + std::to_string(at ? at->uoff : 0));
+  return nullptr;
+}
+
+// ---------------------------------------------------------------------
+// One pass over the trace: the source appends access points as it
+// decompresses, and each one is bound to the first record starting at or
+// after it. A point shows up at the latest while the record that spans
+// it is being read, so binding happens after each read.
+// ---------------------------------------------------------------------
+bool TraceIndex::build(const std::string& trace, uint64_t span,
+                       std::string* err, bool count_pieces)
+{
+  cps_.clear();
+  instrs_ = pieces_ = bytes_ = 0;
+  span_ = span;
+  if (!file_stamp(trace, &fsize_, &mtime_))
+    return set_err(err, "cannot stat " + trace);
+  if (!sniff(trace, &codec_, err)) return false;
+  if (codec_ == Codec::CBPC) return from_footer(trace, err);
+
+  std::unique_ptr<BlockSource> src =
+      open_source(trace, codec_, nullptr, std::thread::hardware_concurrency(),
+                  err);
+  if (!src) return false;
+
+  std::vector<AccessPoint> aps;
+  src->record_points(&aps, span);
+
+  TraceReader tr(std::move(src));
+  tr.set_quiet(true);
+  size_t next_ap = 0;
+  uint64_t pieces = 0;
+  for (;;) {
+    const uint64_t at = tr.offset();
+    const uint64_t instr = tr.nInstr;
+    if (!(count_pieces ? tr.readInstr() : tr.skipInstr())) break;
+
+    for (; next_ap < aps.size() && aps[next_ap].uoff <= at; ++next_ap) {
+      Checkpoint cp;
+      cp.at = std::move(aps[next_ap]);
+      cp.skip = uint32_t(at - cp.at.uoff);
+      cp.instr = instr;
+      cp.pieces = pieces;
+      // several points before one record: keep the closest
+      if (!cps_.empty() && cps_.back().instr == instr) cps_.back() = std::move(cp);
+      else cps_.push_back(std::move(cp));
+    }
+    if (count_pieces) pieces += tr.mTotalPieces;
+  }
+  if (tr.error()) return set_err(err, "failed to decode " + trace);
+
+  // sources without access points still restart at the beginning
+  if (cps_.empty() || cps_.front().instr != 0)
+    cps_.insert(cps_.begin(), Checkpoint());
+
+  instrs_ = tr.nInstr;
+  pieces_ = pieces;
+  bytes_ = tr.offset();
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// One checkpoint per .cbpc block, straight from the footer. Piece counts
+// are not in the file and stay 0.
+// ---------------------------------------------------------------------
+bool TraceIndex::from_footer(const std::string& trace, std::string* err) {
+  CbpcSource s;
+  if (!s.open(trace)) return set_err(err, s.error());
+  for (size_t b = 0; b < s.blocks().size(); ++b) {
+    Checkpoint cp;
+    cp.at.uoff = s.blocks()[b].uoff;
+    cp.at.coff = s.blocks()[b].off;
+    cp.at.block = uint32_t(b);
+    cp.instr = s.blocks()[b].instr;
+    cps_.push_back(std::move(cp));
+  }
+  if (cps_.empty()) cps_.push_back(Checkpoint());
+  instrs_ = s.instrs();
+  bytes_ = s.bytes();
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// gzip windows are stored deflated; the rest is fixed-width fields.
+// ---------------------------------------------------------------------
+bool TraceIndex::save(const std::string& path, std::string* err) const {
+  FILE* f = std::fopen(path.c_str(), "wb");
+  if (!f) return set_err(err, "cannot create " + path);
+
+  bool ok = std::fwrite(kMagic, sizeof kMagic, 1, f) == 1
+         && put(f, kVersion) && put(f, uint32_t(codec_))
+         && put(f, fsize_) && put(f, mtime_) && put(f, span_)
+         && put(f, instrs_) && put(f, pieces_) && put(f, bytes_)
+         && put(f, uint64_t(cps_.size()));
+
+  std::vector<unsigned char> z;
+  for (size_t i = 0; ok && i < cps_.size(); ++i) {
+    const Checkpoint& cp = cps_[i];
+    const std::vector<unsigned char>& w = cp.at.window;
+    uLongf zlen = 0;
+    if (!w.empty()) {
+      zlen = compressBound(uLong(w.size()));
+      z.resize(zlen);
+      ok = compress(z.data(), &zlen, w.data(), uLong(w.size())) == Z_OK;
+    }
+    ok = ok && put(f, cp.at.uoff) && put(f, cp.at.coff)
+            && put(f, cp.instr) && put(f, cp.pieces)
+            && put(f, cp.at.block) && put(f, cp.skip) && put(f, cp.at.bits)
+            && put(f, uint32_t(w.size())) && put(f, uint32_t(zlen))
+            && (zlen == 0 || std::fwrite(z.data(), zlen, 1, f) == 1);
+  }
+
+  if (std::fclose(f) != 0) ok = false;
+  if (!ok) {
+    std::remove(path.c_str());
+    return set_err(err, "failed writing " + path);
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+bool TraceIndex::load(const std::string& path, const std::string& trace,
+                      std::string* err)
+{
+  cps_.clear();
+  FILE* f = std::fopen(path.c_str(), "rb");
+  if (!f) return set_err(err, "cannot open " + path);
+
+  char magic[sizeof kMagic];
+  uint32_t version = 0, codec = 0;
+  uint64_t count = 0;
+  bool ok = std::fread(magic, sizeof magic, 1, f) == 1
+         && std::memcmp(magic, kMagic, sizeof kMagic) == 0
+         && get(f, version) && version == kVersion
+         && get(f, codec) && codec <= uint32_t(Codec::CBPC)
+         && get(f, fsize_) && get(f, mtime_) && get(f, span_)
+         && get(f, instrs_) && get(f, pieces_) && get(f, bytes_)
+         && get(f, count);
+  codec_ = Codec(codec);
+
+  std::vector<unsigned char> z;
+  for (uint64_t i = 0; ok && i < count; ++i) {
+    Checkpoint cp;
+    uint32_t wlen = 0, zlen = 0;
+    ok = get(f, cp.at.uoff) && get(f, cp.at.coff)
+      && get(f, cp.instr) && get(f, cp.pieces)
+      && get(f, cp.at.block) && get(f, cp.skip) && get(f, cp.at.bits)
+      && get(f, wlen) && get(f, zlen) && wlen <= GzipSource::kWindow;
+    if (ok && zlen) {
+      z.resize(zlen);
+      cp.at.window.resize(wlen);
+      uLongf out = wlen;
+      ok = std::fread(z.data(), zlen, 1, f) == 1
+        && uncompress(cp.at.window.data(), &out, z.data(), zlen) == Z_OK
+        && out == wlen;
+    }
+    if (ok) cps_.push_back(std::move(cp));
+  }
+  std::fclose(f);
+  if (!ok) { cps_.clear(); return set_err(err, "corrupt index " + path); }
+
+  uint64_t size = 0, mtime = 0;
+  if (!file_stamp(trace, &size, &mtime) || size != fsize_ || mtime != mtime_) {
+    cps_.clear();
+    return set_err(err, path + " is stale for " + trace);
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+const TraceIndex::Checkpoint* TraceIndex::find(uint64_t n) const {
+  size_t lo = 0, hi = cps_.size();
+  while (lo < hi) {              // first checkpoint with instr > n
+    const size_t mid = lo + (hi - lo) / 2;
+    if (cps_[mid].instr <= n) lo = mid + 1; else hi = mid;
+  }
+  return lo ? &cps_[lo - 1] : nullptr;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+std::unique_ptr<BlockSource>
+TraceIndex::open_at(const std::string& trace, const Checkpoint& cp,
+                    unsigned threads, std::string* err) const
+{
+  return open_source(trace, codec_, &cp.at, threads, err);
+}
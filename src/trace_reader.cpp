@@ -1,6 +1,7 @@
 #include "trace_reader.h"
+#include "cbpc.h"
+#include <cstdio>
 #include <cstring>
-#include <iterator>
 
 static constexpr uint8_t vecOffset  = 32;
 static constexpr uint8_t ccOffset   = 64;
@@ -22,23 +23,24 @@ bool TraceReader::Instr::capture_base_update_log_reg()
 
   if (mOutRegs.size() <= 1) return false;
 
-  auto src = mInRegs, dst = mOutRegs;
-
-  std::sort(src.begin(), src.end());
-  std::sort(dst.begin(), dst.end());
-
-  auto cut = std::lower_bound(src.begin(), src.end(), vecOffset);
-
-  src.erase(cut, src.end());
-  cut = std::lower_bound(dst.begin(), dst.end(), vecOffset);
-  dst.erase(cut, dst.end());
-
-  std::vector<uint8_t> overlap;
-  std::set_intersection(src.begin(), src.end(),
-                        dst.begin(), dst.end(), std::back_inserter(overlap));
+  // Integer registers (below vecOffset) as bitmasks. A register seen twice
+  // also lands in the *2 mask, which keeps the result identical to the
+  // multiset intersection of the sorted register lists.
+  uint64_t src1 = 0, src2 = 0, dst1 = 0, dst2 = 0;
+  for (uint8_t r : mInRegs) {
+    if (r >= vecOffset) continue;
+    const uint64_t bit = 1ULL << r;
+    src2 |= src1 & bit; src1 |= bit;
+  }
+  for (uint8_t r : mOutRegs) {
+    if (r >= vecOffset) continue;
+    const uint64_t bit = 1ULL << r;
+    dst2 |= dst1 & bit; dst1 |= bit;
+  }
 
-  if (overlap.size() == 1) {
-    if (mBaseUpd == 1) mBaseUpdReg.emplace(overlap[0]);
+  const uint64_t overlap = src1 & dst1;
+  if (__builtin_popcountll(overlap) == 1 && (src2 & dst2) == 0) {
+    if (mBaseUpd == 1) mBaseUpdReg.emplace(uint8_t(__builtin_ctzll(overlap)));
     return mBaseUpd == 1;
   }
 
@@ -47,18 +49,20 @@ bool TraceReader::Instr::capture_base_update_log_reg()
 
 // ----------------------------------------------------------------------------
 // ----------------------------------------------------------------------------
-db_t* TraceReader::populateNewInstr()
+void TraceReader::populateNewInstr(db_t& inst, int* val)
 {
-  db_t* inst = new db_t();
+  // Every scalar field is assigned below; only operand slots that end up
+  // invalid would keep stale contents from a reused slot.
+  inst.A = inst.B = inst.C = inst.D = db_operand_t{};
   const bool is_macro_mem = is_mem(mInstr.mType);
   const bool create_base_update_op =
       is_macro_mem && (mProcessedPieces>=1) && (mMemPieces == mProcessedPieces)
       && (mMemPieces == (mTotalPieces -1));
 
-  inst->insn_class = create_base_update_op ? InstClass::aluInstClass : mInstr.mType;
-  inst->pc = mInstr.mPc;
-  inst->is_taken = mInstr.mTaken;
-  inst->next_pc = mInstr.mNextPc;
+  inst.insn_class = create_base_update_op ? InstClass::aluInstClass : mInstr.mType;
+  inst.pc = mInstr.mPc;
+  inst.is_taken = mInstr.mTaken;
+  inst.next_pc = mInstr.mNextPc;
 
   const bool base_upd_present = mInstr.mBaseUpdReg.has_value();
   const uint8_t base_upd_reg  = mInstr.mBaseUpdReg.value_or(0xff);
@@ -67,19 +71,19 @@ db_t* TraceReader::populateNewInstr()
   uint8_t in_done = 0;
   if (create_base_update_op) {
     in_done++;
-    inst->A.valid = true;
-    inst->A.is_int = reg_is_int(base_upd_reg);
-    inst->A.log_reg = base_upd_reg;
-    inst->A.value = 0xdeadbeef;
-    inst->B.valid = inst->C.valid = false;
+    inst.A.valid = true;
+    inst.A.is_int = reg_is_int(base_upd_reg);
+    inst.A.log_reg = base_upd_reg;
+    inst.A.value = 0xdeadbeef;
+    inst.B.valid = inst.C.valid = false;
   } else if (is_store(mInstr.mType)) {
     const uint8_t max_val_regs_per_piece = 1;
     // addr reg
     in_done++;
-    inst->A.valid = true;
-    inst->A.is_int = reg_is_int(mInstr.mInRegs[0]);
-    inst->A.log_reg = mInstr.mInRegs[0];
-    inst->A.value = 0xdeadbeef;
+    inst.A.valid = true;
+    inst.A.is_int = reg_is_int(mInstr.mInRegs[0]);
+    inst.A.log_reg = mInstr.mInRegs[0];
+    inst.A.value = 0xdeadbeef;
 
     const uint8_t val_off = 1 
                           + mInstr.mHasRegOffset
@@ -88,82 +92,85 @@ db_t* TraceReader::populateNewInstr()
     if (mInstr.mHasRegOffset) {
       // offset
       in_done++;
-      inst->B.valid = true;
-      inst->B.is_int = reg_is_int(mInstr.mInRegs[1]);
-      inst->B.log_reg = mInstr.mInRegs[1];
-      inst->B.value = 0xdeadbeef;
+      inst.B.valid = true;
+      inst.B.is_int = reg_is_int(mInstr.mInRegs[1]);
+      inst.B.log_reg = mInstr.mInRegs[1];
+      inst.B.value = 0xdeadbeef;
       // value if present
       if (val_off < mInstr.mNumInRegs) {
         in_done++;
-        inst->C.valid = true;
-        inst->C.is_int = reg_is_int(mInstr.mInRegs[val_off]);
-        inst->C.log_reg = mInstr.mInRegs[val_off];
-        inst->C.value = 0xdeadbeef;
-      } else inst->C.valid = false;
+        inst.C.valid = true;
+        inst.C.is_int = reg_is_int(mInstr.mInRegs[val_off]);
+        inst.C.log_reg = mInstr.mInRegs[val_off];
+        inst.C.value = 0xdeadbeef;
+      } else inst.C.valid = false;
     } else {
       if (val_off < mInstr.mNumInRegs) {
         in_done++;
-        inst->B.valid = true;
-        inst->B.is_int = reg_is_int(mInstr.mInRegs[val_off]);
-        inst->B.log_reg = mInstr.mInRegs[val_off];
-        inst->B.value = 0xdeadbeef;
-        inst->C.valid = false;
+        inst.B.valid = true;
+        inst.B.is_int = reg_is_int(mInstr.mInRegs[val_off]);
+        inst.B.log_reg = mInstr.mInRegs[val_off];
+        inst.B.value = 0xdeadbeef;
+        inst.C.valid = false;
       } else {
-        inst->B.valid = inst->C.valid = false;
+        inst.B.valid = inst.C.valid = false;
       }
     }
   } else {
     if (mInstr.mNumInRegs >= 1) {
       in_done++;
-      inst->A.valid = true;
-      inst->A.is_int = reg_is_int(mInstr.mInRegs[0]);
-      inst->A.log_reg = mInstr.mInRegs[0];
-      inst->A.value=0xdeadbeef;
-    } else inst->A.valid = false;
+      inst.A.valid = true;
+      inst.A.is_int = reg_is_int(mInstr.mInRegs[0]);
+      inst.A.log_reg = mInstr.mInRegs[0];
+      inst.A.value=0xdeadbeef;
+    } else inst.A.valid = false;
 
     if (mInstr.mNumInRegs >= 2) {
       in_done++;
-      inst->B.valid = true;
-      inst->B.is_int = reg_is_int(mInstr.mInRegs[1]);
-      inst->B.log_reg = mInstr.mInRegs[1];
-      inst->B.value=0xdeadbeef;
+      inst.B.valid = true;
+      inst.B.is_int = reg_is_int(mInstr.mInRegs[1]);
+      inst.B.log_reg = mInstr.mInRegs[1];
+      inst.B.value=0xdeadbeef;
     }
-    else inst->B.valid = false;
+    else inst.B.valid = false;
 
     if (mInstr.mNumInRegs >= 3) {
       in_done++;
-      inst->C.valid = true;
-      inst->C.is_int = reg_is_int(mInstr.mInRegs[2]);
-      inst->C.log_reg = mInstr.mInRegs[2];
-      inst->C.value=0xdeadbeef; }
-    else inst->C.valid = false;
+      inst.C.valid = true;
+      inst.C.is_int = reg_is_int(mInstr.mInRegs[2]);
+      inst.C.log_reg = mInstr.mInRegs[2];
+      inst.C.value=0xdeadbeef; }
+    else inst.C.valid = false;
   }
 
   // output
   if (create_base_update_op) {
-    inst->D.valid = true; inst->D.is_int = reg_is_int(base_upd_reg);
-    inst->D.log_reg = base_upd_reg;
-    inst->D.value = *mInstr.mOutRegsValues.rbegin();
+    inst.D.valid = true; inst.D.is_int = reg_is_int(base_upd_reg);
+    inst.D.log_reg = base_upd_reg;
+    inst.D.value = mInstr.mOutRegsValues.back();
+    if (val) *val = int(mInstr.mOutRegsValues.size()) - 1;
   } else if (!is_store(mInstr.mType) && mInstr.mNumOutRegs >= 1) {
-    inst->D.valid = true;
-    inst->D.is_int = reg_is_int(mInstr.mOutRegs[mCrackRegIdx]);
-    inst->D.log_reg = mInstr.mOutRegs[mCrackRegIdx];
-    inst->D.value   = mInstr.mOutRegsValues[mCrackValIdx];
-    if (!inst->D.is_int) start_fp_reg++; else start_fp_reg = 0;
+    inst.D.valid = true;
+    inst.D.is_int = reg_is_int(mInstr.mOutRegs[mCrackRegIdx]);
+    inst.D.log_reg = mInstr.mOutRegs[mCrackRegIdx];
+    inst.D.value   = mInstr.mOutRegsValues[mCrackValIdx];
+    if (val) *val = mCrackValIdx;
+    if (!inst.D.is_int) start_fp_reg++; else start_fp_reg = 0;
   } else {
-    inst->D.valid = false; start_fp_reg = 0;
+    inst.D.valid = false; start_fp_reg = 0;
+    if (val) *val = -1;
   }
 
-  inst->is_load  = create_base_update_op ? false
+  inst.is_load  = create_base_update_op ? false
                  : (mInstr.mType == InstClass::loadInstClass);
-  inst->is_store = create_base_update_op ? false 
+  inst.is_store = create_base_update_op ? false 
                  : (mInstr.mType == InstClass::storeInstClass);
 
-  inst->addr = mInstr.mEffAddr + (mProcessedPieces * mSizeFactor);
-  inst->size = std::max<uint64_t>(1, mSizeFactor);
+  inst.addr = mInstr.mEffAddr + (mProcessedPieces * mSizeFactor);
+  inst.size = std::max<uint64_t>(1, mSizeFactor);
 
   mProcessedPieces++;
-  inst->is_last_piece = (mProcessedPieces == mTotalPieces);
+  inst.is_last_piece = (mProcessedPieces == mTotalPieces);
 
   if (   mInstr.mNumOutRegs > mCrackRegIdx
       && !reg_is_int(mInstr.mOutRegs[mCrackRegIdx]))
@@ -174,53 +181,112 @@ db_t* TraceReader::populateNewInstr()
     mCrackValIdx++;
     mCrackRegIdx++;
   }
-
-  return inst;
 }
 
 // ----------------------------------------------------------------------------
+// Per-class record layout: which optional field groups follow the class byte.
 // ----------------------------------------------------------------------------
-bool TraceReader::readInstr(){
-  mInstr.reset();
-  start_fp_reg = 0;
+namespace {
+struct ClassLayout { uint8_t mem, store, br, cond; };
+
+constexpr ClassLayout kLayout[kNumInstClasses] = {
+  /* alu          */ {0,0,0,0},
+  /* load         */ {1,0,0,0},
+  /* store        */ {1,1,0,0},
+  /* condBr       */ {0,0,1,1},
+  /* uncondDirBr  */ {0,0,1,0},
+  /* uncondIndBr  */ {0,0,1,0},
+  /* fp           */ {0,0,0,0},
+  /* slowAlu      */ {0,0,0,0},
+  /* undef        */ {0,0,0,0},
+  /* callDir      */ {0,0,1,0},
+  /* callInd      */ {0,0,1,0},
+  /* return       */ {0,0,1,0},
+};
+
+// Cursor over a span known to hold a whole record: straight pointer
+// arithmetic, no bounds checks.
+struct FastSrc {
+  const unsigned char* p;
+  template<typename T> bool get(T& v) {
+    std::memcpy(&v, p, sizeof(T)); p += sizeof(T); return true;
+  }
+  bool get_bytes(uint8_t* dst, size_t n) {
+    std::memcpy(dst, p, n); p += n; return true;
+  }
+  bool skip(size_t n) { p += n; return true; }
+};
+} // namespace
+
+// Careful cursor: every field goes through peek/consume and is checked.
+struct TraceReader::SafeSrc {
+  TraceReader& tr;
+  template<typename T> bool get(T& v) { return tr.read_raw(v); }
+  bool get_bytes(uint8_t* dst, size_t n) { return tr.read_bytes(dst, n); }
+  bool skip(size_t n) { return tr.rdr.skip(n) == n; }
+};
+
+// Cursor that only peeks: the record stays unconsumed and ends up
+// contiguous at the reader's position, gathered if it crosses blocks.
+struct TraceReader::PeekSrc {
+  ArchiveByteReader& rdr;
+  const unsigned char* p = nullptr;
+  size_t k = 0;                      // bytes looked at so far
+  bool need(size_t n) { return (p = rdr.peek(k + n)) != nullptr; }
+  template<typename T> bool get(T& v) {
+    if (!need(sizeof(T))) return false;
+    std::memcpy(&v, p + k, sizeof(T)); k += sizeof(T); return true;
+  }
+  bool get_bytes(uint8_t* dst, size_t n) {
+    if (!need(n)) return false;
+    std::memcpy(dst, p + k, n); k += n; return true;
+  }
+  bool skip(size_t n) {
+    if (!need(n)) return false;
+    k += n; return true;
+  }
+};
 
-  if (!read_raw(mInstr.mPc)) return false; // EOF
+// ----------------------------------------------------------------------------
+// Decode one record (pc onward) into mInstr. Returns false on a short read
+// or an invalid class byte.
+// ----------------------------------------------------------------------------
+template<class Src>
+bool TraceReader::decode_record(Src& s){
+  if (!s.get(mInstr.mPc)) return false;
 
   // reset bookkeeping
   mTotalPieces = mMemPieces = mProcessedPieces = 0;
   mSizeFactor = 1; mCrackRegIdx = mCrackValIdx = 0;
   mInstr.mNextPc = mInstr.mPc + 4;
 
-  if (!read_raw(mInstr.mType)) return false;
+  uint8_t cls;
+  if (!s.get(cls)) return false;
+  if (cls >= kNumInstClasses) { mBadClass = true; return false; }
+  mInstr.mType = InstClass(cls);
+  const ClassLayout L = kLayout[cls];
 
-  if (   mInstr.mType == InstClass::loadInstClass
-      || mInstr.mType == InstClass::storeInstClass)
-  {
-    read_raw(mInstr.mEffAddr);
-    read_raw(mInstr.mMemSize);
-    read_raw(mInstr.mBaseUpd);
-    if (mInstr.mType == InstClass::storeInstClass) read_raw(mInstr.mHasRegOffset);
+  if (L.mem) {
+    if (!s.get(mInstr.mEffAddr) || !s.get(mInstr.mMemSize)
+        || !s.get(mInstr.mBaseUpd)) return false;
+    if (L.store && !s.get(mInstr.mHasRegOffset)) return false;
   }
 
-  if (is_br(mInstr.mType)) {
-    read_raw(mInstr.mTaken);
-    if (!is_cond_br(mInstr.mType)) { assert(mInstr.mTaken); }
-    if (mInstr.mTaken) read_raw(mInstr.mNextPc);
+  if (L.br) {
+    uint8_t tkn;
+    if (!s.get(tkn)) return false;
+    mInstr.mTaken = (tkn != 0);
+    if (!L.cond) { assert(mInstr.mTaken); }
+    if (mInstr.mTaken && !s.get(mInstr.mNextPc)) return false;
   }
 
-  read_raw(mInstr.mNumInRegs);
-  for (uint8_t i=0;i<mInstr.mNumInRegs;i++) {
-    uint8_t r;
-    read_raw(r);
-    mInstr.mInRegs.push_back(r);
-  }
+  if (!s.get(mInstr.mNumInRegs)) return false;
+  if (!s.get_bytes(mInstr.mInRegs.v, mInstr.mNumInRegs)) return false;
+  mInstr.mInRegs.n = mInstr.mNumInRegs;
 
-  read_raw(mInstr.mNumOutRegs);
-  for (uint8_t i=0;i<mInstr.mNumOutRegs;i++) {
-    uint8_t r;
-    read_raw(r);
-    mInstr.mOutRegs.push_back(r);
-  }
+  if (!s.get(mInstr.mNumOutRegs)) return false;
+  if (!s.get_bytes(mInstr.mOutRegs.v, mInstr.mNumOutRegs)) return false;
+  mInstr.mOutRegs.n = mInstr.mNumOutRegs;
 
   mTotalPieces = (mInstr.mNumOutRegs > 0) ? mInstr.mNumOutRegs : 1;
 
@@ -231,7 +297,7 @@ bool TraceReader::readInstr(){
 
   for (uint8_t i=0;i<mInstr.mNumOutRegs;i++) {
     uint64_t val;
-    read_raw(val);
+    if (!s.get(val)) return false;
     const bool is_base = base_update_present
                        && mInstr.mBaseUpdReg.value() == mInstr.mOutRegs[i];
     if (is_base) {
@@ -240,7 +306,7 @@ bool TraceReader::readInstr(){
       mInstr.mOutRegsValues.push_back(val);
       if (!reg_is_int(mInstr.mOutRegs[i])) {
         uint64_t hi;
-        read_raw(hi);
+        if (!s.get(hi)) return false;
         mInstr.mOutRegsValues.push_back(hi);
         if (hi != 0) mTotalPieces++;
       }
@@ -252,7 +318,7 @@ bool TraceReader::readInstr(){
   if (base_update_present) {
     assert(is_macro_mem);
     if (mInstr.mOutRegs.size() > 1) {
-      mInstr.mOutRegs.erase(mInstr.mOutRegs.begin()+base_upd_pos);
+      mInstr.mOutRegs.erase_at(base_upd_pos);
       mInstr.mOutRegs.push_back(mInstr.mBaseUpdReg.value());
     }
     mInstr.mOutRegsValues.push_back(base_upd_val);
@@ -273,16 +339,592 @@ bool TraceReader::readInstr(){
     mMemPieces = 0;
     mSizeFactor = 0;
   }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// Find the end of one record without decoding it. Only the output register
+// list is looked at: each output value has a second word for non-integer
+// registers, except for the base-update register. That register is the
+// single output of a store, and always an integer register for a load.
+// ----------------------------------------------------------------------------
+template<class Src>
+bool TraceReader::skip_record(Src& s){
+  uint8_t cls;
+  if (!s.skip(sizeof(uint64_t)) || !s.get(cls)) return false;
+  if (cls >= kNumInstClasses) { mBadClass = true; return false; }
+  const ClassLayout L = kLayout[cls];
+
+  if (L.mem && !s.skip(L.store ? 11 : 10)) return false;
+  if (L.br) {
+    uint8_t tkn;
+    if (!s.get(tkn)) return false;
+    if (tkn && !s.skip(sizeof(uint64_t))) return false;
+  }
+
+  uint8_t nin, nout;
+  if (!s.get(nin) || !s.skip(nin) || !s.get(nout)) return false;
+  uint8_t regs[kMaxRegs];
+  if (!s.get_bytes(regs, nout)) return false;
+
+  const bool store_base = L.store && nout == 1;
+  size_t vals = 0;
+  for (uint8_t i = 0; i < nout; ++i)
+    vals += (!store_base && !reg_is_int(regs[i])) ? 16 : 8;
+  return s.skip(vals);
+}
+
+// ----------------------------------------------------------------------------
+// Open-addressing table of static decodes, and the pool their piece
+// templates live in. Both are dropped whole when the pool fills.
+// ----------------------------------------------------------------------------
+struct TraceReader::PcCache {
+  static constexpr unsigned kBits  = 16;
+  static constexpr size_t   kSlots = size_t(1) << kBits;
+  static constexpr size_t   kProbe = 8;          // slots looked at per PC
+  static constexpr size_t   kRegs  = 32;         // register bytes per entry
+  static constexpr size_t   kWords = 32;         // value words per record
+  static constexpr size_t   kPool  = size_t(1) << 17;
+
+  // A piece with its per-instance fields left out. Inputs A-C hold
+  // 0xdeadbeef when valid, D the value word 'word'; invalid operands are
+  // all zero.
+  struct Piece {
+    uint32_t addr_off;       // from the record's EA
+    uint8_t  cls, size;
+    uint8_t  load : 1, store : 1, last : 1;
+    int8_t   word;           // value word of D, or -1
+    uint8_t  valid, is_int;  // operand bit masks, A = bit 0
+    uint8_t  reg[4];
+  };
+
+  struct alignas(64) Entry {
+    uint64_t pc = 0;
+    uint32_t hi_mask = 0;    // value words that add a piece when non-zero
+    uint32_t first = 0;      // first template piece in the pool
+    uint8_t  pieces = 0;     // 0 = free slot
+    uint8_t  nz = 0;         // hi_mask words that were non-zero
+    uint8_t  cls = 0, nmem = 0, nregs = 0, nwords = 0;
+    uint8_t  mem[8] = {};    // size, base-update, reg-offset
+    uint8_t  regs[kRegs] = {};
+  };
+
+  std::vector<Entry> slots;  // allocated with the first entry
+  std::vector<Piece> pool;
+  const unsigned char* vals = nullptr;   // current record's value words
+  bool verify = false;
+  std::vector<db_t> check;   // pieces cracked the long way (verify)
+
+  // Compact form of 'd', whose D.value is value word 'word'. False if
+  // 'd' does not fit one.
+  static bool pack(const db_t& d, int word, uint64_t ea, Piece* t) {
+    const db_operand_t* op[4] = { &d.A, &d.B, &d.C, &d.D };
+    const uint64_t off = d.addr - ea;
+    if (off > UINT32_MAX || d.size > UINT8_MAX || (word >= 0) != d.D.valid)
+      return false;
+    *t = Piece{};
+    t->addr_off = uint32_t(off);
+    t->cls = uint8_t(d.insn_class);
+    t->size = uint8_t(d.size);
+    t->load = d.is_load;
+    t->store = d.is_store;
+    t->last = d.is_last_piece;
+    t->word = int8_t(word);
+    for (int i = 0; i < 4; ++i) {
+      if (!op[i]->valid) continue;
+      if (op[i]->log_reg > UINT8_MAX || (i < 3 && op[i]->value != 0xdeadbeef))
+        return false;
+      t->valid |= 1 << i;
+      t->is_int |= op[i]->is_int << i;
+      t->reg[i] = uint8_t(op[i]->log_reg);
+    }
+    return true;
+  }
+
+  // Operand 'i' of 't', D without its value.
+  static void unpack(db_operand_t& o, const Piece& t, int i) {
+    const bool v = (t.valid >> i) & 1;
+    o.valid   = v;
+    o.is_int  = (t.is_int >> i) & 1;
+    o.log_reg = v ? t.reg[i] : 0;
+    o.value   = v ? 0xdeadbeef : 0;
+  }
+
+  // The first 'n' bytes at 'rec' against 'key', zero-padded to K words.
+  // Whole words are read from 'rec', which must have them.
+  template<size_t K>
+  static bool same(const unsigned char* rec, const uint8_t* key, size_t n) {
+    uint64_t diff = 0;
+    for (size_t i = 0; i < K && 8 * i < n; ++i) {
+      uint64_t a, b;
+      std::memcpy(&a, rec + 8 * i, sizeof a);
+      std::memcpy(&b, key + 8 * i, sizeof b);
+      uint64_t x = a ^ b;
+      if (n - 8 * i < 8) x &= (uint64_t(1) << 8 * (n - 8 * i)) - 1;
+      diff |= x;
+    }
+    return diff == 0;
+  }
+
+  static size_t home(uint64_t pc) {
+    return size_t(((pc >> 1) * 0x9E3779B97F4A7C15ULL) >> (64 - kBits));
+  }
+
+  const Entry* find(uint64_t pc) const {
+    if (slots.empty()) return nullptr;
+    const size_t h = home(pc);
+    for (size_t i = 0; i < kProbe; ++i) {
+      const Entry& e = slots[(h + i) & (kSlots - 1)];
+      if (e.pieces == 0) return nullptr;
+      if (e.pc == pc) return &e;
+    }
+    return nullptr;
+  }
+
+  // Slot for 'pc': its own, a free one, or else the home slot, evicted.
+  Entry& place(uint64_t pc) {
+    if (slots.empty()) slots.resize(kSlots);
+    const size_t h = home(pc);
+    for (size_t i = 0; i < kProbe; ++i) {
+      Entry& e = slots[(h + i) & (kSlots - 1)];
+      if (e.pieces == 0 || e.pc == pc) return e;
+    }
+    return slots[h];
+  }
+
+  void clear() {
+    for (Entry& e : slots) e.pieces = 0;
+    pool.clear();
+  }
+};
+
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+TraceReader::TraceReader(const char* path, const ReaderOpts& opts)
+  : nInstr(0), mPath(path), mOpts(opts)
+{
+  if (!rdr.open(path, opts)) mError = true;
+  if (opts.pc_cache != PcCacheMode::OFF) {
+    mCache = std::make_unique<PcCache>();
+    mCache->verify = opts.pc_cache == PcCacheMode::VERIFY;
+  }
+}
+
+TraceReader::TraceReader(std::unique_ptr<BlockSource> src)
+  : nInstr(0)
+{
+  if (!rdr.open(std::move(src), 0, false)) mError = true;
+}
+
+TraceReader::~TraceReader() {
+  if (!mQuiet) std::cout << " Read " << nInstr << " instrs " << std::endl;
+}
+
+// ----------------------------------------------------------------------------
+// Hit path: 'p' holds a whole record. False when its PC has no entry or
+// the record's fixed fields, or its count of non-zero upper halves,
+// differ from the entry's.
+// ----------------------------------------------------------------------------
+bool TraceReader::cached_record(const unsigned char* p, size_t* len){
+  PcCache& C = *mCache;
+  uint64_t pc;
+  std::memcpy(&pc, p, sizeof pc);
+  const PcCache::Entry* e = C.find(pc);
+  if (!e || p[8] != e->cls) return false;
+
+  const ClassLayout L = kLayout[e->cls];
+  const unsigned char* q = p + 9;
+  uint64_t ea = mInstr.mEffAddr, next = pc + 4;
+  bool taken = false;
+  if (L.mem) {
+    std::memcpy(&ea, q, sizeof ea);
+    if (!PcCache::same<1>(q + 8, e->mem, e->nmem)) return false;
+    q += 8 + e->nmem;
+  }
+  if (L.br) {
+    taken = *q++ != 0;
+    if (!L.cond) { assert(taken); }
+    if (taken) { std::memcpy(&next, q, sizeof next); q += 8; }
+  }
+  if (!PcCache::same<PcCache::kRegs / 8>(q, e->regs, e->nregs)) return false;
+  q += e->nregs;
+
+  uint8_t nz = 0;
+  for (uint32_t m = e->hi_mask; m; m &= m - 1) {
+    uint64_t v;
+    std::memcpy(&v, q + 8 * __builtin_ctz(m), sizeof v);
+    nz += v != 0;
+  }
+  if (nz != e->nz) return false;
+
+  mInstr.mPc = pc;
+  mInstr.mType = InstClass(e->cls);
+  mInstr.mEffAddr = ea;
+  mInstr.mTaken = taken;
+  mInstr.mNextPc = next;
+  mTotalPieces = e->pieces;
+  mProcessedPieces = 0;
+  mTpl = e->first;
+  C.vals = q;
+  *len = size_t(q - p) + 8 * size_t(e->nwords);
+
+  // the next record's entry, while this one's pieces are copied out
+  if (*len + 8 <= kMaxRecordBytes) {
+    uint64_t next_pc;
+    std::memcpy(&next_pc, p + *len, sizeof next_pc);
+    __builtin_prefetch(&C.slots[PcCache::home(next_pc)]);
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// Miss path: mInstr was just decoded from the 'len' bytes at 'p'. Crack it
+// into a new template once and serve the pieces from there, like a hit.
+// Records too large for an entry stay uncached.
+// ----------------------------------------------------------------------------
+void TraceReader::cache_record(const unsigned char* p, size_t len){
+  PcCache& C = *mCache;
+  const ClassLayout L = kLayout[p[8]];
+  const size_t nmem = L.mem ? (L.store ? 3 : 2) : 0;
+  const unsigned char* mem = p + 9 + 8;
+  const unsigned char* regs = p + 9 + (L.mem ? 8 + nmem : 0);
+  if (L.br) regs += *regs ? 9 : 1;
+  const uint8_t nin = regs[0];
+  const uint8_t nout = regs[1 + nin];
+  const size_t nregs = 2 + size_t(nin) + nout;
+  const unsigned char* vals = regs + nregs;
+  const size_t nwords = size_t(p + len - vals) / 8;
+  if (nregs > PcCache::kRegs || nwords > PcCache::kWords) return;
+
+  // Value word behind each mOutRegsValues slot, in decode_record() order:
+  // every output but the base-update register, then that one.
+  const unsigned char* outs = regs + 2 + nin;
+  int at[PcCache::kWords];
+  size_t n = 0, w = 0;
+  int base = -1;
+  uint32_t hi_mask = 0;
+  for (uint8_t i = 0; i < nout; ++i) {
+    if (mInstr.mBaseUpdReg && *mInstr.mBaseUpdReg == outs[i]) {
+      base = int(w++);
+      continue;
+    }
+    at[n++] = int(w++);
+    if (!reg_is_int(outs[i])) {
+      if (!L.store) hi_mask |= 1u << w;
+      at[n++] = int(w++);
+    }
+  }
+  if (base >= 0) at[n++] = base;
+  if (w != nwords || n != mInstr.mOutRegsValues.size()) return;
+
+  uint8_t nz = 0;
+  for (uint32_t m = hi_mask; m; m &= m - 1) {
+    uint64_t v;
+    std::memcpy(&v, vals + 8 * __builtin_ctz(m), sizeof v);
+    nz += v != 0;
+  }
+
+  if (C.pool.size() + mTotalPieces > PcCache::kPool) C.clear();
+  const uint32_t first = uint32_t(C.pool.size());
+  const uint8_t reg_idx = mCrackRegIdx, val_idx = mCrackValIdx;
+  while (mProcessedPieces < mTotalPieces) {
+    db_t d;
+    PcCache::Piece t;
+    int v;
+    populateNewInstr(d, &v);
+    if (v >= int(n) || !PcCache::pack(d, v < 0 ? -1 : at[v], mInstr.mEffAddr, &t)) {
+      // leave pieces without a compact form to the long way
+      C.pool.resize(first);
+      mProcessedPieces = 0;
+      mCrackRegIdx = reg_idx;
+      mCrackValIdx = val_idx;
+      start_fp_reg = 0;
+      return;
+    }
+    C.pool.push_back(t);
+  }
+
+  uint64_t pc;
+  std::memcpy(&pc, p, sizeof pc);
+  PcCache::Entry& e = C.place(pc);
+  e.pc = pc;
+  e.hi_mask = hi_mask;
+  e.first = first;
+  e.pieces = mTotalPieces;
+  e.nz = nz;
+  e.cls = p[8];
+  e.nmem = uint8_t(nmem);
+  std::memcpy(e.mem, mem, nmem);
+  e.nregs = uint8_t(nregs);
+  std::memcpy(e.regs, regs, nregs);
+  e.nwords = uint8_t(nwords);
+
+  C.vals = vals;
+  mProcessedPieces = 0;
+  mTpl = first;
+}
+
+// ----------------------------------------------------------------------------
+// Verify mode: crack the record at 'p' the long way as well and compare
+// it with the pieces the hit would hand out.
+// ----------------------------------------------------------------------------
+static bool same_operand(const db_operand_t& a, const db_operand_t& b) {
+  return a.valid == b.valid && a.is_int == b.is_int
+      && a.log_reg == b.log_reg && a.value == b.value;
+}
+
+static bool same_piece(const db_t& a, const db_t& b) {
+  return a.insn_class == b.insn_class && a.pc == b.pc
+      && a.is_taken == b.is_taken && a.next_pc == b.next_pc
+      && same_operand(a.A, b.A) && same_operand(a.B, b.B)
+      && same_operand(a.C, b.C) && same_operand(a.D, b.D)
+      && a.is_load == b.is_load && a.is_store == b.is_store
+      && a.addr == b.addr && a.size == b.size
+      && a.is_last_piece == b.is_last_piece;
+}
+
+bool TraceReader::check_cached(const unsigned char* p){
+  PcCache& C = *mCache;
+  const uint8_t pieces = mTotalPieces;
+  const uint32_t tpl = mTpl;
+
+  FastSrc src{p};
+  mTpl = ~0u;
+  bool same = decode_record(src) && mTotalPieces == pieces;
+  C.check.resize(mTotalPieces);
+  for (db_t& d : C.check) populateNewInstr(d);
+
+  mTpl = tpl;
+  mProcessedPieces = 0;
+  for (uint8_t i = 0; same && i < pieces; ++i) {
+    db_t d;
+    next_piece(d);
+    same = same_piece(d, C.check[i]);
+  }
+  mProcessedPieces = 0;
+  if (same) return true;
+
+  mError = true;
+  std::fprintf(stderr, "-E: PC cache differs from a full decode at instr %llu"
+               " (pc 0x%llx)\n", (unsigned long long)nInstr,
+               (unsigned long long)mInstr.mPc);
+  return false;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+void TraceReader::next_piece(db_t& out){
+  if (mTpl == ~0u) { populateNewInstr(out); return; }
+
+  const PcCache::Piece& t = mCache->pool[mTpl + mProcessedPieces++];
+  PcCache::unpack(out.A, t, 0);
+  PcCache::unpack(out.B, t, 1);
+  PcCache::unpack(out.C, t, 2);
+  PcCache::unpack(out.D, t, 3);
+  if (t.word >= 0)
+    std::memcpy(&out.D.value, mCache->vals + 8 * t.word, sizeof out.D.value);
+  out.insn_class    = InstClass(t.cls);
+  out.pc            = mInstr.mPc;
+  out.is_taken      = mInstr.mTaken;
+  out.next_pc       = mInstr.mNextPc;
+  out.is_load       = t.load;
+  out.is_store      = t.store;
+  out.addr          = mInstr.mEffAddr + t.addr_off;
+  out.size          = t.size;
+  out.is_last_piece = t.last;
+}
+
+// ----------------------------------------------------------------------------
+// Fast path when a maximum-size record is contiguous in the current block;
+// the careful path only runs near block ends and at EOF.
+// ----------------------------------------------------------------------------
+bool TraceReader::readInstr(){
+  mInstr.reset();
+  start_fp_reg = 0;
+  mTpl = ~0u;
+  if (mError || nInstr >= mEnd) return false;
+
+  const unsigned char* p = nullptr;
+  size_t len;
+  bool ok;
+  if (rdr.contiguous(&p) >= kMaxRecordBytes) {
+    if (mCache && cached_record(p, &len)) {
+      if (mCache->verify && !check_cached(p)) return false;
+      ok = true;
+    } else {
+      FastSrc src{p};
+      ok = decode_record(src);
+      len = size_t(src.p - p);
+      if (ok && mCache) cache_record(p, len);
+    }
+    if (ok) rdr.consume(len);
+  } else {
+    if (!rdr.peek(1)) {               // EOF on a record boundary
+      if (rdr.failed()) return bad_record();  // ... unless the source broke
+      return false;
+    }
+    SafeSrc src{*this};
+    ok = decode_record(src);
+  }
+
+  if (!ok) return bad_record();
 
   nInstr++;
-  if (nInstr % 5000000ULL == 0) std::cout << nInstr << " instrs " << std::endl;
+  if (nInstr % 5000000ULL == 0 && !mQuiet)
+    std::cout << nInstr << " instrs " << std::endl;
   return true;
 }
+
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+bool TraceReader::skipInstr(){
+  const unsigned char* p;
+  size_t n;
+  return rawInstr(&p, &n);
+}
+
+// ----------------------------------------------------------------------------
+// Same split as readInstr(); near block ends the record is peeked whole
+// rather than consumed field by field, so its bytes can be handed out.
+// ----------------------------------------------------------------------------
+bool TraceReader::rawInstr(const unsigned char** p, size_t* n){
+  if (mError || nInstr >= mEnd) return false;
+
+  bool ok;
+  if (rdr.contiguous(p) >= kMaxRecordBytes) {
+    FastSrc src{*p};
+    ok = skip_record(src);
+    *n = size_t(src.p - *p);
+  } else {
+    if (!rdr.peek(1)) {
+      if (rdr.failed()) return bad_record();
+      return false;
+    }
+    PeekSrc src{rdr};
+    ok = skip_record(src);
+    *p = src.p;
+    *n = src.k;
+  }
+  if (!ok) return bad_record();
+  rdr.consume(*n);
+
+  nInstr++;
+  if (nInstr % 5000000ULL == 0 && !mQuiet)
+    std::cout << nInstr << " instrs " << std::endl;
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+bool TraceReader::bad_record(){
+  mError = true;
+  const bool unreadable = !mBadClass && rdr.failed();
+  std::fprintf(stderr, "-E: %s record after %llu instrs%s%s\n",
+               mBadClass     ? "corrupt (bad class byte)"
+             : unreadable    ? "unreadable"
+                             : "truncated",
+               (unsigned long long)nInstr,
+               unreadable && !rdr.error().empty() ? ": " : "",
+               unreadable ? rdr.error().c_str() : "");
+  return false;
+}
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+bool TraceReader::get_inst(db_t& out){
+  if (mProcessedPieces == mTotalPieces && !readInstr()) return false;
+  next_piece(out);
+  return true;
+}
+
 // ----------------------------------------------------------------------------
 // ----------------------------------------------------------------------------
 db_t* TraceReader::get_inst(){
-  if (mProcessedPieces != mTotalPieces) return populateNewInstr();
-  else if (readInstr())                 return populateNewInstr();
-  else                                  return nullptr;
+  db_t* inst = new db_t();
+  if (get_inst(*inst)) return inst;
+  delete inst;
+  return nullptr;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+size_t TraceReader::get_batch(db_t* out, size_t cap){
+  size_t n = 0;
+  while (n < cap) {
+    if (mProcessedPieces == mTotalPieces && !readInstr()) break;
+    next_piece(out[n++]);
+  }
+  return n;
 }
 
+// ----------------------------------------------------------------------------
+// The index is optional: a missing default sidecar is silent, anything
+// else that cannot be used is reported and ignored. A .cbpc trace
+// without one is indexed by its own footer.
+// ----------------------------------------------------------------------------
+void TraceReader::load_index(){
+  mIndexTried = true;
+  if (mPath.empty()) return;
+
+  std::string err;
+  const bool explicit_idx = !mOpts.index.empty();
+  const std::string idx = explicit_idx ? mOpts.index
+                                       : TraceIndex::sidecar(mPath);
+  if (!explicit_idx) {
+    FILE* f = std::fopen(idx.c_str(), "rb");
+    if (!f) {
+      auto ti = std::make_shared<TraceIndex>();
+      if (cbpc::sniff(mPath) && ti->build(mPath, 0, &err, false))
+        mIndex = std::move(ti);
+      return;
+    }
+    std::fclose(f);
+  }
+
+  auto ti = std::make_shared<TraceIndex>();
+  if (ti->load(idx, mPath, &err)) mIndex = std::move(ti);
+  else std::fprintf(stderr, "-W: ignoring index: %s\n", err.c_str());
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+bool TraceReader::seek(uint64_t n){
+  if (mError) return false;
+  if (!mIndexTried) load_index();
+
+  const TraceIndex::Checkpoint* cp = mIndex ? mIndex->find(n) : nullptr;
+  const bool behind = n < nInstr;
+
+  if (cp && (behind || cp->instr > nInstr)) {
+    std::string err;
+    unsigned threads = mOpts.decomp_threads;
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    std::unique_ptr<BlockSource> src = mIndex->open_at(mPath, *cp, threads, &err);
+    if (!src || !rdr.open(std::move(src), cp->at.uoff, mOpts.prefetch)
+        || rdr.skip(cp->skip) != cp->skip) {
+      std::fprintf(stderr, "-E: seek to instr %llu: %s\n",
+                   (unsigned long long)n, err.c_str());
+      mError = true;
+      return false;
+    }
+    nInstr = cp->instr;
+  } else if (behind) {
+    if (mPath.empty() || !rdr.open(mPath, mOpts)) { mError = true; return false; }
+    nInstr = 0;
+  }
+
+  // drop whatever pieces were left of the current instruction
+  mProcessedPieces = mTotalPieces = 0;
+  while (nInstr < n) {
+    if (!skipInstr()) return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+bool TraceReader::set_window(uint64_t first, uint64_t end){
+  mEnd = ~0ULL;
+  const bool ok = (first == 0) || seek(first);
+  mEnd = end;
+  return ok;
+}
@@ -7,18 +7,31 @@ void usage(const char* a0)
 R"(
   Usage:
        %s --in <INPUT> [--out <OUTPUT>] [--limit N] [-h|--help]
+          [--skip N | --range A:B] [--threads N] [--decomp-threads N]
+          [--index FILE] [--huge-pages] [--backend native|libarchive]
+          [--format-threads N] [--level N] [--compress-threads N]
+          [--io-uring] [--pc-cache on|off|verify] [--memh-sidecars]
+       %s --build-index <TRACE> [--out FILE] [--index-span MiB]
 
   ---------------------------------------------------------------------
   Operations are auto mode by file extension:
     • If INPUT looks like JSON/NDJSON (.json / .jsonl, 
       optionally .gz/.xz/.bz2/.zst or inside .tar.*):
 
-        Read NDJSON lines  →  write human-readable text (sample-style).
+        Read NDJSON lines  →  write text, asm or NDJSON, like a CBP
+        trace would be (one record per line, see NDJSON below).
+
+    • If INPUT is CBP text (.txt, optionally compressed or in .tar.*):
+
+        Read text lines  →  write text, asm or NDJSON. Lines with the
+        same PC in a row are taken as pieces of one instruction.
 
     • Otherwise (e.g., .cbp or any non-JSON binary stream,
       optionally compressed or in .tar.*):
 
-        Read CBP binary trace  →  write NDJSON (one JSON object per line).
+        Read CBP binary trace  →  write text, asm, NDJSON, memh or
+        CBP.
+        A .cbpc file (columnar CBP, see below) is read the same way.
 
   ---------------------------------------------------------------------
   Supported inputs (decompressed transparently):
@@ -26,23 +39,71 @@ R"(
     Raw streams:          .gz, .xz, .bz2, .zst, or uncompressed files
     Formats:
       - CBP binary trace (default path when not JSON/NDJSON)
+      - Columnar CBP (.cbpc), recognized by its magic bytes
       - NDJSON (when INPUT extension indicates .json or .jsonl)
+      - CBP text (when INPUT extension indicates .txt), as written by
+        this tool or in the CBP2025 sample form with ( tkn:1 tar: 0x..)
 
   ---------------------------------------------------------------------
   Supported outputs (chosen by OUTPUT extension; stdout if --out omitted):
     Text (sample-style):  .txt   (plain file)
     NDJSON:               .jsonl or .json
+    Assembly:             .asm
+    Verilog $readmemh:    .memh
+    CBP binary:           .cbp or no format extension
+    Columnar CBP:         .cbpc  (plain file; compressed already)
     Compression (optional): append .gz / .xz / .bz2 / .zst
-    Tar container (single entry "trace.jsonl" for NDJSON, "trace.txt" for text):
-                          .tar, .tar.gz, .tar.xz, .tar.bz2, .tar.zst
+
+  ---------------------------------------------------------------------
+  CBP outputs:
+    From a CBP input the records are copied, not decoded: the whole
+    trace byte for byte (a recompression, e.g. .gz → .zst), or the
+    --skip/--range window record by record. --limit, and every other
+    input, go through the encoder, which writes one record per
+    instruction; --limit is then rounded up to a whole instruction.
+    Pieces no CBP record cracks into (mixed classes, a memory op
+    without a size or over 255 bytes, a store size that does not split
+    over its values) stop the conversion at that file:line.
+
+  ---------------------------------------------------------------------
+  Columnar CBP (.cbpc):
+    The CBP records split into per-field streams (PCs, shapes, branch
+    outcomes, addresses, values), each predicted from the last record
+    at the same PC and zstd-compressed (deflate in builds without
+    libzstd; --level picks the level, default 19). Blocks of 1M
+    instructions decode on their own and a footer indexes them, so
+    --skip/--range and --threads seek without a separate index.
+    Converting back to .cbp gives the original records byte for byte.
+
+  ---------------------------------------------------------------------
+  $readmemh (.memh):
+    One 32-bit RISC-V machine word per piece, 8 hex digits a line: the
+    instruction the asm output would show, encoded directly. With
+    --memh-sidecars, <stem>.ea.memh and <stem>.val.memh get the
+    piece's effective address and output value (16 hex digits, 0 when
+    absent) on the matching line.
 
   ---------------------------------------------------------------------
   Decision rule:
     INPUT is considered JSON/NDJSON if its name ends with:
       .json, .jsonl, .json.gz, .jsonl.gz, .json.xz, .jsonl.xz,
-      .json.bz2, .jsonl.bz2, .json.zst, .jsonl.zst, or inside .tar.* with those.
+      .json.bz2, .jsonl.bz2, .json.zst, .jsonl.zst, or a tar of one
+      named like .jsonl.tar.gz.
+    INPUT is CBP text if its name ends with .txt, with the same
+    compression and tar suffixes.
     Otherwise it’s treated as a CBP binary trace.
 
+  ---------------------------------------------------------------------
+  NDJSON records (one piece per line):
+    {"pc":"0x..","type":"loadOp","ea":"0x..","size":8,
+     "taken":true,"target":"0x..",
+     "A":{"bank":1,"idx":5,"val":"0x.."},"B":..,"C":..,"D":..,
+     "last":false}
+    ea/size for loads and stores, taken/target for branches, A-C inputs
+    and D output when present; bank 1 = integer, 2 = fp. "last":false
+    marks a piece that is not the last of its instruction. On input,
+    keys may come in any order and numbers may also be decimal.
+
   ---------------------------------------------------------------------
   Examples:
     # Full circle:
@@ -52,6 +113,9 @@ R"(
       # 2) NDJSON → human-readable text (compressed input; plain text output)
       %s --in output/sample.jsonl.gz --out output/sample.txt
 
+    # Recompress a trace without decoding it
+      %s --in traces/int_trace.gz --out output/int_trace.zst
+
     # Stream to stdout (useful for piping):
       %s --in traces/sample_int_trace.gz | gzip -9 > output/sample.jsonl.gz
       %s --in output/sample.jsonl.gz | head
@@ -59,14 +123,70 @@ R"(
     # Limit processing (first N records/pieces)
       %s --in traces/sample_int_trace.gz --out output/sample.jsonl --limit 1000
 
+  ---------------------------------------------------------------------
+  Options:
+    --skip N             Start at instruction N (0-based). Skipped records
+                         are stepped over without decoding; with an index
+                         the reader first jumps to the nearest checkpoint.
+    --range A:B          Instructions [A, B); "A:" runs to the end.
+                         --limit still caps the pieces written.
+    --threads N          Convert N contiguous shards in parallel and join
+                         them in order (1 = serial [default], 0 = one per
+                         core). Uses the trace's index, or a quick
+                         pre-scan without one. Ignored with --limit and
+                         for tar inputs.
+    --decomp-threads N   Threads for block-parallel decoding of raw
+                         multi-block .xz and .bz2 inputs (0 = one per
+                         core [default], 1 = serial).
+    --huge-pages         Ask for huge pages on the mapping of an
+                         uncompressed trace (.cbp or no extension; those
+                         are read straight from an mmap).
+    --backend B          Decompressor for bare .gz/.xz/.bz2/.zst inputs:
+                         "native" (zlib/liblzma/libbz2/libzstd, picked
+                         by magic bytes) [default] or "libarchive".
+                         Tar inputs always use libarchive.
+    --pc-cache M         CBP decode cache keyed by PC: "off" [default]
+                         cracks every record, "on" cracks each static
+                         instruction once and reuses its pieces, "verify"
+                         does both and stops at the first difference.
+    --format-threads N   Render text/asm/NDJSON lines on N threads while the
+                         trace is decoded on one; batches are written in
+                         order, so the output is unchanged (1 = in line
+                         [default], 0 = one per core). Not used when
+                         converting in shards (--threads).
+    --level N            Output compression level (defaults: gz 6, xz 6,
+                         bz2 9, zst 3).
+    --compress-threads N Threads compressing the output (1 [default],
+                         0 = one per core). With more than one, .gz/.bz2
+                         are written as concatenated members/streams,
+                         .xz/.zst with the libraries' multithreaded
+                         encoders; .xz threads are capped to fit a
+                         quarter of RAM. The bytes depend only on
+                         whether N is 1, not on N or the host.
+    --io-uring           Submit output writes through io_uring rather
+                         than a writer thread. Plain files only; falls
+                         back to the thread where io_uring is missing.
+    --memh-sidecars      With a .memh output, also write the EA and
+                         value sidecars, compressed like the output.
+                         They are written serially in one pass.
+    --build-index TRACE  Decode TRACE once and write a checkpoint index
+                         (TRACE.cbpidx, or --out) for random access.
+                         Works on raw, .gz, .xz, .bz2 and .zst traces;
+                         .xz/.zst restart only at block/frame starts.
+    --index-span MiB     Decoded bytes between checkpoints (default 16).
+    --index FILE         Index to seek with (default <INPUT>.cbpidx when
+                         present and current).
+
   ---------------------------------------------------------------------
   Notes:
     • Large files supported; reading and writing are fully streaming.
-    • For non-tar compressed outputs (.gz/.xz/.bz2/.zst), 
-      external compressors are used (gzip/xz/bzip2/zstd).
-    • Tar outputs are built via libarchive and contain a single file:
-      NDJSON → trace.jsonl,  Text → trace.txt
+    • Output is written in 4 MiB blocks, double-buffered, so formatting
+      does not wait on the file system; plain outputs of a known size
+      (--limit, --range or an index) are preallocated.
+    • Compressed outputs (.gz/.xz/.bz2/.zst) are compressed in-process
+      (zlib/liblzma/libbz2/libzstd) on separate threads. Tar outputs are
+      not supported.
 )",
-    a0,a0,a0,a0,a0,a0);
+    a0,a0,a0,a0,a0,a0,a0,a0);
 }
 
@@ -6,7 +6,7 @@ import subprocess
 import tempfile
 from pathlib import Path
 
-TOOL = Path("./bin/trace2json")
+TOOL = Path("./bin/cbp_conv")
 
 def run_cmd(args, **kwargs):
     """Run a command and return (rc, stdout, stderr)."""
@@ -16,7 +16,7 @@ def run_cmd(args, **kwargs):
 
 def test_json_to_text_roundtrip_tmpdir():
     """NDJSON (.gz) -> text (.txt). Always runs with a tiny synthetic sample."""
-    assert TOOL.exists(), "trace2json binary not found; did build fail?"
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
 
     with tempfile.TemporaryDirectory() as td:
         td = Path(td)
@@ -70,7 +70,7 @@ def test_cbp_to_ndjson_if_sample_exists():
         import pytest
         pytest.skip("Sample CBP trace not present in repo (traces/sample_int_trace.gz); skipping.")
 
-    assert TOOL.exists(), "trace2json binary not found; did build fail?"
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
     with tempfile.TemporaryDirectory() as td:
         td = Path(td)
         out_path = td / "out.jsonl"
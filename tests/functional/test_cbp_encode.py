@@ -0,0 +1,64 @@
+import json
+import subprocess
+import tempfile
+from pathlib import Path
+
+import pytest
+
+pytestmark = pytest.mark.functional
+
+TOOL = Path("./bin/cbp_conv")
+TRACE = Path("./traces/int_trace.gz")
+
+
+def run_cmd(args):
+    """Run a command and return (rc, stdout, stderr)."""
+    proc = subprocess.run(args, capture_output=True, text=True)
+    return proc.returncode, proc.stdout, proc.stderr
+
+
+def convert(src, dst, *extra):
+    rc, _, err = run_cmd([str(TOOL), "--in", str(src), "--out", str(dst),
+                          *extra])
+    assert rc == 0, f"{Path(src).name} -> {Path(dst).name} failed: {err}"
+
+
+def test_text_and_ndjson_encode_to_cbp():
+    """.txt and .jsonl -> .cbp re-encode the records the text describes."""
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+
+    with tempfile.TemporaryDirectory() as td:
+        td = Path(td)
+        ref_txt = td / "ref.txt"
+        convert(TRACE, ref_txt, "--limit", "20000")
+        ref_jsonl = td / "ref.jsonl"
+        convert(TRACE, ref_jsonl, "--limit", "20000")
+
+        from_txt = td / "from_txt.cbp"
+        convert(ref_txt, from_txt)
+        from_jsonl = td / "from_jsonl.cbp"
+        convert(ref_jsonl, from_jsonl)
+        assert from_txt.read_bytes() == from_jsonl.read_bytes()
+
+        back = td / "back.txt"
+        convert(from_txt, back)
+        assert back.read_text() == ref_txt.read_text()
+
+
+def test_cbp_rejects_unencodable_piece_group():
+    """A piece group CBP cannot hold fails naming the offending line."""
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+
+    with tempfile.TemporaryDirectory() as td:
+        td = Path(td)
+        # two pieces of one instruction with different classes
+        src = td / "mixed.jsonl"
+        src.write_text(
+            json.dumps({"pc": "0x1000", "type": "aluOp",
+                        "last": False}) + "\n" +
+            json.dumps({"pc": "0x1000", "type": "loadOp",
+                        "ea": "0x2000", "size": 8}) + "\n")
+        rc, _, err = run_cmd([str(TOOL), "--in", str(src),
+                              "--out", str(td / "mixed.cbp")])
+        assert rc != 0
+        assert f"{src}:2: cannot encode as CBP" in err
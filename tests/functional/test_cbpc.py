@@ -0,0 +1,38 @@
+import gzip
+import subprocess
+import tempfile
+from pathlib import Path
+
+import pytest
+
+pytestmark = pytest.mark.functional
+
+TOOL = Path("./bin/cbp_conv")
+TRACE = Path("./traces/int_trace.gz")
+
+
+def run_cmd(args):
+    """Run a command and return (rc, stdout, stderr)."""
+    proc = subprocess.run(args, capture_output=True, text=True)
+    return proc.returncode, proc.stdout, proc.stderr
+
+
+def convert(src, dst, *extra):
+    rc, _, err = run_cmd([str(TOOL), "--in", str(src), "--out", str(dst),
+                          *extra])
+    assert rc == 0, f"{Path(src).name} -> {Path(dst).name} failed: {err}"
+
+
+def test_cbpc_round_trip_is_byte_identical():
+    """.cbp -> .cbpc -> .cbp gives back the original records byte for byte."""
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+
+    with tempfile.TemporaryDirectory() as td:
+        td = Path(td)
+        cbpc = td / "int.cbpc"
+        convert(TRACE, cbpc)
+        back = td / "int.cbp"
+        convert(cbpc, back)
+
+        with gzip.open(TRACE, "rb") as f:
+            assert back.read_bytes() == f.read()
@@ -0,0 +1,36 @@
+import subprocess
+import tempfile
+from pathlib import Path
+
+import pytest
+
+pytestmark = pytest.mark.functional
+
+TOOL = Path("./bin/cbp_conv")
+TRACE = Path("./traces/int_trace.gz")
+
+
+def convert(src, dst, *extra):
+    proc = subprocess.run([str(TOOL), "--in", str(src), "--out", str(dst),
+                           *extra], capture_output=True, text=True)
+    assert proc.returncode == 0, f"-> {Path(dst).name} failed: {proc.stderr}"
+
+
+@pytest.mark.parametrize("ext", ["gz", "bz2", "xz"])
+def test_parallel_compression_ignores_write_pattern(ext):
+    """--compress-threads output is the same whatever the thread count or
+    how the formatter hands over its bytes."""
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+
+    with tempfile.TemporaryDirectory() as td:
+        td = Path(td)
+        outs = []
+        for i, extra in enumerate([
+                ("--compress-threads", "4"),
+                ("--compress-threads", "4", "--format-threads", "3"),
+                ("--compress-threads", "2", "--format-threads", "0"),
+                ("--compress-threads", "0")]):
+            out = td / f"t{i}.txt.{ext}"
+            convert(TRACE, out, "--limit", "300000", *extra)
+            outs.append(out.read_bytes())
+        assert all(o == outs[0] for o in outs[1:])
@@ -0,0 +1,48 @@
+import bz2
+import gzip
+import lzma
+import subprocess
+import tempfile
+from pathlib import Path
+
+import pytest
+
+pytestmark = pytest.mark.functional
+
+TOOL = Path("./bin/cbp_conv")
+TRACE = Path("./traces/int_trace.gz")
+LIMIT = "200000"
+
+DECOMPRESS = {".gz": gzip.decompress, ".xz": lzma.decompress,
+              ".bz2": bz2.decompress}
+
+
+def run_cmd(args):
+    """Run a command and return (rc, stdout, stderr)."""
+    proc = subprocess.run(args, capture_output=True, text=True)
+    return proc.returncode, proc.stdout, proc.stderr
+
+
+def convert(src, dst, *extra):
+    rc, _, err = run_cmd([str(TOOL), "--in", str(src), "--out", str(dst),
+                          *extra])
+    assert rc == 0, f"{Path(src).name} -> {Path(dst).name} failed: {err}"
+    return Path(dst).read_bytes()
+
+
+@pytest.mark.parametrize("ext", [".gz", ".xz", ".bz2"])
+def test_compressed_output_decodes_to_plain(ext):
+    """x.txt<ext> decompresses to the bytes of x.txt."""
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+
+    with tempfile.TemporaryDirectory() as td:
+        td = Path(td)
+        plain = convert(TRACE, td / "plain.txt", "--limit", LIMIT)
+        assert plain
+
+        # one stream, then parallel chunks/members
+        for threads in ("1", "4"):
+            packed = convert(TRACE, td / f"out{threads}.txt{ext}",
+                             "--limit", LIMIT, "--compress-threads", threads)
+            assert packed != plain
+            assert DECOMPRESS[ext](packed) == plain, f"{threads} threads"
@@ -0,0 +1,62 @@
+import json
+import re
+import subprocess
+import tempfile
+from pathlib import Path
+
+import pytest
+
+pytestmark = pytest.mark.functional
+
+TOOL = Path("./bin/cbp_conv")
+TRACE = Path("./traces/int_trace.gz")
+LIMIT = "20000"
+
+
+def run_cmd(args):
+    """Run a command and return (rc, stdout, stderr)."""
+    proc = subprocess.run(args, capture_output=True, text=True)
+    return proc.returncode, proc.stdout, proc.stderr
+
+
+def convert(src, dst, *extra):
+    rc, _, err = run_cmd([str(TOOL), "--in", str(src), "--out", str(dst),
+                          *extra])
+    assert rc == 0, f"{Path(src).name} -> {Path(dst).name} failed: {err}"
+    return Path(dst).read_text()
+
+
+def test_memh_sidecars_line_up_with_words():
+    """Line i of each sidecar belongs to the word on line i of the .memh."""
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+
+    with tempfile.TemporaryDirectory() as td:
+        td = Path(td)
+        plain = convert(TRACE, td / "plain.memh", "--limit", LIMIT)
+        words = convert(TRACE, td / "t.memh", "--limit", LIMIT,
+                        "--memh-sidecars").splitlines()
+        eas = (td / "t.ea.memh").read_text().splitlines()
+        vals = (td / "t.val.memh").read_text().splitlines()
+        recs = [json.loads(l) for l in
+                convert(TRACE, td / "t.jsonl", "--limit", LIMIT).splitlines()]
+
+        # the sidecars do not change the words
+        assert plain.splitlines() == words
+
+        assert len(words) == int(LIMIT)
+        assert len(eas) == len(words)
+        assert len(vals) == len(words)
+        assert len(recs) == len(words)
+
+        mem = 0
+        for i, (word, ea, val, rec) in enumerate(zip(words, eas, vals, recs)):
+            assert re.fullmatch(r"[0-9a-f]{8}", word), f"line {i + 1}: {word}"
+            assert re.fullmatch(r"[0-9a-f]{16}", ea), f"line {i + 1}: {ea}"
+            assert re.fullmatch(r"[0-9a-f]{16}", val), f"line {i + 1}: {val}"
+
+            want_ea = int(rec["ea"], 16) if "ea" in rec else 0
+            want_val = int(rec["D"]["val"], 16) if "D" in rec else 0
+            assert int(ea, 16) == want_ea, f"line {i + 1}: {rec}"
+            assert int(val, 16) == want_val, f"line {i + 1}: {rec}"
+            mem += rec["type"] in ("loadOp", "storeOp")
+        assert mem
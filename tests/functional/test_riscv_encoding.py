@@ -0,0 +1,83 @@
+import json
+import subprocess
+import tempfile
+from pathlib import Path
+
+import pytest
+
+pytestmark = pytest.mark.functional
+
+TOOL = Path("./bin/cbp_conv")
+
+# One piece per instruction form the README rules produce, the standard
+# assembly for what the asm output prints for it, and the word
+# llvm-mc -triple=riscv64 -mattr=+m,+experimental-zbt assembles it to.
+CASES = [
+    ({"pc": "0x80002af0", "type": "aluOp"},
+     "fence.i", 0x0000100f),
+    ({"pc": "0x80002aec", "type": "aluOp", "A": {"bank": 1, "idx": 8, "val": "0x0"}},
+     "add x1,x8,x0", 0x000400b3),
+    ({"pc": "0x3ba768", "type": "aluOp", "A": {"bank": 1, "idx": 10, "val": "0x0"}, "D": {"bank": 1, "idx": 64, "val": "0x6"}},
+     "add x31,x10,x0", 0x00050fb3),
+    ({"pc": "0x41df08", "type": "aluOp", "A": {"bank": 1, "idx": 8, "val": "0x0"}, "B": {"bank": 1, "idx": 19, "val": "0x0"}, "D": {"bank": 1, "idx": 64, "val": "0x6"}},
+     "add x31,x8,x19", 0x01340fb3),
+    ({"pc": "0x8000055c", "type": "aluOp", "A": {"bank": 1, "idx": 5, "val": "0x0"}, "B": {"bank": 1, "idx": 6, "val": "0x0"}, "C": {"bank": 1, "idx": 7, "val": "0x0"}, "D": {"bank": 1, "idx": 9, "val": "0x0"}},
+     "fsl x9,x5,x6,x7", 0x347294b3),
+    ({"pc": "0x8000055c", "type": "aluOp", "A": {"bank": 1, "idx": 64, "val": "0x0"}, "B": {"bank": 1, "idx": 0, "val": "0x0"}, "C": {"bank": 1, "idx": 1, "val": "0x0"}, "D": {"bank": 1, "idx": 0, "val": "0x0"}},
+     "fsl x1,x31,x0,x1", 0x041f90b3),
+    ({"pc": "0x3b8094", "type": "slowAluOp", "A": {"bank": 1, "idx": 8, "val": "0x0"}, "B": {"bank": 1, "idx": 11, "val": "0x0"}, "D": {"bank": 1, "idx": 8, "val": "0x5555a8"}},
+     "divu x0,x0,x0", 0x02005033),
+    ({"pc": "0x80000540", "type": "callDirBrOp", "taken": True, "target": "0x800019e4", "D": {"bank": 1, "idx": 30, "val": "0x80000544"}},
+     "jal x30, 0x14a4", 0x4a401f6f),
+    ({"pc": "0x41dbfc", "type": "callIndBrOp", "taken": True, "target": "0x3bcc18", "A": {"bank": 1, "idx": 8, "val": "0x0"}, "D": {"bank": 1, "idx": 30, "val": "0x41dc00"}},
+     "jalr x30, x8, 0", 0x00040f67),
+    ({"pc": "0x40e530", "type": "condBrOp", "taken": True, "target": "0x40e538", "A": {"bank": 1, "idx": 0, "val": "0x0"}},
+     "beq x0,x0,8", 0x00000463),
+    ({"pc": "0x1000", "type": "condBrOp", "taken": True, "target": "0xff0", "A": {"bank": 1, "idx": 0, "val": "0x0"}},
+     "beq x0,x0,-16", 0xfe0008e3),
+    ({"pc": "0x3bd3cc", "type": "condBrOp", "taken": False, "target": "0x3bd3d0", "A": {"bank": 1, "idx": 26, "val": "0x0"}},
+     "bne x0,x0,0", 0x00001063),
+    ({"pc": "0x40c690", "type": "retBrOp", "taken": True, "target": "0x3bd028", "A": {"bank": 1, "idx": 30, "val": "0x0"}},
+     "jalr x0, x30, 0", 0x000f0067),
+    ({"pc": "0x41defc", "type": "uncondDirBrOp", "taken": True, "target": "0x41df10"},
+     "jal x0,0x14", 0x0140006f),
+    ({"pc": "0x41000", "type": "uncondDirBrOp", "taken": True, "target": "0x40800"},
+     "jal x0,-2048", 0x801ff06f),
+    ({"pc": "0x41df84", "type": "uncondIndBrOp", "taken": True, "target": "0x41df00", "A": {"bank": 1, "idx": 11, "val": "0x0"}},
+     "jalr x0,x11,-132", 0xf7c58067),
+    ({"pc": "0x3b7604", "type": "loadOp", "ea": "0x895b13", "size": 1, "A": {"bank": 1, "idx": 8, "val": "0x0"}, "D": {"bank": 1, "idx": 9, "val": "0x0"}},
+     "lbu x0, 0(x0)", 0x00004003),
+    ({"pc": "0x3ba764", "type": "loadOp", "ea": "0x895a30", "size": 2, "A": {"bank": 1, "idx": 9, "val": "0x0"}, "D": {"bank": 1, "idx": 9, "val": "0x4630"}},
+     "lhu x0, 0(x0)", 0x00005003),
+    ({"pc": "0x3b74fc", "type": "loadOp", "ea": "0x554070", "size": 4, "A": {"bank": 1, "idx": 8, "val": "0x0"}, "D": {"bank": 1, "idx": 8, "val": "0x2"}},
+     "lwu x0, 0(x0)", 0x00006003),
+    ({"pc": "0x80002af8", "type": "loadOp", "ea": "0x800085d0", "size": 8, "A": {"bank": 1, "idx": 31, "val": "0x0"}, "D": {"bank": 1, "idx": 30, "val": "0x80002b38"}},
+     "ld x0, 0(x0)", 0x00003003),
+    ({"pc": "0x3b74dc", "type": "stOp", "ea": "0x54d909", "size": 1, "A": {"bank": 1, "idx": 10, "val": "0x0"}, "B": {"bank": 1, "idx": 65, "val": "0x0"}},
+     "sb x31,0(x10)", 0x01f50023),
+    ({"pc": "0x3b74dc", "type": "stOp", "ea": "0x54d909", "size": 2, "A": {"bank": 1, "idx": 10, "val": "0x0"}, "B": {"bank": 1, "idx": 13, "val": "0x0"}},
+     "sh x13,0(x10)", 0x00d51023),
+    ({"pc": "0x3aabe0", "type": "stOp", "ea": "0x554070", "size": 4, "A": {"bank": 1, "idx": 8, "val": "0x0"}, "B": {"bank": 1, "idx": 12, "val": "0x0"}},
+     "sw x12,0(x8)", 0x00c42023),
+    ({"pc": "0x3ba808", "type": "stOp", "ea": "0x8934f8", "size": 8, "A": {"bank": 1, "idx": 10, "val": "0x0"}, "B": {"bank": 1, "idx": 8, "val": "0x0"}},
+     "sd x8,0(x10)", 0x00853023),
+]
+
+
+def test_memh_words_match_assembler():
+    """NDJSON -> .memh gives the assembler's word for every form."""
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+
+    with tempfile.TemporaryDirectory() as td:
+        td = Path(td)
+        src = td / "forms.jsonl"
+        src.write_text("".join(json.dumps(c) + "\n" for c, _, _ in CASES))
+        out = td / "forms.memh"
+        proc = subprocess.run([str(TOOL), "--in", str(src), "--out", str(out)],
+                              capture_output=True, text=True)
+        assert proc.returncode == 0, f"jsonl->memh failed: {proc.stderr}"
+
+        got = [int(w, 16) for w in out.read_text().split()]
+        assert len(got) == len(CASES)
+        for (_, asm, want), word in zip(CASES, got):
+            assert word == want, f"{asm}: got {word:08x}, want {want:08x}"
@@ -0,0 +1,83 @@
+import subprocess
+import tempfile
+from pathlib import Path
+
+import pytest
+
+pytestmark = pytest.mark.functional
+
+TOOL = Path("./bin/cbp_conv")
+TRACE = Path("./traces/int_trace.gz")
+INSTRS = 50000   # instructions in the test trace
+CUT = 12345
+
+
+def run_cmd(args):
+    """Run a command and return (rc, stdout, stderr)."""
+    proc = subprocess.run(args, capture_output=True, text=True)
+    return proc.returncode, proc.stdout, proc.stderr
+
+
+def convert(src, dst, *extra):
+    rc, _, err = run_cmd([str(TOOL), "--in", str(src), "--out", str(dst),
+                          *extra])
+    assert rc == 0, f"{Path(src).name} -> {Path(dst).name} failed: {err}"
+    return Path(dst).read_bytes()
+
+
+def make_small(td):
+    """Cut the first INSTRS instructions of int_trace into td."""
+    path = Path(td) / "small.cbp.gz"
+    convert(TRACE, path, "--range", f"0:{INSTRS}")
+    return path
+
+
+def test_ranges_concatenate_to_full_output():
+    """--range 0:N then --range N: is the whole trace."""
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+
+    with tempfile.TemporaryDirectory() as td:
+        td = Path(td)
+        small_trace = make_small(td)
+        full = convert(small_trace, td / "full.txt")
+        head = convert(small_trace, td / "head.txt", "--range", f"0:{CUT}")
+        tail = convert(small_trace, td / "tail.txt", "--range", f"{CUT}:")
+        assert head and tail
+        assert head + tail == full
+
+
+def test_skip_equals_open_range():
+    """--skip N is --range N:."""
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+
+    with tempfile.TemporaryDirectory() as td:
+        td = Path(td)
+        small_trace = make_small(td)
+        skip = convert(small_trace, td / "skip.txt", "--skip", str(CUT))
+        rng = convert(small_trace, td / "range.txt", "--range", f"{CUT}:")
+        assert skip == rng
+
+
+def test_skip_and_range_are_exclusive():
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+
+    with tempfile.TemporaryDirectory() as td:
+        small_trace = make_small(td)
+        rc, _, err = run_cmd([str(TOOL), "--in", str(small_trace),
+                              "--out", str(Path(td) / "x.txt"),
+                              "--skip", "10", "--range", "20:30"])
+        assert rc != 0
+        assert "--skip and --range are exclusive" in err
+
+
+@pytest.mark.parametrize("rng", ["30:30", "30:20", "30", ":30", "a:b"])
+def test_bad_range_is_rejected(rng):
+    """A:B needs A < B; anything else is a usage error."""
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+
+    with tempfile.TemporaryDirectory() as td:
+        rc, _, err = run_cmd([str(TOOL), "--in", str(TRACE),
+                              "--out", str(Path(td) / "x.txt"),
+                              "--range", rng])
+        assert rc != 0
+        assert "bad --range value" in err
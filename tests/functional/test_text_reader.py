@@ -0,0 +1,44 @@
+import subprocess
+import tempfile
+from pathlib import Path
+
+import pytest
+
+pytestmark = pytest.mark.functional
+
+TOOL = Path("./bin/cbp_conv")
+GOLDEN = Path("./golden/int_trace.txt")
+
+
+def run_cmd(args):
+    """Run a command and return (rc, stdout, stderr)."""
+    proc = subprocess.run(args, capture_output=True, text=True)
+    return proc.returncode, proc.stdout, proc.stderr
+
+
+def convert(src, dst, *extra):
+    rc, _, err = run_cmd([str(TOOL), "--in", str(src), "--out", str(dst),
+                          *extra])
+    assert rc == 0, f"{Path(src).name} -> {Path(dst).name} failed: {err}"
+    return Path(dst).read_bytes()
+
+
+def test_text_to_text_matches_golden():
+    """Parsing the golden text and printing it again changes nothing."""
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+    assert GOLDEN.exists(), "golden/int_trace.txt missing"
+
+    with tempfile.TemporaryDirectory() as td:
+        out = convert(GOLDEN, Path(td) / "round.txt")
+        assert out == GOLDEN.read_bytes()
+
+
+def test_text_through_cbp_matches_golden():
+    """golden .txt -> .cbp -> .txt is byte-identical."""
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+
+    with tempfile.TemporaryDirectory() as td:
+        td = Path(td)
+        convert(GOLDEN, td / "golden.cbp")
+        out = convert(td / "golden.cbp", td / "round.txt")
+        assert out == GOLDEN.read_bytes()
@@ -0,0 +1,96 @@
+import bz2
+import gzip
+import lzma
+import re
+import shutil
+import subprocess
+import tempfile
+from pathlib import Path
+
+import pytest
+
+pytestmark = pytest.mark.functional
+
+TOOL = Path("./bin/cbp_conv")
+TRACE = Path("./traces/int_trace.gz")
+INSTRS = 300000
+SKIPS = [0, 1, 54321, 150000, INSTRS - 7]
+
+
+def run_cmd(args):
+    """Run a command and return (rc, stdout, stderr)."""
+    proc = subprocess.run(args, capture_output=True, text=True)
+    return proc.returncode, proc.stdout, proc.stderr
+
+
+def convert(src, dst, *extra):
+    rc, _, err = run_cmd([str(TOOL), "--in", str(src), "--out", str(dst),
+                          *extra])
+    assert rc == 0, f"{Path(src).name} -> {Path(dst).name} failed: {err}"
+    assert "ignoring index" not in err, err
+    return Path(dst).read_bytes()
+
+
+def framed(pack, data, size=1 << 20):
+    """Concatenated .xz/.zst streams: those index at stream boundaries."""
+    return b"".join(pack(data[i:i + size])
+                    for i in range(0, len(data), size))
+
+
+def zstd(data):
+    return subprocess.run(["zstd", "-q", "-c"], input=data,
+                          capture_output=True, check=True).stdout
+
+
+def compress(raw, codec):
+    """Write raw.<codec> next to 'raw' and return its path."""
+    dst = raw.with_name(raw.name + "." + codec)
+    data = raw.read_bytes()
+    if codec == "gz":
+        dst.write_bytes(gzip.compress(data))
+    elif codec == "xz":
+        dst.write_bytes(framed(lzma.compress, data))
+    elif codec == "bz2":
+        dst.write_bytes(bz2.compress(data))
+    elif codec == "zst":
+        if not shutil.which("zstd"):
+            pytest.skip("zstd not installed")
+        dst.write_bytes(framed(zstd, data))
+    else:
+        return raw
+    return dst
+
+
+@pytest.mark.parametrize("codec", ["cbp", "gz", "xz", "bz2", "zst"])
+def test_index_seek_matches_linear_read(codec):
+    """--skip through an index reads what a linear --skip reads."""
+    assert TOOL.exists(), "cbp_conv binary not found; did build fail?"
+
+    with tempfile.TemporaryDirectory() as td:
+        td = Path(td)
+        raw = td / "s.cbp"
+        convert(TRACE, raw, "--range", f"0:{INSTRS}")
+        src = compress(raw, codec)
+
+        # the index goes elsewhere, so the linear reads do not find it
+        idx = td / "s.idx"
+        rc, _, err = run_cmd([str(TOOL), "--build-index", str(src),
+                              "--out", str(idx), "--index-span", "1"])
+        assert rc == 0, err
+        m = re.search(r"(\d+) checkpoints, (\d+) instrs", err)
+        assert m, err
+        assert int(m.group(1)) > 1
+        assert int(m.group(2)) == INSTRS
+
+        for n in SKIPS:
+            linear = convert(src, td / f"lin{n}.txt", "--skip", str(n))
+            seek = convert(src, td / f"idx{n}.txt", "--skip", str(n),
+                           "--index", str(idx))
+            assert linear
+            assert seek == linear, f"--skip {n}"
+
+        # a window that ends early, too
+        linear = convert(src, td / "lin.txt", "--range", "150001:150400")
+        seek = convert(src, td / "idx.txt", "--range", "150001:150400",
+                       "--index", str(idx))
+        assert seek == linear